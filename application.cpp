@@ -10,19 +10,28 @@
 
 
 
-Application::Application(const char* caption, int width, int height)
+Application::Application(const char* caption, int width, int height, bool headless)
 {
-	this->window = createWindow(caption, width, height);
-
-	int w, h;
-	SDL_GetWindowSize(window, &w, &h);
+	int w = width, h = height;
+	this->headless = headless;
+	if (headless) {
+		// Nothing is ever pressed
+		static const Uint8 no_keys[SDL_NUM_SCANCODES] = {};
+		this->keystate = no_keys;
+	}
+	else {
+		this->window = createWindow(caption, width, height);
+		SDL_GetWindowSize(window, &w, &h);
+		this->keystate = SDL_GetKeyboardState(nullptr);
+	}
 
 	this->mouse_state = 0;
 	this->time = 0.f;
 	this->window_width = w;
 	this->window_height = h;
-	this->keystate = SDL_GetKeyboardState(nullptr);
 
+	// 32-bit aligned rows for the framebuffer, fills and blits are much faster than with RGB8
+	this->framebuffer.SetFormat(Image::RGBX8);
 	this->framebuffer.Resize(w, h);
 
 
@@ -74,7 +83,42 @@ void Application::Render(void) {
 		particleSystem.Render(&framebuffer);
 	}
 
-	framebuffer.Render();
+	// The frame is presented by the render thread (see launchLoop)
+}
+
+void Application::Tick(float seconds_elapsed)
+{
+	double start = FrameTimer::Now();
+	Render();
+	double rendered = FrameTimer::Now();
+	time += seconds_elapsed;
+	Update(seconds_elapsed);
+	frame_timer.Record(FrameTimer::RENDER, rendered - start);
+	frame_timer.Record(FrameTimer::UPDATE, FrameTimer::Now() - rendered);
+	frame_timer.EndFrame();
+}
+
+void Application::SimulateKey(int key)
+{
+	SDL_KeyboardEvent event = {};
+	event.keysym.sym = key;
+	OnKeyPressed(event);
+}
+
+void Application::SimulateMouse(Uint32 type, int x, int y)
+{
+	SDL_MouseButtonEvent event = {};
+	event.type = type;
+	event.button = SDL_BUTTON_LEFT;
+	event.x = x;
+	event.y = y;
+	if (type == SDL_MOUSEBUTTONDOWN)
+		OnMouseButtonDown(event);
+	else if (type == SDL_MOUSEBUTTONUP)
+		OnMouseButtonUp(event);
+	else
+		OnMouseMove(event);
+	mouse_position.set(float(x), float(window_height - y));
 }
 
 
@@ -85,7 +129,10 @@ void Application::Update(float seconds_elapsed)
 	if (tecla == 1) {
 
 		framebuffer.Fill(Color(0, 0, 0));
-		framebuffer.DrawLineDDA(100, 100, 100 + 50 * cos(time), 100 + 50 * sin(time), Color::RED);
+		if (antialias)
+			framebuffer.DrawLineAA(100, 100, 100 + 50 * cos(time), 100 + 50 * sin(time), Color::RED);
+		else
+			framebuffer.DrawLineDDA(100, 100, 100 + 50 * cos(time), 100 + 50 * sin(time), Color::RED);
 
 	}
 
@@ -99,14 +146,20 @@ void Application::Update(float seconds_elapsed)
 	if (tecla == 3) {
 
 		framebuffer.Fill(Color(0, 0, 0));
-		framebuffer.DrawCircle(200, 400, 50, Color::PURPLE, borderWi, fillMode, Color::BLUE);
+		if (antialias)
+			framebuffer.DrawCircleAA(200, 400, 50, Color::PURPLE, borderWi, fillMode, Color::BLUE);
+		else
+			framebuffer.DrawCircle(200, 400, 50, Color::PURPLE, borderWi, fillMode, Color::BLUE);
 
 	}
 
 	if (tecla == 4) {
 
 		framebuffer.Fill(Color(0, 0, 0));
-		framebuffer.DrawTriangle(Vector2(500.0f, 500.0f), Vector2(200.0f, 100.0f), Vector2(500.0f, 100.0f), Color::RED, borderWi, fillMode, Color::BLUE);
+		if (antialias)
+			framebuffer.DrawTriangleAA(Vector2(500.0f, 500.0f), Vector2(200.0f, 100.0f), Vector2(500.0f, 100.0f), Color::RED, borderWi, fillMode, Color::BLUE);
+		else
+			framebuffer.DrawTriangle(Vector2(500.0f, 500.0f), Vector2(200.0f, 100.0f), Vector2(500.0f, 100.0f), Color::RED, borderWi, fillMode, Color::BLUE);
 	}
 
 	if (tecla == 5) {
@@ -161,7 +214,17 @@ void Application::OnKeyPressed(SDL_KeyboardEvent event)
 {
 	// KEY CODES: https://wiki.libsdl.org/SDL2/SDL_Keycode
 	switch (event.keysym.sym) {
-	case SDLK_ESCAPE: exit(0); break; // ESC key, kill the app
+	case SDLK_ESCAPE: // ESC key, kill the app
+		if (headless)
+			exit(0);
+		else {
+			// Handlers run on the simulation thread, the main thread owns SDL and has to stop the others first
+			SDL_Event quit;
+			SDL_zero(quit);
+			quit.type = SDL_QUIT;
+			SDL_PushEvent(&quit);
+		}
+		break;
 	case SDLK_1: tecla = 1; break;
 	case SDLK_2: tecla = 2; break;
 	case SDLK_3: tecla = 3; break;
@@ -172,6 +235,20 @@ void Application::OnKeyPressed(SDL_KeyboardEvent event)
 		if (fillMode) { fillMode = false; }
 		else { fillMode = true; }
 		break;
+	case SDLK_a: antialias = !antialias; break;
+
+	case SDLK_F1: {
+		// The overlay is not part of the framebuffer, marking its area makes sure a frame shows or hides it
+		int x, y;
+		frame_timer.show_hud = !frame_timer.show_hud;
+		FrameTimer::GetHUDPosition(framebuffer, x, y);
+		framebuffer.MarkDirty(x, y, FrameTimer::HUD_WIDTH, FrameTimer::HUD_HEIGHT);
+		break;
+	}
+	case SDLK_F2:
+		if (frame_timer.IsWritingCSV()) frame_timer.CloseCSV();
+		else if (!frame_timer.OpenCSV("frame_times.csv")) std::cerr << "Can't write frame_times.csv" << std::endl;
+		break;
 
 	case SDLK_PLUS: case SDLK_KP_PLUS: borderWi++; break;
 	case SDLK_MINUS: case SDLK_KP_MINUS:
@@ -239,12 +316,18 @@ void Application::OnMouseButtonDown(SDL_MouseButtonEvent event)
 			}
 		}
 		else if (lineButton.IsMouseInside(mousePosition)) {
-			framebuffer.DrawLineDDA(line_start.x, -line_start.y, line_end.x, -line_end.y, currentColor);
+			if (antialias)
+				framebuffer.DrawLineAA(line_start.x, -line_start.y, line_end.x, -line_end.y, currentColor);
+			else
+				framebuffer.DrawLineDDA(line_start.x, -line_start.y, line_end.x, -line_end.y, currentColor);
 		}
 		else if (circleButton.IsMouseInside(mousePosition)) {
 			float scale_factor = 1.2f;
 			float radius = sqrt(pow(line_end.x - line_start.x, 2) + pow(-(line_end.y - line_start.y), 2));
-			framebuffer.DrawCircle(line_start.x, -line_start.y, radius, currentColor, 2, fillMode, currentColor);
+			if (antialias)
+				framebuffer.DrawCircleAA(line_start.x, -line_start.y, radius, currentColor, 2, fillMode, currentColor);
+			else
+				framebuffer.DrawCircle(line_start.x, -line_start.y, radius, currentColor, 2, fillMode, currentColor);
 		}
 		else if (rectangleButton.IsMouseInside(mousePosition)) {
 			framebuffer.DrawRectUpdate(line_start.x, -line_start.y, line_end.x, -line_end.y, currentColor, 2, fillMode, currentColor);
@@ -252,7 +335,10 @@ void Application::OnMouseButtonDown(SDL_MouseButtonEvent event)
 
 		else if (triangleButton.IsMouseInside(mousePosition)) {
 
-			framebuffer.DrawTriangle(Vector2(line_end.x,-line_end.y), Vector2(line_end.x, -line_start.y), Vector2(line_start.x, -line_start.y), currentColor, 2,fillMode, currentColor);
+			if (antialias)
+				framebuffer.DrawTriangleAA(Vector2(line_end.x, -line_end.y), Vector2(line_end.x, -line_start.y), Vector2(line_start.x, -line_start.y), currentColor, 2, fillMode, currentColor);
+			else
+				framebuffer.DrawTriangle(Vector2(line_end.x,-line_end.y), Vector2(line_end.x, -line_start.y), Vector2(line_start.x, -line_start.y), currentColor, 2,fillMode, currentColor);
 		}
 
 		else if (eraserButton.IsMouseInside(mousePosition)) {
@@ -304,17 +390,7 @@ void Application::OnMouseMove(SDL_MouseButtonEvent event)
 			int erase_radius = 5; // Set your desired erase radius here
 
 			// Erase pixels in a square around the mouse position
-			for (int i = -erase_radius; i <= erase_radius; ++i) {
-				for (int j = -erase_radius; j <= erase_radius; ++j) {
-					int x = event.x + i;
-					int y = event.y + j - int(framebuffer.height);
-
-					// Check if the pixel is within the framebuffer bounds
-					if (x >= 0 && x < framebuffer.width && -y >= 0 && -y < framebuffer.height) {
-						framebuffer.SetPixel(x, -y, Color::BLACK);
-					}
-				}
-			}
+			framebuffer.FillRect(event.x - erase_radius, int(framebuffer.height) - event.y - erase_radius, 2 * erase_radius + 1, 2 * erase_radius + 1, Color::BLACK);
 		}
 
 
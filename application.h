@@ -7,6 +7,8 @@
 #include "main/includes.h"
 #include "framework.h"
 #include "image.h"
+#include "presenter.h"
+#include "frame_timer.h"
 
 class Application
 {
@@ -14,7 +16,8 @@ public:
 
 	// Window
 
-	SDL_Window* window = nullptr;
+	SDL_Window* window = nullptr; // NULL when headless
+	bool headless = false;
 	int window_width;
 	int window_height;
 	bool draw = false;
@@ -62,24 +65,36 @@ public:
 
 	int tecla = -1;
 	bool fillMode;
+	bool antialias = false; // A switches the lines, circles and triangles to the anti-aliased versions
 	bool ImageFruit;
 
 	// CPU Global framebuffer
 	Image framebuffer;
-
-	// Constructor and main methods
-	Application(const char* caption, int width, int height);
+	// Streams the dirty rectangles of the framebuffer to the GPU and draws it
+	Presenter presenter;
+	// Time of every phase of the frame, F1 shows the overlay and F2 writes frame_times.csv
+	FrameTimer frame_timer;
+
+	// Constructor and main methods. A headless application has no window, SDL video or GL:
+	// only the CPU framebuffer, driven with Tick and the Simulate methods and saved with SaveTGA.
+	Application(const char* caption, int width, int height, bool headless = false);
 	~Application();
 
 	void Init(void);
 	void Render(void);
 	void Update(float dt);
 
+	// One frame without the main loop: Render and Update, advancing time by seconds_elapsed
+	void Tick(float seconds_elapsed);
+	// Scripted input, as if it came from SDL (x,y in window coordinates, y down)
+	void SimulateKey(int key);
+	void SimulateMouse(Uint32 type, int x, int y);
+
 
 
 	// Other methods to control the app
+	// The viewport is set by the render thread, that owns the GL context
 	void SetWindowSize(int width, int height) {
-		glViewport(0, 0, width, height);
 		this->window_width = width;
 		this->window_height = height;
 	}
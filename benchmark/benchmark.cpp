@@ -0,0 +1,457 @@
+/*
+	+ Benchmark of the rasterizer and the bulk operations of Image.
+	+ Every primitive is measured over a sweep of canvas resolutions, shape sizes, border widths and fill modes,
+	  reporting ns per call, ns per pixel, pixels per second and allocations per call.
+	+ Usage: benchmark [options]
+		--filter <text>        only the cases whose name contains text
+		--min-time <ms>        time spent measuring each case (default 100)
+		--quick                smaller sweep and 20 ms per case
+		--csv | --json         machine readable output instead of a table
+		--output <file>        write the results to a file instead of stdout
+		--baseline <file>      compare against the JSON of a previous run
+		--threshold <percent>  slowdown that counts as a regression (default 10), the exit code is 1 if any
+		--level <scalar|sse2|avx2>  run the pixel kernels at a lower instruction set
+*/
+
+#include "framework/image.h"
+#include "framework/camera.h"
+#include "framework/mesh.h"
+#include "framework/texture_sampler.h"
+#include "framework/pixel_pool.h"
+#include "framework/pixel_kernels.h"
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <new>
+
+// Every heap allocation of the process is counted, to catch temporaries in the hot paths
+static std::atomic<size_t> heap_allocs(0);
+
+void* operator new(size_t size)
+{
+	heap_allocs.fetch_add(1, std::memory_order_relaxed);
+	void* ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+struct BenchCase {
+	std::string name;
+	std::string op;
+	unsigned int canvas_width, canvas_height;
+	int size, border;
+	bool filled;
+	double pixels; // Pixels written by one call, to compare sizes
+	std::function<void()> run;
+};
+
+struct BenchResult {
+	const BenchCase* bench;
+	size_t iterations;
+	double ns_per_op;
+	double ns_per_pixel;
+	double pixels_per_s;
+	double allocs_per_op; // Heap allocations
+	double pool_allocs_per_op; // Pixel buffers that missed the pool and went to the system
+};
+
+static double Now()
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs the case in batches long enough to be timed, and keeps the median of 5 batches
+static BenchResult Measure(const BenchCase& bench, double min_time_ns)
+{
+	bench.run(); // Warm up caches and the pixel pool
+
+	size_t batch = 1;
+	while (true) {
+		double start = Now();
+		for (size_t i = 0; i < batch; ++i)
+			bench.run();
+		double elapsed = Now() - start;
+		if (elapsed >= min_time_ns / 5 || batch >= ((size_t)1 << 30))
+			break;
+		batch = elapsed > 0 ? std::max(batch * 2, (size_t)(batch * (min_time_ns / 5) / elapsed)) : batch * 2;
+	}
+
+	std::vector<double> samples;
+	size_t allocs_before = heap_allocs.load();
+	size_t pool_before = PixelPool::GetStats().system_allocs;
+	for (int s = 0; s < 5; ++s) {
+		double start = Now();
+		for (size_t i = 0; i < batch; ++i)
+			bench.run();
+		samples.push_back((Now() - start) / batch);
+	}
+	size_t iterations = batch * 5;
+	std::sort(samples.begin(), samples.end());
+
+	BenchResult result;
+	result.bench = &bench;
+	result.iterations = iterations;
+	result.ns_per_op = samples[2];
+	result.ns_per_pixel = bench.pixels > 0 ? result.ns_per_op / bench.pixels : 0;
+	result.pixels_per_s = result.ns_per_op > 0 ? bench.pixels * 1e9 / result.ns_per_op : 0;
+	result.allocs_per_op = double(heap_allocs.load() - allocs_before) / iterations;
+	result.pool_allocs_per_op = double(PixelPool::GetStats().system_allocs - pool_before) / iterations;
+	return result;
+}
+
+//**************************************
+// Cases
+
+struct Canvas {
+	unsigned int width, height;
+	Image image;
+	Image scale_source;
+	TriangleBatch batch;
+	Mesh cube;
+	Camera camera;
+	MeshRenderer renderer;
+	FloatImage depth;
+	TextureSampler checker;
+	MeshRenderer textured_renderer;
+};
+
+static std::string CaseName(const char* op, const Canvas& canvas, int size, int border, int filled)
+{
+	std::ostringstream name;
+	name << op << "/" << canvas.width << "x" << canvas.height;
+	if (size >= 0) name << "/s" << size;
+	if (border >= 0) name << "/b" << border;
+	if (filled >= 0) name << (filled ? "/filled" : "/outline");
+	return name.str();
+}
+
+static void AddCase(std::vector<BenchCase>& cases, const char* op, Canvas& canvas, int size, int border, int filled, double pixels, std::function<void()> run)
+{
+	BenchCase bench;
+	bench.name = CaseName(op, canvas, size, border, filled);
+	bench.op = op;
+	bench.canvas_width = canvas.width;
+	bench.canvas_height = canvas.height;
+	bench.size = size;
+	bench.border = border;
+	bench.filled = filled > 0;
+	bench.pixels = pixels;
+	bench.run = run;
+	cases.push_back(bench);
+}
+
+static void BuildCases(std::vector<BenchCase>& cases, std::vector<Canvas*>& canvases, std::vector<Image*>& sprites, bool quick)
+{
+	const unsigned int resolutions[][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+	std::vector<int> sizes = quick ? std::vector<int>{ 16, 256 } : std::vector<int>{ 16, 64, 256, 512 };
+	std::vector<int> borders = quick ? std::vector<int>{ 1 } : std::vector<int>{ 1, 5 };
+	const float pi = 3.14159265f;
+
+	for (const auto& res : resolutions) {
+		if (quick && res[0] == 640)
+			continue;
+
+		// The framebuffer of the application uses RGBX8
+		Canvas* canvas = new Canvas;
+		canvas->width = res[0];
+		canvas->height = res[1];
+		canvas->image = Image(res[0], res[1], Image::RGBX8);
+		canvas->scale_source = Image(res[0], res[1], Image::RGBX8);
+		canvases.push_back(canvas);
+		Image& fb = canvas->image;
+		int cx = res[0] / 2, cy = res[1] / 2;
+
+		for (int size : sizes) {
+			if (size >= (int)res[1])
+				continue;
+			int half = size / 2;
+
+			// A diagonal line touches size pixels, in both directions so it is not always the same octant
+			AddCase(cases, "line", *canvas, size, -1, -1, 2.0 * size, [&fb, cx, cy, half]() {
+				fb.DrawLineDDA(cx - half, cy - half, cx + half, cy + half, Color::RED);
+				fb.DrawLineDDA(cx + half, cy - half, cx - half, cy + half, Color::GREEN);
+			});
+			AddCase(cases, "line_aa", *canvas, size, -1, -1, 2.0 * size, [&fb, cx, cy, half]() {
+				fb.DrawLineAA((float)(cx - half), (float)(cy - half), (float)(cx + half), (float)(cy + half), Color::RED);
+				fb.DrawLineAA((float)(cx + half), (float)(cy - half), (float)(cx - half), (float)(cy + half), Color::GREEN);
+			});
+
+			for (int border : borders) {
+				for (int filled = 0; filled < 2; ++filled) {
+					double rect_pixels = filled ? (double)size * size : 4.0 * size * border;
+					AddCase(cases, "rect", *canvas, size, border, filled, rect_pixels, [&fb, cx, cy, half, size, border, filled]() {
+						fb.DrawRectUpdate(cx - half, cy - half, size, size, Color::GREEN, border, filled != 0, Color::BLUE);
+					});
+
+					double circle_pixels = filled ? pi * half * half : 2.0 * pi * half * border;
+					AddCase(cases, "circle", *canvas, size, border, filled, circle_pixels, [&fb, cx, cy, half, border, filled]() {
+						fb.DrawCircle(cx, cy, half, Color::PURPLE, border, filled != 0, Color::BLUE);
+					});
+					AddCase(cases, "circle_aa", *canvas, size, border, filled, circle_pixels, [&fb, cx, cy, half, border, filled]() {
+						fb.DrawCircleAA((float)cx, (float)cy, (float)half, Color::PURPLE, border, filled != 0, Color::BLUE);
+					});
+
+					double triangle_pixels = filled ? 0.5 * size * size : 3.4 * size * border;
+					Vector2 p0((float)(cx - half), (float)(cy - half)), p1((float)(cx + half), (float)(cy - half)), p2((float)cx, (float)(cy + half));
+					AddCase(cases, "triangle", *canvas, size, border, filled, triangle_pixels, [&fb, p0, p1, p2, border, filled]() {
+						fb.DrawTriangle(p0, p1, p2, Color::RED, border, filled != 0, Color::BLUE);
+					});
+					AddCase(cases, "triangle_aa", *canvas, size, border, filled, triangle_pixels, [&fb, p0, p1, p2, border, filled]() {
+						fb.DrawTriangleAA(p0, p1, p2, Color::RED, border, filled != 0, Color::BLUE);
+					});
+				}
+			}
+
+			// Only the fill, the setup is most of the cost of the small ones
+			Vector2 t0((float)(cx - half), (float)(cy - half)), t1((float)(cx + half), (float)(cy - half)), t2((float)cx, (float)(cy + half));
+			AddCase(cases, "fill_triangle", *canvas, size, -1, -1, 0.5 * size * size, [&fb, t0, t1, t2]() {
+				fb.FillTriangle(t0, t1, t2, Color::BLUE);
+			});
+
+			Image* sprite = new Image(size, size, Image::RGBX8);
+			sprite->Fill(Color::CYAN);
+			sprites.push_back(sprite);
+			AddCase(cases, "draw_image", *canvas, size, -1, -1, (double)size * size, [&fb, sprite, cx, cy, half]() {
+				fb.DrawImage(*sprite, cx - half, cy - half, false);
+			});
+		}
+
+		double canvas_pixels = (double)res[0] * res[1];
+		AddCase(cases, "fill", *canvas, -1, -1, -1, canvas_pixels, [&fb]() {
+			fb.Fill(Color::BLUE);
+		});
+
+		// 10000 triangles of about 16 px spread over the canvas, one in four with a color per vertex.
+		// Binning is part of every call, as it would be when the scene changes every frame.
+		srand(1);
+		TriangleBatch& batch = canvas->batch;
+		for (int i = 0; i < 10000; ++i) {
+			Vector2 p0((float)(rand() % res[0]), (float)(rand() % res[1]));
+			Vector2 p1 = p0 + Vector2((float)(rand() % 17), (float)(rand() % 5 - 2));
+			Vector2 p2 = p0 + Vector2((float)(rand() % 5 - 2), (float)(rand() % 17));
+			if (i % 4)
+				batch.Add(p0, p1, p2, Color::GREEN);
+			else
+				batch.Add(p0, p1, p2, Color::RED, Color::GREEN, Color::BLUE);
+		}
+		AddCase(cases, "triangle_batch", *canvas, -1, -1, -1, 10000 * 64.0, [&fb, &batch]() {
+			fb.DrawTriangles(batch);
+		});
+
+		// A lit cube seen from a corner covering about a sixth of the canvas, depth cleared on every frame as an application would
+		canvas->cube.CreateCube(1.0f);
+		canvas->camera.LookAt(Vector3(2.5f, 2.0f, 3.0f), Vector3(0, 0, 0), Vector3(0, 1, 0));
+		canvas->camera.SetPerspective(60.0f, (float)res[0] / res[1], 0.1f, 100.0f);
+		// The triangles of CreateCube do not all wind the same way
+		canvas->renderer.cull_back_faces = false;
+		Matrix44 model;
+		AddCase(cases, "mesh", *canvas, -1, -1, -1, canvas_pixels / 6, [&fb, canvas, model]() {
+			canvas->depth.Fill(1.0f);
+			fb.DrawMesh(canvas->renderer, canvas->cube, model, canvas->camera, canvas->depth);
+		});
+
+		// The same cube with a 256x256 checker, trilinear, minified on the faces seen at an angle
+		Image checker(256, 256, Image::RGB8);
+		for (unsigned int y = 0; y < 256; ++y)
+			for (unsigned int x = 0; x < 256; ++x)
+				checker.SetPixel(x, y, ((x / 16) ^ (y / 16)) & 1 ? Color::WHITE : Color::RED);
+		canvas->checker.Create(checker);
+		canvas->textured_renderer.cull_back_faces = false;
+		canvas->textured_renderer.texture = &canvas->checker;
+		AddCase(cases, "mesh_textured", *canvas, -1, -1, -1, canvas_pixels / 6, [&fb, canvas, model]() {
+			canvas->depth.Fill(1.0f);
+			fb.DrawMesh(canvas->textured_renderer, canvas->cube, model, canvas->camera, canvas->depth);
+		});
+		AddCase(cases, "flip_y", *canvas, -1, -1, -1, canvas_pixels, [&fb]() {
+			fb.FlipY();
+		});
+		AddCase(cases, "for_each_pixel", *canvas, -1, -1, -1, canvas_pixels, [&fb]() {
+			fb.ForEachPixel([](Color c) { return Color(255 - c.r, 255 - c.g, 255 - c.b); });
+		});
+		AddCase(cases, "parallel_for_each_pixel", *canvas, -1, -1, -1, canvas_pixels, [&fb]() {
+			fb.ParallelForEachPixel([](Color c) { return Color(255 - c.r, 255 - c.g, 255 - c.b); });
+		});
+
+		// Scale writes a new image, the pixels counted are the ones of the result
+		Image& source = canvas->scale_source;
+		unsigned int half_w = res[0] / 2, half_h = res[1] / 2;
+		AddCase(cases, "scale_half_bilinear", *canvas, -1, -1, -1, (double)half_w * half_h, [&source, half_w, half_h]() {
+			Image result = source;
+			result.Scale(half_w, half_h, Image::BILINEAR);
+		});
+		AddCase(cases, "scale_double_bicubic", *canvas, -1, -1, -1, 4.0 * canvas_pixels, [&source]() {
+			Image result = source;
+			result.Scale(source.width * 2, source.height * 2, Image::BICUBIC);
+		});
+	}
+}
+
+//**************************************
+// Output
+
+static std::string FormatTable(const std::vector<BenchResult>& results)
+{
+	std::ostringstream out;
+	char line[256];
+	snprintf(line, sizeof(line), "%-44s %12s %10s %12s %9s %9s\n", "case", "ns/op", "ns/pixel", "Mpixels/s", "allocs", "pool");
+	out << line;
+	for (const BenchResult& r : results) {
+		snprintf(line, sizeof(line), "%-44s %12.1f %10.3f %12.1f %9.2f %9.2f\n", r.bench->name.c_str(),
+			r.ns_per_op, r.ns_per_pixel, r.pixels_per_s * 1e-6, r.allocs_per_op, r.pool_allocs_per_op);
+		out << line;
+	}
+	return out.str();
+}
+
+static std::string FormatCSV(const std::vector<BenchResult>& results)
+{
+	std::ostringstream out;
+	out << "name,op,canvas_width,canvas_height,size,border,filled,iterations,ns_per_op,ns_per_pixel,pixels_per_s,allocs_per_op,pool_allocs_per_op\n";
+	for (const BenchResult& r : results) {
+		const BenchCase& b = *r.bench;
+		out << b.name << "," << b.op << "," << b.canvas_width << "," << b.canvas_height << "," << b.size << "," << b.border << ","
+			<< (b.filled ? 1 : 0) << "," << r.iterations << "," << r.ns_per_op << "," << r.ns_per_pixel << "," << r.pixels_per_s << ","
+			<< r.allocs_per_op << "," << r.pool_allocs_per_op << "\n";
+	}
+	return out.str();
+}
+
+// One result per line, so a baseline can be read back without a JSON parser
+static std::string FormatJSON(const std::vector<BenchResult>& results)
+{
+	std::ostringstream out;
+	out << "{\n\t\"kernels\": \"" << PixelKernels::GetLevelName(PixelKernels::GetLevel()) << "\",\n";
+	out << "\t\"threads\": " << ThreadPool::Get().GetNumThreads() << ",\n\t\"results\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult& r = results[i];
+		const BenchCase& b = *r.bench;
+		out << "\t\t{\"name\": \"" << b.name << "\", \"op\": \"" << b.op << "\", \"canvas_width\": " << b.canvas_width
+			<< ", \"canvas_height\": " << b.canvas_height << ", \"size\": " << b.size << ", \"border\": " << b.border
+			<< ", \"filled\": " << (b.filled ? "true" : "false") << ", \"iterations\": " << r.iterations
+			<< ", \"ns_per_op\": " << r.ns_per_op << ", \"ns_per_pixel\": " << r.ns_per_pixel << ", \"pixels_per_s\": " << r.pixels_per_s
+			<< ", \"allocs_per_op\": " << r.allocs_per_op << ", \"pool_allocs_per_op\": " << r.pool_allocs_per_op << "}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "\t]\n}\n";
+	return out.str();
+}
+
+// Reads name -> ns_per_op from the output of --json
+static bool LoadBaseline(const char* filename, std::map<std::string, double>& baseline)
+{
+	std::ifstream file(filename);
+	if (!file)
+		return false;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		size_t name = line.find("\"name\": \"");
+		size_t time = line.find("\"ns_per_op\": ");
+		if (name == std::string::npos || time == std::string::npos)
+			continue;
+		name += 9;
+		size_t name_end = line.find('"', name);
+		baseline[line.substr(name, name_end - name)] = atof(line.c_str() + time + 13);
+	}
+	return true;
+}
+
+// Prints the change of every case against the baseline, returns how many got slower than threshold
+static int Compare(const std::vector<BenchResult>& results, const std::map<std::string, double>& baseline, double threshold)
+{
+	int regressions = 0, improvements = 0, missing = 0;
+	fprintf(stderr, "\n%-44s %12s %12s %9s\n", "case", "baseline", "now", "change");
+	for (const BenchResult& r : results) {
+		auto it = baseline.find(r.bench->name);
+		if (it == baseline.end() || it->second <= 0) {
+			missing++;
+			continue;
+		}
+		double change = (r.ns_per_op / it->second - 1.0) * 100.0;
+		const char* mark = "";
+		if (change > threshold) { mark = "  REGRESSION"; regressions++; }
+		else if (change < -threshold) { mark = "  faster"; improvements++; }
+		fprintf(stderr, "%-44s %12.1f %12.1f %+8.1f%%%s\n", r.bench->name.c_str(), it->second, r.ns_per_op, change, mark);
+	}
+	fprintf(stderr, "\n%d regressions, %d improvements over %.1f%%, %d cases not in the baseline\n", regressions, improvements, threshold, missing);
+	return regressions;
+}
+
+int main(int argc, char** argv)
+{
+	const char* filter = NULL;
+	const char* output = NULL;
+	const char* baseline_file = NULL;
+	double min_time_ms = 100;
+	double threshold = 10;
+	bool quick = false;
+	enum { TABLE, CSV, JSON } format = TABLE;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--filter" && has_value) filter = argv[++i];
+		else if (arg == "--min-time" && has_value) min_time_ms = atof(argv[++i]);
+		else if (arg == "--quick") { quick = true; min_time_ms = 20; }
+		else if (arg == "--csv") format = CSV;
+		else if (arg == "--json") format = JSON;
+		else if (arg == "--output" && has_value) output = argv[++i];
+		else if (arg == "--baseline" && has_value) baseline_file = argv[++i];
+		else if (arg == "--threshold" && has_value) threshold = atof(argv[++i]);
+		else if (arg == "--level" && has_value) {
+			std::string level = argv[++i];
+			PixelKernels::SetLevel(level == "scalar" ? PixelKernels::SCALAR : (level == "sse2" ? PixelKernels::SSE2 : PixelKernels::AVX2));
+		}
+		else {
+			fprintf(stderr, "Unknown option %s, see the top of benchmark.cpp\n", argv[i]);
+			return 2;
+		}
+	}
+
+	std::map<std::string, double> baseline;
+	if (baseline_file && !LoadBaseline(baseline_file, baseline)) {
+		fprintf(stderr, "Can't read the baseline %s\n", baseline_file);
+		return 2;
+	}
+
+	std::vector<BenchCase> cases;
+	std::vector<Canvas*> canvases;
+	std::vector<Image*> sprites;
+	BuildCases(cases, canvases, sprites, quick);
+
+	fprintf(stderr, "Kernels: %s, threads: %u\n", PixelKernels::GetLevelName(PixelKernels::GetLevel()), ThreadPool::Get().GetNumThreads());
+	std::vector<BenchResult> results;
+	for (const BenchCase& bench : cases) {
+		if (filter && bench.name.find(filter) == std::string::npos)
+			continue;
+		results.push_back(Measure(bench, min_time_ms * 1e6));
+		if (format != TABLE || output)
+			fprintf(stderr, "%s: %.1f ns\n", bench.name.c_str(), results.back().ns_per_op);
+	}
+
+	std::string text = format == CSV ? FormatCSV(results) : (format == JSON ? FormatJSON(results) : FormatTable(results));
+	if (output) {
+		std::ofstream file(output);
+		file << text;
+	}
+	else
+		fputs(text.c_str(), stdout);
+
+	int regressions = baseline_file ? Compare(results, baseline, threshold) : 0;
+
+	for (Canvas* canvas : canvases)
+		delete canvas;
+	for (Image* sprite : sprites)
+		delete sprite;
+
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#include "blitter.h"
+#include "pixel_kernels.h"
+
+#include <vector>
+
+static void CopyRowColorKey(unsigned char* dst, Image::PixelFormat dst_format, const unsigned char* src, Image::PixelFormat src_format, const Color& key, unsigned int count)
+{
+	if (src_format == dst_format && src_format != Image::GRAY8) {
+		unsigned char k[4];
+		Image::PackColor(src_format, key, k);
+		if (src_format == Image::RGB8)
+			PixelKernels::CopyColorKey24(dst, src, k, count);
+		else {
+			uint32_t value;
+			memcpy(&value, k, 4);
+			PixelKernels::CopyColorKey32((uint32_t*)dst, (const uint32_t*)src, value, count);
+		}
+		return;
+	}
+
+	unsigned int src_bpp = Image::GetBytesPerPixel(src_format);
+	unsigned int dst_bpp = Image::GetBytesPerPixel(dst_format);
+	for (unsigned int i = 0; i < count; ++i, src += src_bpp, dst += dst_bpp) {
+		Color c = Image::UnpackColor(src_format, src);
+		if (c.r != key.r || c.g != key.g || c.b != key.b)
+			Image::PackColor(dst_format, c, dst);
+	}
+}
+
+static void BlendRow(unsigned char* dst, Image::PixelFormat dst_format, const uint32_t* src, unsigned int count, std::vector<uint32_t>& scratch)
+{
+	if (dst_format == Image::RGB8)
+		PixelKernels::BlendPixels24(dst, src, count);
+	else if (dst_format == Image::GRAY8) {
+		scratch.resize(count);
+		PixelKernels::ConvertGrayToRGBX(scratch.data(), dst, count);
+		PixelKernels::BlendPixels32(scratch.data(), src, count);
+		PixelKernels::ConvertRGBXToGray(dst, scratch.data(), count);
+	}
+	else
+		PixelKernels::BlendPixels32((uint32_t*)dst, src, count);
+}
+
+void Blitter::Blit(const ImageView& dst, int x, int y, const ImageView& src, int flags, const Color& key)
+{
+	if (!dst.pixels || !src.pixels)
+		return;
+
+	// Clip the rectangle once against the destination
+	int x0 = std::max(x, 0);
+	int y0 = std::max(y, 0);
+	int x1 = std::min(x + (int)src.width, (int)dst.width);
+	int y1 = std::min(y + (int)src.height, (int)dst.height);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	unsigned int count = x1 - x0;
+	bool blend = (flags & ALPHA) && src.format == Image::RGBA8;
+	bool color_key = !blend && (flags & COLOR_KEY);
+	std::vector<uint32_t> scratch;
+
+	for (int dy = y0; dy < y1; ++dy) {
+		unsigned int sy = dy - y;
+		if (flags & FLIP_Y)
+			sy = src.height - 1 - sy;
+		const unsigned char* s = src.GetPixelPtr(x0 - x, sy);
+		unsigned char* d = dst.GetPixelPtr(x0, dy);
+
+		if (blend)
+			BlendRow(d, dst.format, (const uint32_t*)s, count, scratch);
+		else if (color_key)
+			CopyRowColorKey(d, dst.format, s, src.format, key, count);
+		else if (src.format == dst.format)
+			memcpy(d, s, (size_t)count * dst.bytes_per_pixel);
+		else
+			Image::ConvertPixels(s, src.format, d, dst.format, count);
+	}
+}
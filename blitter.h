@@ -0,0 +1,22 @@
+/*
+	+ This file defines the blitter, that copies a rectangle of pixels from one view into another.
+	+ The rectangle is clipped once, then every row is copied, converted or blended with the pixel kernels.
+*/
+
+#pragma once
+
+#include "image.h"
+
+class Blitter
+{
+public:
+	enum Flags {
+		FLIP_Y = 1, // The first row of the source goes to the bottom of the rectangle
+		COLOR_KEY = 2, // Source pixels with the key color are skipped
+		ALPHA = 4 // RGBA8 sources are blended using their alpha (the key is ignored), other formats are copied
+	};
+
+	// Copies src into dst with its top-left corner at x,y. Only the part inside dst is written.
+	// The formats can be different, the views must not overlap.
+	static void Blit(const ImageView& dst, int x, int y, const ImageView& src, int flags = 0, const Color& key = Color::BLACK);
+};
@@ -86,18 +86,23 @@ void Camera::UpdateViewMatrix()
 	// Reset Matrix (Identity)
 	view_matrix.SetIdentity();
 
-	// Comment this line to create your own projection matrix!
-	SetExampleViewMatrix();
-
-	// Remember how to fill a Matrix4x4 (check framework slides)
-	// Careful with the order of matrix multiplications, and be sure to use normalized vectors!
-	
-	// Create the view matrix rotation
-	// ...
-	// view_matrix.M[3][3] = 1.0;
+	// Built on the CPU, the same matrix as gluLookAt, so it works without a GL context
+	Vector3 front = center - eye;
+	front.Normalize();
+	Vector3 side = front.Cross(up);
+	side.Normalize();
+	Vector3 top = side.Cross(front);
+
+	// Create the view matrix rotation, the rows are the axes of the camera
+	view_matrix.M[0][0] = side.x; view_matrix.M[1][0] = side.y; view_matrix.M[2][0] = side.z;
+	view_matrix.M[0][1] = top.x; view_matrix.M[1][1] = top.y; view_matrix.M[2][1] = top.z;
+	view_matrix.M[0][2] = -front.x; view_matrix.M[1][2] = -front.y; view_matrix.M[2][2] = -front.z;
+	view_matrix.M[3][3] = 1.0;
 
 	// Translate view matrix
-	// ...
+	view_matrix.M[3][0] = -side.Dot(eye);
+	view_matrix.M[3][1] = -top.Dot(eye);
+	view_matrix.M[3][2] = front.Dot(eye);
 
 	UpdateViewProjectionMatrix();
 }
@@ -108,17 +113,23 @@ void Camera::UpdateProjectionMatrix()
 	// Reset Matrix (Identity)
 	projection_matrix.SetIdentity();
 
-	// Comment this line to create your own projection matrix!
-	SetExampleProjectionMatrix();
-
-	// Remember how to fill a Matrix4x4 (check framework slides)
-	
+	// Same matrices as gluPerspective and glOrtho, built without a GL context
 	if (type == PERSPECTIVE) {
-		// projection_matrix.M[2][3] = -1;
-		// ...
+		float f = 1.0f / tanf(fov * DEG2RAD * 0.5f);
+		projection_matrix.M[0][0] = f / aspect;
+		projection_matrix.M[1][1] = f;
+		projection_matrix.M[2][2] = (far_plane + near_plane) / (near_plane - far_plane);
+		projection_matrix.M[2][3] = -1;
+		projection_matrix.M[3][2] = 2.0f * far_plane * near_plane / (near_plane - far_plane);
+		projection_matrix.M[3][3] = 0;
 	}
 	else if (type == ORTHOGRAPHIC) {
-		// ...
+		projection_matrix.M[0][0] = 2.0f / (right - left);
+		projection_matrix.M[1][1] = 2.0f / (top - bottom);
+		projection_matrix.M[2][2] = -2.0f / (far_plane - near_plane);
+		projection_matrix.M[3][0] = -(right + left) / (right - left);
+		projection_matrix.M[3][1] = -(top + bottom) / (top - bottom);
+		projection_matrix.M[3][2] = -(far_plane + near_plane) / (far_plane - near_plane);
 	} 
 
 	UpdateViewProjectionMatrix();
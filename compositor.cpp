@@ -0,0 +1,392 @@
+#include "compositor.h"
+#include "pixel_kernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#define COMPOSITOR_X86
+	#include <emmintrin.h>
+	#include <immintrin.h>
+#endif
+
+#if defined(COMPOSITOR_X86) && (defined(__GNUC__) || defined(__clang__))
+	#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+	#define TARGET_AVX2
+#endif
+
+// Formats without alpha are converted to RGBX in chunks of this many pixels
+#define CHUNK_PIXELS 256
+
+typedef void (*CompositeFunc)(uint32_t* dst, const uint32_t* src, uint32_t color, const unsigned char* mask, unsigned int opacity, size_t count);
+
+//**************************************
+// Scalar versions. They saturate at 16 bits like the SIMD ones, so all give the same bytes.
+
+static inline unsigned int Sat16(unsigned int v)
+{
+	return v > 65535 ? 65535 : v;
+}
+
+// Division by 255 of v + 128, exact for v <= 255 * 255 and 255 above
+static inline unsigned int Div255(unsigned int v)
+{
+	v = Sat16(v + 128);
+	v = Sat16(v + (v >> 8));
+	return v >> 8;
+}
+
+static inline uint32_t PremultiplyPixel(uint32_t v)
+{
+	unsigned int a = v >> 24;
+	return Div255((v & 0xFF) * a) | (Div255(((v >> 8) & 0xFF) * a) << 8) | (Div255(((v >> 16) & 0xFF) * a) << 16) | (a << 24);
+}
+
+template <int MODE>
+static inline unsigned int BlendChannel(unsigned int s, unsigned int d, unsigned int sa, unsigned int da)
+{
+	switch (MODE) {
+		case Image::BLEND_OVER:
+			return Div255(Sat16(s * 255 + d * (255 - sa)));
+		case Image::BLEND_ADD:
+			return std::min(s + d, 255u);
+		case Image::BLEND_MULTIPLY:
+			return Div255(Sat16(Sat16(s * d + s * (255 - da)) + d * (255 - sa)));
+		case Image::BLEND_SCREEN:
+			return Div255(Sat16(s * 255 + d * (255 - s)));
+		case Image::BLEND_DARKEN:
+			return Div255(Sat16(Sat16(std::min(s * da, d * sa) + s * (255 - da)) + d * (255 - sa)));
+		case Image::BLEND_LIGHTEN:
+			return Div255(Sat16(Sat16(std::max(s * da, d * sa) + s * (255 - da)) + d * (255 - sa)));
+	}
+	return d;
+}
+
+template <int MODE, bool SOLID>
+static void CompositeScalar(uint32_t* dst, const uint32_t* src, uint32_t color, const unsigned char* mask, unsigned int opacity, size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t v = SOLID ? color : src[i];
+		unsigned int m = mask ? Div255(mask[i] * opacity) : opacity;
+		unsigned int s[4];
+		for (int c = 0; c < 4; ++c) {
+			s[c] = (v >> (c * 8)) & 0xFF;
+			if (m != 255)
+				s[c] = Div255(s[c] * m);
+		}
+
+		unsigned char* d = (unsigned char*)(dst + i);
+		unsigned int da = d[3];
+		for (int c = 0; c < 4; ++c)
+			d[c] = (unsigned char)BlendChannel<MODE>(s[c], d[c], s[3], da);
+	}
+}
+
+#ifdef COMPOSITOR_X86
+
+//**************************************
+// SSE2 versions, two pixels in 8 16-bit lanes
+
+static inline __m128i Div255SSE2(__m128i v)
+{
+	v = _mm_adds_epu16(v, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_adds_epu16(v, _mm_srli_epi16(v, 8)), 8);
+}
+
+// Copies the alpha of each pixel to its 4 lanes
+static inline __m128i Alpha16SSE2(__m128i v)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+// min and max of unsigned 16-bit lanes, SSE2 only has the signed ones
+static inline __m128i Min16SSE2(__m128i a, __m128i b) { return _mm_sub_epi16(a, _mm_subs_epu16(a, b)); }
+static inline __m128i Max16SSE2(__m128i a, __m128i b) { return _mm_add_epi16(b, _mm_subs_epu16(a, b)); }
+
+template <int MODE>
+static inline __m128i Blend16SSE2(__m128i s, __m128i d)
+{
+	const __m128i full = _mm_set1_epi16(255);
+	__m128i sa = Alpha16SSE2(s), da = Alpha16SSE2(d);
+	__m128i inv_sa = _mm_sub_epi16(full, sa), inv_da = _mm_sub_epi16(full, da);
+	__m128i v;
+	switch (MODE) {
+		case Image::BLEND_ADD:
+			return Min16SSE2(_mm_add_epi16(s, d), full);
+		case Image::BLEND_MULTIPLY:
+			v = _mm_adds_epu16(_mm_adds_epu16(_mm_mullo_epi16(s, d), _mm_mullo_epi16(s, inv_da)), _mm_mullo_epi16(d, inv_sa));
+			break;
+		case Image::BLEND_SCREEN:
+			v = _mm_adds_epu16(_mm_mullo_epi16(s, full), _mm_mullo_epi16(d, _mm_sub_epi16(full, s)));
+			break;
+		case Image::BLEND_DARKEN:
+		case Image::BLEND_LIGHTEN: {
+			__m128i a = _mm_mullo_epi16(s, da), b = _mm_mullo_epi16(d, sa);
+			v = MODE == Image::BLEND_DARKEN ? Min16SSE2(a, b) : Max16SSE2(a, b);
+			v = _mm_adds_epu16(_mm_adds_epu16(v, _mm_mullo_epi16(s, inv_da)), _mm_mullo_epi16(d, inv_sa));
+			break;
+		}
+		default:
+			v = _mm_adds_epu16(_mm_mullo_epi16(s, full), _mm_mullo_epi16(d, inv_sa));
+			break;
+	}
+	return Div255SSE2(v);
+}
+
+template <int MODE, bool SOLID>
+static void CompositeSSE2(uint32_t* dst, const uint32_t* src, uint32_t color, const unsigned char* mask, unsigned int opacity, size_t count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i op = _mm_set1_epi16((short)opacity);
+	const __m128i c = _mm_set1_epi32((int)color);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = SOLID ? c : _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i s_lo = _mm_unpacklo_epi8(s, zero), s_hi = _mm_unpackhi_epi8(s, zero);
+		if (mask) {
+			int m4;
+			memcpy(&m4, mask + i, 4);
+			__m128i m = _mm_unpacklo_epi8(_mm_cvtsi32_si128(m4), zero);
+			m = Div255SSE2(_mm_mullo_epi16(m, op));
+			m = _mm_unpacklo_epi16(m, m);
+			s_lo = Div255SSE2(_mm_mullo_epi16(s_lo, _mm_unpacklo_epi32(m, m)));
+			s_hi = Div255SSE2(_mm_mullo_epi16(s_hi, _mm_unpackhi_epi32(m, m)));
+		}
+		else if (opacity != 255) {
+			s_lo = Div255SSE2(_mm_mullo_epi16(s_lo, op));
+			s_hi = Div255SSE2(_mm_mullo_epi16(s_hi, op));
+		}
+		__m128i lo = Blend16SSE2<MODE>(s_lo, _mm_unpacklo_epi8(d, zero));
+		__m128i hi = Blend16SSE2<MODE>(s_hi, _mm_unpackhi_epi8(d, zero));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	// The last 1 to 3 pixels go through the same code in a padded copy, short spans of
+	// anti-aliased edges are common and the scalar loop is several times slower
+	if (i < count) {
+		size_t n = count - i;
+		uint32_t d4[4] = {}, s4[4] = {};
+		unsigned char m4[4] = {};
+		memcpy(d4, dst + i, n * 4);
+		if (!SOLID)
+			memcpy(s4, src + i, n * 4);
+		if (mask)
+			memcpy(m4, mask + i, n);
+		CompositeSSE2<MODE, SOLID>(d4, s4, color, mask ? m4 : NULL, opacity, 4);
+		memcpy(dst + i, d4, n * 4);
+	}
+}
+
+static void PremultiplySSE2(uint32_t* dst, const uint32_t* src, size_t count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000u);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+		lo = Div255SSE2(_mm_mullo_epi16(lo, Alpha16SSE2(lo)));
+		hi = Div255SSE2(_mm_mullo_epi16(hi, Alpha16SSE2(hi)));
+		__m128i r = _mm_packus_epi16(lo, hi);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_andnot_si128(alpha_mask, r), _mm_and_si128(alpha_mask, v)));
+	}
+	for (; i < count; ++i)
+		dst[i] = PremultiplyPixel(src[i]);
+}
+
+//**************************************
+// AVX2 versions, the same as SSE2 on 256 bits (4 pixels, two in each 128-bit lane)
+
+TARGET_AVX2 static inline __m256i Div255AVX2(__m256i v)
+{
+	v = _mm256_adds_epu16(v, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_adds_epu16(v, _mm256_srli_epi16(v, 8)), 8);
+}
+
+TARGET_AVX2 static inline __m256i Alpha16AVX2(__m256i v)
+{
+	return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+template <int MODE>
+TARGET_AVX2 static inline __m256i Blend16AVX2(__m256i s, __m256i d)
+{
+	const __m256i full = _mm256_set1_epi16(255);
+	__m256i sa = Alpha16AVX2(s), da = Alpha16AVX2(d);
+	__m256i inv_sa = _mm256_sub_epi16(full, sa), inv_da = _mm256_sub_epi16(full, da);
+	__m256i v;
+	switch (MODE) {
+		case Image::BLEND_ADD:
+			return _mm256_min_epu16(_mm256_add_epi16(s, d), full);
+		case Image::BLEND_MULTIPLY:
+			v = _mm256_adds_epu16(_mm256_adds_epu16(_mm256_mullo_epi16(s, d), _mm256_mullo_epi16(s, inv_da)), _mm256_mullo_epi16(d, inv_sa));
+			break;
+		case Image::BLEND_SCREEN:
+			v = _mm256_adds_epu16(_mm256_mullo_epi16(s, full), _mm256_mullo_epi16(d, _mm256_sub_epi16(full, s)));
+			break;
+		case Image::BLEND_DARKEN:
+		case Image::BLEND_LIGHTEN: {
+			__m256i a = _mm256_mullo_epi16(s, da), b = _mm256_mullo_epi16(d, sa);
+			v = MODE == Image::BLEND_DARKEN ? _mm256_min_epu16(a, b) : _mm256_max_epu16(a, b);
+			v = _mm256_adds_epu16(_mm256_adds_epu16(v, _mm256_mullo_epi16(s, inv_da)), _mm256_mullo_epi16(d, inv_sa));
+			break;
+		}
+		default:
+			v = _mm256_adds_epu16(_mm256_mullo_epi16(s, full), _mm256_mullo_epi16(d, inv_sa));
+			break;
+	}
+	return Div255AVX2(v);
+}
+
+template <int MODE, bool SOLID>
+TARGET_AVX2 static void CompositeAVX2(uint32_t* dst, const uint32_t* src, uint32_t color, const unsigned char* mask, unsigned int opacity, size_t count)
+{
+	// Coverage of pixels 0,1 (low half) and 2,3 (high half) of each lane, copied to their 4 channels
+	const __m256i mask_lo = _mm256_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 4, 5, 4, 5, 4, 5, 4, 5,
+		0, 1, 0, 1, 0, 1, 0, 1, 4, 5, 4, 5, 4, 5, 4, 5);
+	const __m256i mask_hi = _mm256_setr_epi8(8, 9, 8, 9, 8, 9, 8, 9, 12, 13, 12, 13, 12, 13, 12, 13,
+		8, 9, 8, 9, 8, 9, 8, 9, 12, 13, 12, 13, 12, 13, 12, 13);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i op = _mm256_set1_epi16((short)opacity);
+	const __m256i c = _mm256_set1_epi32((int)color);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i s = SOLID ? c : _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+		__m256i s_lo = _mm256_unpacklo_epi8(s, zero), s_hi = _mm256_unpackhi_epi8(s, zero);
+		if (mask) {
+			__m256i m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(mask + i)));
+			m = Div255AVX2(_mm256_mullo_epi16(m, op));
+			s_lo = Div255AVX2(_mm256_mullo_epi16(s_lo, _mm256_shuffle_epi8(m, mask_lo)));
+			s_hi = Div255AVX2(_mm256_mullo_epi16(s_hi, _mm256_shuffle_epi8(m, mask_hi)));
+		}
+		else if (opacity != 255) {
+			s_lo = Div255AVX2(_mm256_mullo_epi16(s_lo, op));
+			s_hi = Div255AVX2(_mm256_mullo_epi16(s_hi, op));
+		}
+		__m256i lo = Blend16AVX2<MODE>(s_lo, _mm256_unpacklo_epi8(d, zero));
+		__m256i hi = Blend16AVX2<MODE>(s_hi, _mm256_unpackhi_epi8(d, zero));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+	CompositeSSE2<MODE, SOLID>(dst + i, SOLID ? src : src + i, color, mask ? mask + i : NULL, opacity, count - i);
+}
+
+#endif
+
+//**************************************
+// Dispatch
+
+template <int MODE, bool SOLID>
+static CompositeFunc SelectLevel()
+{
+#ifdef COMPOSITOR_X86
+	PixelKernels::Level level = PixelKernels::GetLevel();
+	if (level >= PixelKernels::AVX2) return CompositeAVX2<MODE, SOLID>;
+	if (level >= PixelKernels::SSE2) return CompositeSSE2<MODE, SOLID>;
+#endif
+	return CompositeScalar<MODE, SOLID>;
+}
+
+template <bool SOLID>
+static CompositeFunc SelectFunc(Image::BlendMode mode)
+{
+	switch (mode) {
+		case Image::BLEND_ADD: return SelectLevel<Image::BLEND_ADD, SOLID>();
+		case Image::BLEND_MULTIPLY: return SelectLevel<Image::BLEND_MULTIPLY, SOLID>();
+		case Image::BLEND_SCREEN: return SelectLevel<Image::BLEND_SCREEN, SOLID>();
+		case Image::BLEND_DARKEN: return SelectLevel<Image::BLEND_DARKEN, SOLID>();
+		case Image::BLEND_LIGHTEN: return SelectLevel<Image::BLEND_LIGHTEN, SOLID>();
+		default: return SelectLevel<Image::BLEND_OVER, SOLID>();
+	}
+}
+
+uint32_t Compositor::PremultiplyColor(const Color& c, unsigned int alpha)
+{
+	return PremultiplyPixel(c.r | (c.g << 8) | (c.b << 16) | ((uint32_t)alpha << 24));
+}
+
+void Compositor::Premultiply(uint32_t* dst, const uint32_t* src, size_t count)
+{
+#ifdef COMPOSITOR_X86
+	if (PixelKernels::GetLevel() >= PixelKernels::SSE2)
+		return PremultiplySSE2(dst, src, count);
+#endif
+	for (size_t i = 0; i < count; ++i)
+		dst[i] = PremultiplyPixel(src[i]);
+}
+
+void Compositor::Unpremultiply(uint32_t* dst, const uint32_t* src, size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t v = src[i];
+		unsigned int a = v >> 24;
+		if (a == 0) {
+			dst[i] = 0;
+			continue;
+		}
+		uint32_t r = 0;
+		for (int c = 0; c < 3; ++c)
+			r |= std::min((((v >> (c * 8)) & 0xFF) * 255 + a / 2) / a, 255u) << (c * 8);
+		dst[i] = r | (a << 24);
+	}
+}
+
+void Compositor::CompositeSpan(uint32_t* dst, const uint32_t* src, const unsigned char* mask, unsigned int opacity, size_t count, Image::BlendMode mode)
+{
+	SelectFunc<false>(mode)(dst, src, 0, mask, opacity, count);
+}
+
+void Compositor::CompositeColor(uint32_t* dst, uint32_t color, const unsigned char* mask, size_t count, Image::BlendMode mode)
+{
+	SelectFunc<true>(mode)(dst, NULL, color, mask, 255, count);
+}
+
+// Runs f on the row as RGBX, converting formats without 4 bytes per pixel in chunks
+template <typename F>
+static void WithRGBXRow(unsigned char* dst, Image::PixelFormat format, size_t count, F f)
+{
+	if (format == Image::RGBA8 || format == Image::RGBX8) {
+		f((uint32_t*)dst, 0, count);
+		return;
+	}
+
+	uint32_t tmp[CHUNK_PIXELS];
+	unsigned int bpp = Image::GetBytesPerPixel(format);
+	for (size_t i = 0; i < count; i += CHUNK_PIXELS) {
+		size_t n = std::min(count - i, (size_t)CHUNK_PIXELS);
+		unsigned char* p = dst + i * bpp;
+		Image::ConvertPixels(p, format, (unsigned char*)tmp, Image::RGBX8, (unsigned int)n);
+		f(tmp, i, n);
+		Image::ConvertPixels((unsigned char*)tmp, Image::RGBX8, p, format, (unsigned int)n);
+	}
+}
+
+void Compositor::CompositeRow(unsigned char* dst, Image::PixelFormat format, uint32_t color, const unsigned char* mask, size_t count, Image::BlendMode mode)
+{
+	CompositeFunc func = SelectFunc<true>(mode);
+	WithRGBXRow(dst, format, count, [&](uint32_t* row, size_t offset, size_t n) {
+		func(row, NULL, color, mask ? mask + offset : NULL, 255, n);
+	});
+}
+
+void Compositor::Composite(const ImageView& dst, int x, int y, const ImageView& src, Image::BlendMode mode, unsigned int opacity)
+{
+	assert(src.format == Image::RGBA8);
+	if (!dst.pixels || !src.pixels)
+		return;
+
+	// Clip the rectangle once against the destination
+	int x0 = std::max(x, 0);
+	int y0 = std::max(y, 0);
+	int x1 = std::min(x + (int)src.width, (int)dst.width);
+	int y1 = std::min(y + (int)src.height, (int)dst.height);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	CompositeFunc func = SelectFunc<false>(mode);
+	for (int dy = y0; dy < y1; ++dy) {
+		const uint32_t* s = (const uint32_t*)src.GetPixelPtr(x0 - x, dy - y);
+		WithRGBXRow(dst.GetPixelPtr(x0, dy), dst.format, x1 - x0, [&](uint32_t* row, size_t offset, size_t n) {
+			func(row, s + offset, 0, NULL, opacity, n);
+		});
+	}
+}
@@ -0,0 +1,30 @@
+/*
+	+ This file defines the compositor, that blends premultiplied RGBA8 pixels with the modes of Image::BlendMode.
+	+ Premultiplied means r,g,b are already multiplied by a, so every mode is the same integer formula on the 4 channels.
+	+ The kernels use saturating 16-bit math, with SSE2/AVX2 versions picked with the level of PixelKernels.
+*/
+
+#pragma once
+
+#include "image.h"
+
+class Compositor
+{
+public:
+	// Conversion between straight and premultiplied RGBA8
+	static uint32_t PremultiplyColor(const Color& c, unsigned int alpha);
+	static void Premultiply(uint32_t* dst, const uint32_t* src, size_t count);
+	static void Unpremultiply(uint32_t* dst, const uint32_t* src, size_t count);
+
+	// dst = src (mode) dst on count premultiplied pixels. The source is scaled by opacity and,
+	// when mask is not NULL, by one coverage byte per pixel (0 leaves dst untouched).
+	static void CompositeSpan(uint32_t* dst, const uint32_t* src, const unsigned char* mask, unsigned int opacity, size_t count, Image::BlendMode mode);
+	// Same with a single premultiplied color, for brushes and shapes
+	static void CompositeColor(uint32_t* dst, uint32_t color, const unsigned char* mask, size_t count, Image::BlendMode mode);
+
+	// Composites the premultiplied RGBA8 view src into dst at x,y, clipped once.
+	// dst can use any format, the ones without alpha are opaque.
+	static void Composite(const ImageView& dst, int x, int y, const ImageView& src, Image::BlendMode mode, unsigned int opacity = 255);
+	// Composites a color over count pixels of a row of dst (the caller clips), with an optional mask
+	static void CompositeRow(unsigned char* dst, Image::PixelFormat format, uint32_t color, const unsigned char* mask, size_t count, Image::BlendMode mode);
+};
@@ -0,0 +1,207 @@
+#include "frame_timer.h"
+
+#include <chrono>
+#include <algorithm>
+
+// Colors of the phases in the HUD
+static const Color phase_colors[FrameTimer::NUM_PHASES] = {
+	Color(128, 128, 128), Color(60, 200, 60), Color(60, 120, 255), Color(255, 150, 40), Color(200, 80, 220), Color(255, 255, 255)
+};
+
+// 3x5 digits, one row per byte from the top, the bit 4 is the left column
+static const unsigned char digit_font[11][5] = {
+	{ 7, 5, 5, 5, 7 }, { 2, 6, 2, 2, 7 }, { 7, 1, 7, 4, 7 }, { 7, 1, 7, 1, 7 }, { 5, 5, 7, 1, 1 },
+	{ 7, 4, 7, 1, 7 }, { 7, 4, 7, 5, 7 }, { 7, 1, 1, 1, 1 }, { 7, 5, 7, 5, 7 }, { 7, 5, 7, 1, 7 },
+	{ 0, 0, 0, 0, 2 } // '.'
+};
+
+// Passed by reference to std::min, so they need storage
+const unsigned int FrameTimer::HISTORY;
+const unsigned int FrameTimer::HISTOGRAM_BUCKETS;
+
+const char* FrameTimer::GetPhaseName(Phase phase)
+{
+	switch (phase) {
+		case EVENTS: return "events";
+		case UPDATE: return "update";
+		case RENDER: return "render";
+		case UPLOAD: return "upload";
+		case SWAP: return "swap";
+		case FRAME: return "frame";
+		default: return "unknown";
+	}
+}
+
+FrameTimer::FrameTimer()
+{
+	for (unsigned int p = 0; p < NUM_PHASES; ++p) {
+		counts[p] = 0;
+		for (unsigned int i = 0; i < HISTORY; ++i)
+			samples[p][i] = 0;
+	}
+	for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+		histogram[i] = 0;
+}
+
+FrameTimer::~FrameTimer()
+{
+	CloseCSV();
+}
+
+double FrameTimer::Now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FrameTimer::Record(Phase phase, double seconds)
+{
+	unsigned int n = counts[phase].load(std::memory_order_relaxed);
+	samples[phase][n % HISTORY].store((float)seconds, std::memory_order_relaxed);
+	counts[phase].store(n + 1, std::memory_order_release);
+}
+
+void FrameTimer::EndFrame()
+{
+	double now = Now();
+	if (last_frame_end > 0) {
+		double frame = now - last_frame_end;
+		Record(FRAME, frame);
+		unsigned int bucket = std::min((unsigned int)(frame * 1000.0), HISTOGRAM_BUCKETS - 1);
+		histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+		if (csv) {
+			fprintf(csv, "%u,%.6f", frame_index, now);
+			for (unsigned int p = 0; p < NUM_PHASES; ++p)
+				fprintf(csv, ",%.4f", GetLast((Phase)p) * 1000.0);
+			fprintf(csv, "\n");
+		}
+	}
+	last_frame_end = now;
+	frame_index++;
+}
+
+void FrameTimer::SkipFrame()
+{
+	if (last_frame_end > 0)
+		last_frame_end = Now();
+}
+
+double FrameTimer::GetLast(Phase phase) const
+{
+	unsigned int n = counts[phase].load(std::memory_order_acquire);
+	return n ? samples[phase][(n - 1) % HISTORY].load(std::memory_order_relaxed) : 0.0;
+}
+
+double FrameTimer::GetPercentile(Phase phase, double p) const
+{
+	unsigned int n = std::min(counts[phase].load(std::memory_order_acquire), HISTORY);
+	if (n == 0)
+		return 0;
+
+	float values[HISTORY];
+	for (unsigned int i = 0; i < n; ++i)
+		values[i] = samples[phase][i].load(std::memory_order_relaxed);
+	unsigned int k = std::min((unsigned int)(p * (n - 1) + 0.5), n - 1);
+	std::nth_element(values, values + k, values + n);
+	return values[k];
+}
+
+bool FrameTimer::OpenCSV(const char* filename)
+{
+	CloseCSV();
+	csv = fopen(filename, "w");
+	if (!csv)
+		return false;
+	fprintf(csv, "frame,time_s");
+	for (unsigned int p = 0; p < NUM_PHASES; ++p)
+		fprintf(csv, ",%s_ms", GetPhaseName((Phase)p));
+	fprintf(csv, "\n");
+	return true;
+}
+
+void FrameTimer::CloseCSV()
+{
+	if (csv) {
+		fclose(csv);
+		csv = NULL;
+	}
+}
+
+//**************************************
+// HUD
+
+static void FillRect(Image& target, int x, int y, int w, int h, const Color& c, unsigned int alpha = 255)
+{
+	for (int j = 0; j < h; ++j)
+		target.BlendSpan(x, y + j, w, c, alpha);
+}
+
+// Draws value with one decimal, returns the x after the last character
+static int DrawNumber(Image& target, int x, int y, double value, const Color& c, int scale)
+{
+	char text[16];
+	snprintf(text, sizeof(text), "%.1f", std::min(value, 999.9));
+	for (const char* ch = text; *ch; ++ch) {
+		const unsigned char* glyph = digit_font[*ch == '.' ? 10 : *ch - '0'];
+		for (int row = 0; row < 5; ++row)
+			for (int col = 0; col < 3; ++col)
+				if (glyph[row] & (4 >> col))
+					FillRect(target, x + col * scale, y + (4 - row) * scale, scale, scale, c);
+		x += 4 * scale;
+	}
+	return x;
+}
+
+void FrameTimer::DrawHUD(Image& target, int x, int y) const
+{
+	const int margin = 4;
+	FillRect(target, x, y, HUD_WIDTH, HUD_HEIGHT, Color(0, 0, 0), 180);
+
+	// p50, p95 and p99 of the frame time in ms, white, yellow and red
+	const double percentiles[3] = { 0.5, 0.95, 0.99 };
+	const Color colors[3] = { Color(255, 255, 255), Color(255, 220, 0), Color(255, 60, 60) };
+	int text_y = y + HUD_HEIGHT - margin - 10;
+	int text_x = x + margin;
+	for (int i = 0; i < 3; ++i)
+		text_x = DrawNumber(target, text_x, text_y, GetPercentile(FRAME, percentiles[i]) * 1000.0, colors[i], 2) + 10;
+
+	// Last frames as stacked bars of the phases, 3 px per ms with a line at 60 Hz
+	const int graph_h = HUD_HEIGHT - 2 * margin - 16;
+	const int graph_w = 180;
+	const float px_per_ms = 3.0f;
+	const int columns = graph_w / 2;
+	unsigned int n = counts[FRAME].load(std::memory_order_acquire);
+	for (int i = 0; i < columns && i < (int)std::min(n, HISTORY); ++i) {
+		int bar_x = x + margin + graph_w - 2 * (i + 1);
+		int bar_y = y + margin;
+		// The phases of the render thread may be one frame behind, it is only a picture
+		for (unsigned int p = 0; p < FRAME; ++p) {
+			unsigned int count = counts[p].load(std::memory_order_acquire);
+			if (count <= (unsigned int)i)
+				continue;
+			float ms = samples[p][(count - 1 - i) % HISTORY].load(std::memory_order_relaxed) * 1000.0f;
+			int h = std::min((int)(ms * px_per_ms + 0.5f), y + margin + graph_h - bar_y);
+			FillRect(target, bar_x, bar_y, 2, h, phase_colors[p]);
+			bar_y += h;
+		}
+		float frame_ms = samples[FRAME][(n - 1 - i) % HISTORY].load(std::memory_order_relaxed) * 1000.0f;
+		int top = std::min((int)(frame_ms * px_per_ms + 0.5f), graph_h - 1);
+		FillRect(target, bar_x, y + margin + top, 2, 1, phase_colors[FRAME]);
+	}
+	FillRect(target, x + margin, y + margin + (int)(16.67f * px_per_ms), graph_w, 1, Color(255, 60, 60), 160);
+
+	// Histogram of all the frames, 1 ms per bucket, with the tallest bucket at full height
+	int hist_x = x + margin + graph_w + 8;
+	int bucket_w = (HUD_WIDTH - graph_w - 2 * margin - 8) / HISTOGRAM_BUCKETS;
+	unsigned int max_count = 1;
+	for (unsigned int b = 0; b < HISTOGRAM_BUCKETS; ++b)
+		max_count = std::max(max_count, GetHistogram(b));
+	for (unsigned int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+		int h = (int)((double)GetHistogram(b) * graph_h / max_count + 0.5);
+		FillRect(target, hist_x + b * bucket_w, y + margin, std::max(bucket_w - 1, 1), h, b == HISTOGRAM_BUCKETS - 1 ? colors[2] : phase_colors[RENDER]);
+	}
+
+	// Legend of the phases below the numbers
+	for (unsigned int p = 0; p < NUM_PHASES; ++p)
+		FillRect(target, x + HUD_WIDTH - margin - (NUM_PHASES - p) * 10, text_y + 2, 8, 6, phase_colors[p]);
+}
@@ -0,0 +1,63 @@
+/*
+	+ This file defines the frame timer, that measures where the time of every frame goes.
+	+ Each phase keeps its last HISTORY samples for the percentiles, and the whole frame also goes to a histogram.
+	+ The numbers can be drawn as an overlay, that the presenter shows over the frame, and written to a CSV file,
+	  one row per frame.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <stdio.h>
+#include "image.h"
+
+class FrameTimer
+{
+public:
+	// FRAME is the time from one EndFrame to the next, the rest are parts of it.
+	// UPLOAD and SWAP are measured in the render thread.
+	enum Phase { EVENTS, UPDATE, RENDER, UPLOAD, SWAP, FRAME, NUM_PHASES };
+	static const char* GetPhaseName(Phase phase);
+
+	static const unsigned int HISTORY = 256; // Samples kept per phase
+	static const unsigned int HISTOGRAM_BUCKETS = 34; // 1 ms each, the last one counts everything slower
+
+	FrameTimer();
+	~FrameTimer();
+
+	// Seconds from a steady high resolution clock
+	static double Now();
+
+	// Adds a sample of the phase. Every phase must be recorded always from the same thread.
+	void Record(Phase phase, double seconds);
+	// Closes the frame: records FRAME and writes the CSV row
+	void EndFrame();
+	// Drops the frame in progress, one that presented nothing: the next FRAME is measured from now
+	void SkipFrame();
+
+	// p in [0,1] over the last HISTORY samples, in seconds
+	double GetPercentile(Phase phase, double p) const;
+	double GetLast(Phase phase) const;
+	unsigned int GetHistogram(unsigned int bucket) const { return histogram[bucket].load(std::memory_order_relaxed); }
+
+	// One row per frame with the time of every phase in ms, until CloseCSV
+	bool OpenCSV(const char* filename);
+	void CloseCSV();
+	bool IsWritingCSV() const { return csv != NULL; }
+
+	// Overlay with the last frames as stacked bars, the histogram and the p50/p95/p99 of FRAME
+	bool show_hud = false;
+	static const int HUD_WIDTH = 300;
+	static const int HUD_HEIGHT = 120;
+	void DrawHUD(Image& target, int x, int y) const;
+	// Top-left corner of the window, the first row of an image is the bottom one
+	static void GetHUDPosition(const Image& target, int& x, int& y) { x = 10; y = (int)target.height - HUD_HEIGHT - 10; }
+
+private:
+	std::atomic<float> samples[NUM_PHASES][HISTORY];
+	std::atomic<unsigned int> counts[NUM_PHASES];
+	std::atomic<unsigned int> histogram[HISTOGRAM_BUCKETS];
+	double last_frame_end = 0;
+	unsigned int frame_index = 0;
+	FILE* csv = NULL;
+};
@@ -2,128 +2,487 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <ctime>
+#include <cstdlib>
+#include <cfloat>
 #include "GL/glew.h"
 #include "../extra/picopng.h"
 #include "image.h"
 #include "utils.h"
 #include "camera.h"
 #include "mesh.h"
+#include "pixel_pool.h"
+#include "pixel_kernels.h"
+#include "resampler.h"
+#include "blitter.h"
+#include "compositor.h"
+#include "line_rasterizer.h"
+#include "triangle_rasterizer.h"
+#include "texture_sampler.h"
+
+// Pixel buffers come from the pool, aligned to a cache line so rows of the 32-bit formats can use wide loads
+static unsigned char* AllocPixels(size_t size)
+{
+	return (unsigned char*)PixelPool::Alloc(size);
+}
+
+static void FreePixels(unsigned char* ptr, size_t size)
+{
+	PixelPool::Free(ptr, size);
+}
+
+static PixelBuffer* CreateBuffer(size_t size)
+{
+	PixelBuffer* buffer = new PixelBuffer;
+	buffer->refs = 1;
+	buffer->size = size;
+	buffer->data = AllocPixels(size);
+	return buffer;
+}
+
+static void ReleaseBuffer(PixelBuffer* buffer)
+{
+	if (buffer && buffer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		FreePixels(buffer->data, buffer->size);
+		delete buffer;
+	}
+}
 
 Image::Image() {
 	width = 0; height = 0;
 	pixels = NULL;
 }
 
-Image::Image(unsigned int width, unsigned int height)
+Image::Image(unsigned int width, unsigned int height, PixelFormat format, PixelLayout layout)
 {
 	this->width = width;
 	this->height = height;
-	pixels = new Color[width*height];
-	memset(pixels, 0, width * height * sizeof(Color));
+	this->format = format;
+	this->layout = layout;
+	pixels = NULL;
+	size_t size = ComputeLayout();
+	SetBuffer(CreateBuffer(size));
+	memset(pixels, 0, size);
+	MarkAllDirty();
 }
 
-// Copy constructor
+// Copy constructor, the pixels are shared until one of the images is modified
 Image::Image(const Image& c)
 {
 	pixels = NULL;
 	width = c.width;
 	height = c.height;
 	bytes_per_pixel = c.bytes_per_pixel;
-	if(c.pixels)
+	stride = c.stride;
+	format = c.format;
+	layout = c.layout;
+	tiles_x = c.tiles_x;
+	CopyDirty(c);
+	if(c.buffer)
 	{
-		pixels = new Color[width*height];
-		memcpy(pixels, c.pixels, width*height*bytes_per_pixel);
+		c.buffer->refs.fetch_add(1, std::memory_order_relaxed);
+		buffer = c.buffer;
+		pixels = buffer->data;
 	}
 }
 
+Image::Image(const ImageView& view) : Image(view.width, view.height, view.format)
+{
+	GetView().CopyFrom(view);
+}
+
 // Assign operator
 Image& Image::operator = (const Image& c)
 {
-	if(pixels) delete pixels;
-	pixels = NULL;
+	if (this == &c)
+		return *this;
+
+	if (c.buffer)
+		c.buffer->refs.fetch_add(1, std::memory_order_relaxed);
+	ReleaseBuffer(buffer);
+	buffer = c.buffer;
+	pixels = buffer ? buffer->data : NULL;
 
 	width = c.width;
 	height = c.height;
 	bytes_per_pixel = c.bytes_per_pixel;
+	stride = c.stride;
+	format = c.format;
+	layout = c.layout;
+	tiles_x = c.tiles_x;
+	CopyDirty(c);
+	return *this;
+}
 
-	if(c.pixels)
-	{
-		pixels = new Color[width*height*bytes_per_pixel];
-		memcpy(pixels, c.pixels, width*height*bytes_per_pixel);
-	}
+// Move constructor, steals the buffer of c
+Image::Image(Image&& c)
+{
+	width = c.width;
+	height = c.height;
+	bytes_per_pixel = c.bytes_per_pixel;
+	stride = c.stride;
+	format = c.format;
+	layout = c.layout;
+	tiles_x = c.tiles_x;
+	buffer = c.buffer;
+	pixels = c.pixels;
+	CopyDirty(c);
+
+	c.buffer = NULL;
+	c.pixels = NULL;
+	c.width = c.height = c.stride = 0;
+	c.num_dirty_rects = 0;
+}
+
+// Move assign operator
+Image& Image::operator = (Image&& c)
+{
+	if (this == &c)
+		return *this;
+
+	ReleaseBuffer(buffer);
+
+	width = c.width;
+	height = c.height;
+	bytes_per_pixel = c.bytes_per_pixel;
+	stride = c.stride;
+	format = c.format;
+	layout = c.layout;
+	tiles_x = c.tiles_x;
+	buffer = c.buffer;
+	pixels = c.pixels;
+	CopyDirty(c);
+
+	c.buffer = NULL;
+	c.pixels = NULL;
+	c.width = c.height = c.stride = 0;
+	c.num_dirty_rects = 0;
 	return *this;
 }
 
 Image::~Image()
 {
-	if(pixels) 
-		delete pixels;
+	ReleaseBuffer(buffer);
+}
+
+void Image::SetBuffer(PixelBuffer* new_buffer)
+{
+	ReleaseBuffer(buffer);
+	buffer = new_buffer;
+	pixels = buffer ? buffer->data : NULL;
+}
+
+// Gives this image its own copy of a shared buffer
+void Image::Unshare(bool keep_content)
+{
+	PixelBuffer* new_buffer = CreateBuffer(buffer->size);
+	if (keep_content)
+		memcpy(new_buffer->data, buffer->data, buffer->size);
+	SetBuffer(new_buffer);
+}
+
+void Image::CopyDirty(const Image& c)
+{
+	num_dirty_rects = c.num_dirty_rects;
+	std::copy(c.dirty_rects, c.dirty_rects + c.num_dirty_rects, dirty_rects);
+}
+
+static bool DirtyRectsTouch(const Image::DirtyRect& a, const Image::DirtyRect& b)
+{
+	return a.x <= b.x + b.w && b.x <= a.x + a.w && a.y <= b.y + b.h && b.y <= a.y + a.h;
+}
+
+static Image::DirtyRect DirtyRectsUnion(const Image::DirtyRect& a, const Image::DirtyRect& b)
+{
+	Image::DirtyRect r;
+	r.x = std::min(a.x, b.x);
+	r.y = std::min(a.y, b.y);
+	r.w = std::max(a.x + a.w, b.x + b.w) - r.x;
+	r.h = std::max(a.y + a.h, b.y + b.h) - r.y;
+	return r;
+}
+
+void Image::MarkDirty(int x, int y, int w, int h)
+{
+	int x0 = std::max(x, 0), y0 = std::max(y, 0);
+	int x1 = std::min(x + w, (int)width), y1 = std::min(y + h, (int)height);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	DirtyRect r = { x0, y0, x1 - x0, y1 - y0 };
+	while (true) {
+		// Absorb every rectangle that overlaps or touches the new one, the union can reach more
+		for (unsigned int i = 0; i < num_dirty_rects; ) {
+			if (DirtyRectsTouch(r, dirty_rects[i])) {
+				r = DirtyRectsUnion(r, dirty_rects[i]);
+				dirty_rects[i] = dirty_rects[--num_dirty_rects];
+				i = 0;
+			}
+			else
+				++i;
+		}
+		if (num_dirty_rects < MAX_DIRTY_RECTS) {
+			dirty_rects[num_dirty_rects++] = r;
+			return;
+		}
+
+		// The list is full, join the rectangle whose area grows the least
+		unsigned int best = 0;
+		int64_t best_growth = INT64_MAX;
+		for (unsigned int i = 0; i < num_dirty_rects; ++i) {
+			DirtyRect u = DirtyRectsUnion(r, dirty_rects[i]);
+			int64_t growth = (int64_t)u.w * u.h - (int64_t)dirty_rects[i].w * dirty_rects[i].h;
+			if (growth < best_growth) {
+				best_growth = growth;
+				best = i;
+			}
+		}
+		r = DirtyRectsUnion(r, dirty_rects[best]);
+		dirty_rects[best] = dirty_rects[--num_dirty_rects];
+	}
+}
+
+unsigned int Image::GetStride(PixelFormat format, unsigned int width)
+{
+	unsigned int row_size = width * GetBytesPerPixel(format);
+	if (format == RGBA8 || format == RGBX8)
+		row_size = (row_size + 63) & ~63u;
+	return row_size;
+}
+
+size_t Image::ComputeLayout()
+{
+	bytes_per_pixel = GetBytesPerPixel(format);
+	if (layout == LINEAR) {
+		tiles_x = 0;
+		stride = GetStride(format, width);
+		return (size_t)stride * height;
+	}
+
+	// Partial tiles at the right and bottom borders are stored complete
+	tiles_x = (width + TILE_MASK) >> TILE_SHIFT;
+	unsigned int tiles_y = (height + TILE_MASK) >> TILE_SHIFT;
+	stride = TILE_SIZE * bytes_per_pixel;
+	return (size_t)tiles_x * tiles_y * TILE_SIZE * stride;
+}
+
+void Image::ConvertPixels(const unsigned char* src, PixelFormat src_format, unsigned char* dst, PixelFormat dst_format, unsigned int count)
+{
+	bool src32 = src_format == RGBA8 || src_format == RGBX8;
+	bool dst32 = dst_format == RGBA8 || dst_format == RGBX8;
+
+	// RGBX8 already has alpha 255, so it can go to RGBA8 unchanged
+	if (src_format == dst_format || (src_format == RGBX8 && dst_format == RGBA8))
+		PixelKernels::Copy(dst, src, (size_t)count * GetBytesPerPixel(src_format));
+	else if (src_format == RGBA8 && dst_format == RGBX8)
+		PixelKernels::ConvertRGBAToRGBX((uint32_t*)dst, (const uint32_t*)src, count);
+	else if (src_format == RGB8 && dst32)
+		PixelKernels::ConvertRGBToRGBX((uint32_t*)dst, src, count);
+	else if (src32 && dst_format == RGB8)
+		PixelKernels::ConvertRGBXToRGB(dst, (const uint32_t*)src, count);
+	else if (src32 && dst_format == GRAY8)
+		PixelKernels::ConvertRGBXToGray(dst, (const uint32_t*)src, count);
+	else if (src_format == RGB8 && dst_format == GRAY8)
+		PixelKernels::ConvertRGBToGray(dst, src, count);
+	else if (src_format == GRAY8 && dst32)
+		PixelKernels::ConvertGrayToRGBX((uint32_t*)dst, src, count);
+	else if (src_format == GRAY8 && dst_format == RGB8)
+		PixelKernels::ConvertGrayToRGB(dst, src, count);
+}
+
+void Image::SetFormat(PixelFormat format)
+{
+	if (this->format == format)
+		return;
+
+	PixelFormat old_format = this->format;
+	unsigned int old_stride = stride;
+	this->format = format;
+	size_t size = ComputeLayout();
+
+	PixelBuffer* new_buffer = NULL;
+	if (buffer)
+	{
+		new_buffer = CreateBuffer(size);
+		if (layout == LINEAR) {
+			for (unsigned int y = 0; y < height; ++y)
+				ConvertPixels(pixels + (size_t)y * old_stride, old_format, new_buffer->data + (size_t)y * stride, format, width);
+		}
+		else // Tiles keep their order, so the whole buffer is converted at once
+			ConvertPixels(pixels, old_format, new_buffer->data, format, (unsigned int)(size / bytes_per_pixel));
+	}
+	SetBuffer(new_buffer);
+	MarkAllDirty();
+}
+
+void Image::SetLayout(PixelLayout layout)
+{
+	if (this->layout == layout)
+		return;
+
+	Image result(width, height, format, layout);
+	if (buffer)
+	{
+		// Copy tile by tile, every row of a tile is contiguous in both layouts
+		const Image& src = *this;
+		result.ForEachTile([&](unsigned int x0, unsigned int y0, unsigned int w, unsigned int h, unsigned char* data, unsigned int tile_stride) {
+			for (unsigned int y = 0; y < h; ++y)
+				memcpy(data + (size_t)y * tile_stride, src.GetPixelPtr(x0, y0 + y), w * bytes_per_pixel);
+		});
+	}
+	else
+		result.SetBuffer(NULL);
+	result.CopyDirty(*this); // Same content, only the layout changes
+	*this = std::move(result);
 }
 
 void Image::Render()
 {
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glDrawPixels(width, height, bytes_per_pixel == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	// OpenGL only understands rows
+	if (layout == TILED) {
+		Image linear = *this;
+		linear.SetLayout(LINEAR);
+		linear.Render();
+		return;
+	}
+
+	GLenum gl_format = GL_RGB;
+	if (format == RGBA8 || format == RGBX8) gl_format = GL_RGBA;
+	else if (format == GRAY8) gl_format = GL_LUMINANCE;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, bytes_per_pixel == 4 ? 4 : 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / bytes_per_pixel);
+	glDrawPixels(width, height, gl_format, GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+void Image::Fill(const Color& c)
+{
+	if (!pixels || !width)
+		return;
+
+	// Everything is overwritten, no need to copy a shared buffer
+	Detach(false);
+
+	// The whole buffer is filled in one pass, row padding and partial tiles included
+	unsigned char pixel[4];
+	PackColor(format, c, pixel);
+	size_t count = buffer->size / bytes_per_pixel;
+	if (bytes_per_pixel == 4) {
+		uint32_t value;
+		memcpy(&value, pixel, 4);
+		PixelKernels::Fill32((uint32_t*)pixels, value, count);
+	}
+	else if (bytes_per_pixel == 3)
+		PixelKernels::Fill24(pixels, pixel, count);
+	else
+		PixelKernels::Fill8(pixels, pixel[0], count);
+	MarkAllDirty();
 }
 
 // Change image size (the old one will remain in the top-left corner)
 void Image::Resize(unsigned int width, unsigned int height)
 {
-	Color* new_pixels = new Color[width*height];
+	Image result(width, height, format, layout);
 	unsigned int min_width = this->width > width ? width : this->width;
 	unsigned int min_height = this->height > height ? height : this->height;
 
-	for(unsigned int x = 0; x < min_width; ++x)
-		for(unsigned int y = 0; y < min_height; ++y)
-			new_pixels[ y * width + x ] = GetPixel(x,y);
-
-	delete pixels;
-	this->width = width;
-	this->height = height;
-	pixels = new_pixels;
+	if (buffer) {
+		const Image& src = *this;
+		result.ForEachTile(0, 0, min_width, min_height, [&](unsigned int x0, unsigned int y0, unsigned int w, unsigned int h, unsigned char* data, unsigned int tile_stride) {
+			for(unsigned int y = 0; y < h; ++y)
+				PixelKernels::Copy(data + (size_t)y * tile_stride, src.GetPixelPtr(x0, y0 + y), w * bytes_per_pixel);
+		});
+	}
+	*this = std::move(result);
 }
 
 // Change image size and scale the content
-void Image::Scale(unsigned int width, unsigned int height)
+void Image::Scale(unsigned int width, unsigned int height, ResampleFilter filter)
 {
-	Color* new_pixels = new Color[width*height];
+	if (width == this->width && height == this->height)
+		return;
 
-	for(unsigned int x = 0; x < width; ++x)
-		for(unsigned int y = 0; y < height; ++y)
-			new_pixels[ y * width + x ] = GetPixel((unsigned int)(this->width * (x / (float)width)), (unsigned int)(this->height * (y / (float)height)) );
+	// The resampler reads and writes whole rows, tiled images go through a linear copy
+	Image result(width, height, format);
+	if (layout == TILED) {
+		Image linear = *this;
+		linear.SetLayout(LINEAR);
+		Resampler::Resample(linear.GetView(), result.GetView(), filter);
+		result.SetLayout(TILED);
+	}
+	else {
+		const Image& src = *this;
+		Resampler::Resample(src.GetView(), result.GetView(), filter);
+	}
 
-	delete pixels;
-	this->width = width;
-	this->height = height;
-	pixels = new_pixels;
+	*this = std::move(result);
 }
 
-Image Image::GetArea(unsigned int start_x, unsigned int start_y, unsigned int width, unsigned int height)
+unsigned int Image::GetBandHeight() const
 {
-	Image result(width, height);
-	for(unsigned int x = 0; x < width; ++x)
-		for(unsigned int y = 0; y < height; ++x)
-		{
-			if( (x + start_x) < this->width && (y + start_y) < this->height) 
-				result.SetPixel( x, y, GetPixel(x + start_x,y + start_y) );
+	// Around 32K pixels per band, with at least 4 bands per thread to balance the load
+	const unsigned int grain_pixels = 32 * 1024;
+	unsigned int threads = ThreadPool::Get().GetNumThreads();
+	unsigned int band = std::max(1u, grain_pixels / std::max(width, 1u));
+	band = std::min(band, std::max(1u, (height + threads * 4 - 1) / (threads * 4)));
+	if (layout == TILED)
+		band = (band + TILE_MASK) & ~TILE_MASK;
+	return band;
+}
+
+Image Image::GetArea(unsigned int start_x, unsigned int start_y, unsigned int width, unsigned int height) const
+{
+	Image result(width, height, format);
+	if (start_x < this->width && start_y < this->height) {
+		if (layout == LINEAR)
+			result.GetView().CopyFrom(GetView(start_x, start_y, width, height));
+		else {
+			unsigned int w = std::min(width, this->width - start_x);
+			unsigned int h = std::min(height, this->height - start_y);
+			for(unsigned int y = 0; y < h; ++y)
+				for(unsigned int x = 0; x < w; ++x)
+					result.SetPixel(x, y, GetPixel(x + start_x, y + start_y));
 		}
+	}
+	result.SetLayout(layout);
 	return result;
 }
 
+ImageView Image::GetView()
+{
+	Detach();
+	return ((const Image*)this)->GetView();
+}
+
+ImageView Image::GetView(int x, int y, int w, int h)
+{
+	return GetView().GetArea(x, y, w, h);
+}
+
+ImageView Image::GetView() const
+{
+	assert(layout == LINEAR);
+	return ImageView(pixels, width, height, stride, format);
+}
+
+ImageView Image::GetView(int x, int y, int w, int h) const
+{
+	return GetView().GetArea(x, y, w, h);
+}
+
 void Image::FlipY()
 {
-	int row_size = bytes_per_pixel * width;
-	Uint8* temp_row = new Uint8[row_size];
-#pragma omp simd
-	for (int y = 0; y < height * 0.5; y += 1)
-	{
-		Uint8* pos = (Uint8*)pixels + y * row_size;
-		memcpy(temp_row, pos, row_size);
-		Uint8* pos2 = (Uint8*)pixels + (height - y - 1) * row_size;
-		memcpy(pos, pos2, row_size);
-		memcpy(pos2, temp_row, row_size);
+	if (layout == TILED) {
+		SetLayout(LINEAR);
+		FlipY();
+		SetLayout(TILED);
+		return;
 	}
-	delete[] temp_row;
+
+	GetView().FlipY();
+	MarkAllDirty();
 }
 
 bool Image::LoadPNG(const char* filename, bool flip_y)
@@ -151,36 +510,29 @@ bool Image::LoadPNG(const char* filename, bool flip_y)
 		buffer.clear();
 
 	std::vector<unsigned char> out_image;
+	unsigned int png_width, png_height;
 
-	if (decodePNG(out_image, width, height, buffer.empty() ? 0 : &buffer[0], (unsigned long)buffer.size(), true) != 0)
+	if (decodePNG(out_image, png_width, png_height, buffer.empty() ? 0 : &buffer[0], (unsigned long)buffer.size(), true) != 0)
 		return false;
 
-	size_t bufferSize = out_image.size();
-	unsigned int originalBytesPerPixel = (unsigned int)bufferSize / (width * height);
-	
-	// Force 3 channels
-	bytes_per_pixel = 3;
-
-	if (originalBytesPerPixel == 3) {
-		pixels = new Color[bufferSize];
-		memcpy(pixels, &out_image[0], bufferSize);
-	}
-	else if (originalBytesPerPixel == 4) {
+	// The decoder always returns RGBA, convert it to the format of this image.
+	// Tiled images are decoded as linear and converted at the end
+	PixelLayout target_layout = layout;
+	width = png_width;
+	height = png_height;
+	layout = LINEAR;
+	SetBuffer(CreateBuffer(ComputeLayout()));
 
-		unsigned int newBufferSize = width * height * bytes_per_pixel;
-		pixels = new Color[newBufferSize];
-
-		unsigned int k = 0;
-		for (unsigned int i = 0; i < bufferSize; i += originalBytesPerPixel) {
-			pixels[k] = Color(out_image[i], out_image[i + 1], out_image[i + 2]);
-			k++;
-		}
-	}
+	for (unsigned int y = 0; y < height; ++y)
+		ConvertPixels(&out_image[(size_t)y * width * 4], RGBA8, GetRow(y), format, width);
+	MarkAllDirty();
 
 	// Flip pixels in Y
 	if (flip_y)
 		FlipY();
 
+	SetLayout(target_layout);
+
 	return true;
 }
 
@@ -231,7 +583,7 @@ bool Image::LoadTGA(const char* filename, bool flip_y)
 	if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
 	{
 		if (tgainfo->data != NULL)
-			delete tgainfo->data;
+			delete[] tgainfo->data;
             
 		fclose(file);
 		delete tgainfo;
@@ -241,39 +593,58 @@ bool Image::LoadTGA(const char* filename, bool flip_y)
 	fclose(file);
 
 	// Save info in image
-	if(pixels)
-		delete pixels;
-
 	width = tgainfo->width;
 	height = tgainfo->height;
-	pixels = new Color[width*height];
+	SetBuffer(CreateBuffer(ComputeLayout()));
 
-	// Convert to float all pixels
+	// The file is BGR(A), swap the channels one row at a time and convert to our format
+	unsigned int row_size = width * bytesPerPixel;
+	unsigned char* temp_row = AllocPixels(row_size);
 	for (unsigned int y = 0; y < height; ++y) {
-		for (unsigned int x = 0; x < width; ++x) {
-			unsigned int pos = y * width * bytesPerPixel + x * bytesPerPixel;
-			// Make sure we don't access out of memory
-			if( (pos < imageSize) && (pos + 1 < imageSize) && (pos + 2 < imageSize))
-				SetPixel(x, height - y - 1, Color(tgainfo->data[pos + 2], tgainfo->data[pos + 1], tgainfo->data[pos]));
+		const unsigned char* src = tgainfo->data + (size_t)y * row_size;
+		unsigned int dst_y = height - y - 1;
+		if (bytesPerPixel == 3)
+			PixelKernels::SwapRedBlue24(temp_row, src, width);
+		else
+			PixelKernels::SwapRedBlue32((uint32_t*)temp_row, (const uint32_t*)src, width);
+
+		// 32 bits are RGBA, so RGBA8 images keep the alpha. A row is one span when LINEAR and one per tile when TILED
+		PixelFormat src_format = bytesPerPixel == 3 ? RGB8 : RGBA8;
+		unsigned int count;
+		for (unsigned int x = 0; x < width; x += count) {
+			unsigned char* dst = GetSpan(x, dst_y, count);
+			ConvertPixels(temp_row + x * bytesPerPixel, src_format, dst, format, count);
 		}
 	}
+	FreePixels(temp_row, row_size);
+	MarkAllDirty();
 
 	// Flip pixels in Y
 	if (flip_y)
 		FlipY();
 
-	delete tgainfo->data;
+	delete[] tgainfo->data;
 	delete tgainfo;
 
 	return true;
 }
 
 // Saves the image to a TGA file
-bool Image::SaveTGA(const char* filename)
+bool Image::SaveTGA(const char* filename, bool in_res)
+{
+	if (layout == TILED) {
+		Image linear = *this;
+		linear.SetLayout(LINEAR);
+		return SaveTGA(filename, linear.GetView(), in_res);
+	}
+	return SaveTGA(filename, GetView(), in_res);
+}
+
+bool Image::SaveTGA(const char* filename, const ImageView& view, bool in_res)
 {
 	unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
-	std::string fullPath = absResPath(filename);
+	std::string fullPath = in_res ? absResPath(filename) : std::string(filename);
 	std::cout << "Saving image to: " << fullPath << std::endl;
 
 	FILE *file = fopen(fullPath.c_str(), "wb");
@@ -284,75 +655,73 @@ bool Image::SaveTGA(const char* filename)
 	}
 
 	unsigned short header_short[3];
-	header_short[0] = width;
-	header_short[1] = height;
+	header_short[0] = view.width;
+	header_short[1] = view.height;
 	unsigned char* header = (unsigned char*)header_short;
-	header[4] = 24;
-	header[5] = 0;
+	// RGBA8 is saved with its alpha as 32 bits, the rest as 24
+	bool alpha = view.format == RGBA8;
+	unsigned int bytes_per_pixel = alpha ? 4 : 3;
+	header[4] = alpha ? 32 : 24;
+	header[5] = alpha ? 8 : 0; // Bits of alpha per pixel
 
 	fwrite(TGAheader, 1, sizeof(TGAheader), file);
 	fwrite(header, 1, 6, file);
 
-	// Convert pixels to unsigned char
-	unsigned char* bytes = new unsigned char[width*height*3];
-	for(unsigned int y = 0; y < height; ++y)
-		for(unsigned int x = 0; x < width; ++x)
-		{
-			Color c = pixels[y*width+x];
-			unsigned int pos = (y*width+x)*3;
-			bytes[pos+2] = c.r;
-			bytes[pos+1] = c.g;
-			bytes[pos] = c.b;
+	// Convert pixels to BGR(A), one row at a time
+	unsigned int row_size = view.width * bytes_per_pixel;
+	unsigned char* bytes = AllocPixels(row_size);
+	for(unsigned int y = 0; y < view.height; ++y)
+	{
+		if (alpha)
+			PixelKernels::SwapRedBlue32((uint32_t*)bytes, (const uint32_t*)view.GetRow(y), view.width);
+		else {
+			ConvertPixels(view.GetRow(y), view.format, bytes, RGB8, view.width);
+			PixelKernels::SwapRedBlue24(bytes, bytes, view.width);
 		}
-
-	fwrite(bytes, 1, width*height*3, file);
+		fwrite(bytes, 1, row_size, file);
+	}
+	FreePixels(bytes, row_size);
 	fclose(file);
 
 	return true;
 }
 
 void Image::DrawLineDDA(int x0, int y0, int x1, int y1, const Color& c) {
+	if (!pixels || !width || !height)
+		return;
+	MarkDirty(std::min(x0, x1), std::min(y0, y1), abs(x1 - x0) + 1, abs(y1 - y0) + 1);
 
-	// Calculate dx, dy and the largest leg of the triangle
-	float dx = x1 - x0;
-	float dy = y1 - y0;
-	float d = std::max(abs(dx), abs(dy));
-
-	// Calculate the direction step vector v
-	float vx = dx / d;
-	float vy = dy / d;
-
-	// Start drawing the line
-	float x = static_cast<float>(x0);
-	float y = static_cast<float>(y0);
-
-	for (int i = 0; i <= d; ++i) {
-		// Paint pixel at position [floor(x), floor(y)]
-		float pixelX = std::floor(x);
-		float pixelY = std::floor(y);
-		// Ensure the pixel is within the image boundaries
-		if (pixelX >= 0 && pixelX < width && pixelY >= 0 && pixelY < height) {
-			SetPixel(pixelX, pixelY, c);
-		}
+	unsigned char pixel[4];
+	PackColor(format, c, pixel);
+	Detach();
 
-		// Increment x and y by v
-		x += vx;
-		y += vy;
-	}
+	// Only the part inside the image is walked, flat runs are filled as spans
+	LineRasterizer::Rasterize(x0, y0, x1, y1, 0, 0, width - 1, height - 1, [&](int x, int y, int count) {
+		if (count == 1)
+			memcpy(pixels + GetPixelOffset(x, y), pixel, bytes_per_pixel);
+		else
+			WriteSpan(x, y, count, pixel);
+	});
+}
 
+void Image::FillRect(int x, int y, int w, int h, const Color& c)
+{
+	// Clipped once, then every row is a single span fill
+	int x0 = std::max(x, 0), y0 = std::max(y, 0);
+	int x1 = std::min(x + w, (int)width), y1 = std::min(y + h, (int)height);
+	if (!pixels || x0 >= x1 || y0 >= y1)
+		return;
+	MarkDirty(x0, y0, x1 - x0, y1 - y0);
+
+	unsigned char pixel[4];
+	PackColor(format, c, pixel);
+	for (int row = y0; row < y1; ++row)
+		WriteSpan(x0, row, x1 - x0, pixel);
 }
 
 void Image::DrawRect(int x, int y, int w, int h, const Color& c)
 {
-	for (int i = 0; i < w; ++i) {
-		SetPixel(x + i, y, c);
-		SetPixel(x + i, y + h - 1, c);
-	}
-
-	for (int j = 0; j < h; ++j) {
-		SetPixel(x, y + j, c);
-		SetPixel(x + w - 1, y + j, c);
-	}
+	DrawRectUpdate(x, y, w, h, c, 1, false, c);
 }
 
 void Image::DrawRectUpdate(int x, int y, int w, int h, const Color& borderColor,
@@ -362,158 +731,947 @@ void Image::DrawRectUpdate(int x, int y, int w, int h, const Color& borderColor,
 		std::cerr << "Error: Border width must be greater than 0." << std::endl;
 		return;
 	}
+	if (w <= 0 || h <= 0)
+		return;
 
-	// Draw filled rectangle
-	if (isFilled) {
-		for (int i = 0; i < w; ++i) {
-			for (int j = 0; j < h; ++j) {
-				SetPixelSafe(x + i, y + j, fillColor);
-			}
+	// The border grows outwards from the edges of the rectangle, along them only, so the outer
+	// corners stay notched. It is split in rectangles that do not overlap, each pixel is written once.
+	int b = borderWidth - 1;
+	int right = x + w - 1, bottom = y + h - 1;
+	FillRect(x, y - b, w, b, borderColor); // Outside the top edge
+	FillRect(x - b, y, w + 2 * b, 1, borderColor); // Top edge, with the left and right bands
+	if (h > 1)
+		FillRect(x - b, bottom, w + 2 * b, 1, borderColor); // Bottom edge
+	FillRect(x, bottom + 1, w, b, borderColor); // Outside the bottom edge
+
+	// Rows between the edges: left band, inside and right band
+	if (h > 2) {
+		if (w <= 2)
+			FillRect(x - b, y + 1, w + 2 * b, h - 2, borderColor);
+		else {
+			FillRect(x - b, y + 1, b + 1, h - 2, borderColor);
+			if (isFilled)
+				FillRect(x + 1, y + 1, w - 2, h - 2, fillColor);
+			FillRect(right, y + 1, b + 1, h - 2, borderColor);
 		}
 	}
+}
+
+void Image::DrawCircle(int x, int y, int r, const Color& borderColor,
+	int borderWidth, bool isFilled, const Color& fillColor) {
 
-	// Draw border
-	for (int i = 0; i < borderWidth; ++i) {
+	// The fill stops where the border starts, so no pixel is written twice
+	if (isFilled)
+		FillDisk(x, y, borderWidth > 0 ? r - 1 : r, fillColor);
 
-		//Draw border horizontal
-		for (int j = 0; j < w; ++j) {
-			SetPixelSafe(x + j, y - i, borderColor);
-			SetPixelSafe(x + j, y + h - 1 + i, borderColor);
-		}
-		//Draw border vertical
-		for (int j = 0; j < h; ++j) {
-			SetPixelSafe(x - i, y + j, borderColor);
-			SetPixelSafe(x + w - 1 + i, y + j, borderColor);
+	// The border covers from r to r + borderWidth - 1, as the difference of two disks
+	if (borderWidth > 0)
+		FillRing(x, y, r, r + borderWidth - 1, borderColor);
+}
+
+static int64_t ISqrt(int64_t v)
+{
+	int64_t s = (int64_t)std::sqrt((double)v);
+	while (s > 0 && s * s > v)
+		s--;
+	while ((s + 1) * (s + 1) <= v)
+		s++;
+	return s;
+}
+
+// a * b in 128 bits as hi, lo, with 32-bit halves so it does not need a compiler extension
+static void Multiply128(uint64_t a, uint64_t b, uint64_t& hi, uint64_t& lo)
+{
+	uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+	uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+	uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+	lo = (mid << 32) | (uint32_t)p00;
+	hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+// Largest dx with the pixel dx,dy inside the ellipse, -1 when the row is outside. A pixel is inside
+// when its center is within rx + 1/2, ry + 1/2, so a circle takes the distances that round to r or less.
+static int EllipseHalfWidth(int rx, int ry, int64_t dy)
+{
+	dy = dy < 0 ? -dy : dy;
+	if (rx < 0 || ry < 0 || dy > ry)
+		return -1;
+	if (rx == ry)
+		return (int)ISqrt((int64_t)rx * rx + rx - dy * dy);
+
+	// (2 dx b)^2 <= a^2 (b^2 - (2 dy)^2) with a = 2 rx + 1 and b = 2 ry + 1. Every factor fits in 64 bits
+	// for any int radii and the products are compared in 128, so it is exact for all of them.
+	uint64_t a = 2 * (uint64_t)rx + 1, b = 2 * (uint64_t)ry + 1;
+	uint64_t right_hi, right_lo;
+	Multiply128(a * a, b * b - 4 * (uint64_t)dy * dy, right_hi, right_lo);
+	auto inside = [&](int64_t dx) {
+		uint64_t side = 2 * (uint64_t)dx * b, left_hi, left_lo;
+		Multiply128(side, side, left_hi, left_lo);
+		return left_hi < right_hi || (left_hi == right_hi && left_lo <= right_lo);
+	};
+
+	// The estimate in double is off by a step at most, the exact test settles it
+	double estimate = (double)a * std::sqrt((double)b * b - 4.0 * (double)dy * dy) / (2.0 * (double)b);
+	int64_t dx = std::min((int64_t)rx, (int64_t)estimate);
+	while (dx > 0 && !inside(dx))
+		dx--;
+	while (dx < rx && inside(dx + 1))
+		dx++;
+	return (int)dx;
+}
+
+void Image::FillEllipse(int x, int y, int rx, int ry, const Color& c)
+{
+	FillEllipseSpans(x, y, rx, ry, -1, -1, c);
+}
+
+void Image::FillRing(int x, int y, int r0, int r1, const Color& c)
+{
+	int hole = r0 > 0 ? r0 - 1 : -1;
+	FillEllipseSpans(x, y, r1, r1, hole, hole, c);
+}
+
+// Calls span(x, y, count) for the rows of the ellipse rx,ry without the ellipse hole_rx,hole_ry (no hole when
+// they are negative) clipped to width x height. Returns false when nothing is inside, else box is x0,y0,x1,y1.
+// The box, the rows and the spans are in 64 bits, x - rx or 2 rx + 1 overflow an int for big radii.
+template <typename F>
+static bool RasterizeEllipse(int x, int y, int rx, int ry, int hole_rx, int hole_ry, unsigned int width, unsigned int height, int box[4], F span)
+{
+	if (!width || !height || rx < 0 || ry < 0)
+		return false;
+	int64_t box_x0 = std::max((int64_t)x - rx, (int64_t)0), box_x1 = std::min((int64_t)x + rx, (int64_t)width - 1);
+	int64_t box_y0 = std::max((int64_t)y - ry, (int64_t)0), box_y1 = std::min((int64_t)y + ry, (int64_t)height - 1);
+	if (box_x0 > box_x1 || box_y0 > box_y1)
+		return false;
+	box[0] = (int)box_x0;
+	box[1] = (int)box_y0;
+	box[2] = (int)box_x1;
+	box[3] = (int)box_y1;
+
+	auto clipped = [&](int64_t x0, int64_t x1, int row) {
+		x0 = std::max(x0, box_x0);
+		x1 = std::min(x1, box_x1);
+		if (x0 <= x1)
+			span((int)x0, row, (int)(x1 - x0 + 1));
+	};
+
+	// Only the rows inside the image are computed
+	for (int row = (int)box_y0; row <= (int)box_y1; ++row) {
+		int64_t dy = (int64_t)row - y;
+		int64_t outer = EllipseHalfWidth(rx, ry, dy);
+		int64_t inner = EllipseHalfWidth(hole_rx, hole_ry, dy);
+		if (inner < 0)
+			clipped(x - outer, x + outer, row);
+		else {
+			clipped(x - outer, x - inner - 1, row);
+			clipped(x + inner + 1, x + outer, row);
 		}
 	}
+	return true;
 }
 
-void Image::DrawCircle(int x, int y, int r, const Color& borderColor,
-	int borderWidth, bool isFilled, const Color& fillColor) {
+void Image::FillEllipseSpans(int x, int y, int rx, int ry, int hole_rx, int hole_ry, const Color& c)
+{
+	if (!pixels)
+		return;
+	unsigned char pixel[4];
+	PackColor(format, c, pixel);
+	int box[4];
+	if (RasterizeEllipse(x, y, rx, ry, hole_rx, hole_ry, width, height, box, [&](int x0, int row, int count) {
+		WriteSpan(x0, row, count, pixel);
+	}))
+		MarkDirty(box[0], box[1], box[2] - box[0] + 1, box[3] - box[1] + 1);
+}
 
-	int x1 = r;
-	int y1 = 0;
-	int v = 1 - x1;
+void Image::DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor) {
 
-	while (y1 <= x1) {
-		if (isFilled) {
+	// Fill the triangle using a different color
+	if (isFilled)
+		FillTriangle(p0, p1, p2, fillColor);
 
-			for (int i = x - x1; i <= x + x1; i++) { // revisa les X i ompla de forma vertical
-				SetPixelSafe(i, y1 + y, fillColor);
-				SetPixelSafe(i, y - y1, fillColor);
-			}
-			for (int j = x - y1; j <= x + y1; j++) { //Revisa les Y i ompla de forma horitzontal
-				SetPixelSafe(j, x1 + y, fillColor);
-				SetPixelSafe(j, y - x1, fillColor);
+
+	// Draw the border of the triangle as one stroke with mitered corners
+	if (borderWidth > 0) {
+		Vector2 corners[3] = { p0, p1, p2 };
+		DrawStroke(corners, 3, true, (float)borderWidth, borderColor);
+	}
+}
+
+
+void Image::FillTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& c)
+{
+	if (!pixels || !width || !height)
+		return;
+	float min_x = std::min(p0.x, std::min(p1.x, p2.x)), max_x = std::max(p0.x, std::max(p1.x, p2.x));
+	float min_y = std::min(p0.y, std::min(p1.y, p2.y)), max_y = std::max(p0.y, std::max(p1.y, p2.y));
+	int x0, y0, x1, y1;
+	TriangleRasterizer::GetPixelRange(min_x, max_x, width, x0, x1);
+	TriangleRasterizer::GetPixelRange(min_y, max_y, height, y0, y1);
+	MarkDirty(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+
+	// The rasterizer clips to the image and gives one span per row
+	unsigned char pixel[4];
+	PackColor(format, c, pixel);
+	TriangleRasterizer::Rasterize(p0, p1, p2, 0, 0, width - 1, height - 1, [&](int x, int y, int count) {
+		WriteSpan(x, y, count, pixel);
+	});
+}
+
+void Image::DrawTriangles(TriangleBatch& batch)
+{
+	if (!pixels || !width || !height)
+		return;
+	batch.Bin(width, height);
+	int x0, y0, x1, y1;
+	if (!batch.GetBounds(x0, y0, x1, y1))
+		return;
+	// Not from the bins, the buffer and the dirty list are not thread safe
+	Detach();
+	MarkDirty(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+
+	const std::vector<unsigned int>& used = batch.GetUsedBins();
+	ThreadPool::Get().ParallelFor((unsigned int)used.size(), 1, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int i = begin; i < end; ++i) {
+			unsigned int bin = used[i];
+			int bin_x = (int)(bin % batch.GetBinsX()) * TriangleBatch::BIN_SIZE;
+			int bin_y = (int)(bin / batch.GetBinsX()) * TriangleBatch::BIN_SIZE;
+			int bin_x1 = std::min(bin_x + TriangleBatch::BIN_SIZE, (int)width) - 1;
+			int bin_y1 = std::min(bin_y + TriangleBatch::BIN_SIZE, (int)height) - 1;
+
+			for (unsigned int index : batch.GetBin(bin)) {
+				const TriangleBatch::Triangle& t = batch.GetTriangle(index);
+				if (!t.smooth) {
+					unsigned char pixel[4];
+					PackColor(format, t.color, pixel);
+					TriangleRasterizer::Rasterize(t.p[0], t.p[1], t.p[2], bin_x, bin_y, bin_x1, bin_y1, [&](int x, int y, int count) {
+						WriteSpan(x, y, count, pixel);
+					});
+					continue;
+				}
+
+				// The colors are stepped along the span in 16.16 fixed point from the value at its first pixel
+				int step[3];
+				for (int c = 0; c < 3; ++c)
+					step[c] = (int)(t.dx[c] * 65536.0f);
+				TriangleRasterizer::Rasterize(t.p[0], t.p[1], t.p[2], bin_x, bin_y, bin_x1, bin_y1, [&](int x, int y, int count) {
+					int value[3];
+					for (int c = 0; c < 3; ++c)
+						value[c] = (int)((t.c0[c] + t.dx[c] * (x - t.p[0].x) + t.dy[c] * (y - t.p[0].y) + 0.5f) * 65536.0f);
+					while (count > 0) {
+						unsigned int n;
+						unsigned char* p = GetSpan(x, y, n);
+						n = std::min(n, (unsigned int)count);
+						for (unsigned int j = 0; j < n; ++j, p += bytes_per_pixel) {
+							Color color;
+							for (int c = 0; c < 3; ++c) {
+								color.v[c] = (unsigned char)std::min(std::max(value[c] >> 16, 0), 255);
+								value[c] += step[c];
+							}
+							PackColor(format, color, p);
+						}
+						x += n;
+						count -= n;
+					}
+				});
 			}
 		}
-		
-		for (int w = 0; w < borderWidth; w++) {
-			SetPixelSafe(x + x1 + w, y + y1, borderColor); // Second Octant
-			SetPixelSafe(x - x1 - w, y + y1, borderColor); // Fourth Octant
-			SetPixelSafe(x + x1 + w, y - y1, borderColor); // Sixth Octant
-			SetPixelSafe(x - x1 - w, y - y1, borderColor); // Eighth Octant
-			SetPixelSafe(x + y1, y + x1 + w, borderColor); // First Octant
-			SetPixelSafe(x - y1, y + x1 + w, borderColor); // Third Octant
-			SetPixelSafe(x + y1, y - x1 - w, borderColor); // Fifth Octant
-			SetPixelSafe(x - y1, y - x1 - w, borderColor); // Seventh Octant
+	});
+}
+
+void Image::DrawMesh(MeshRenderer& renderer, const Mesh& mesh, const Matrix44& model, Camera& camera, FloatImage& depth)
+{
+	if (!pixels || !width || !height)
+		return;
+	if (depth.width != width || depth.height != height) {
+		depth.Resize(width, height);
+		depth.Fill(1.0f);
+	}
+	renderer.Setup(mesh, model, camera, width, height);
+	int x0, y0, x1, y1;
+	if (!renderer.GetBounds(x0, y0, x1, y1))
+		return;
+	// Not from the bands, the buffer and the dirty list are not thread safe
+	Detach();
+	MarkDirty(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+
+	enum { Z = MeshRenderer::PLANE_Z, INV_W = MeshRenderer::PLANE_INV_W, SHADE = MeshRenderer::PLANE_SHADE,
+		U = MeshRenderer::PLANE_U, V = MeshRenderer::PLANE_V };
+	const TextureSampler* texture = renderer.texture;
+	const Color base = renderer.color;
+	const int first_band = y0 / MeshRenderer::BAND_HEIGHT;
+	const int bands = y1 / MeshRenderer::BAND_HEIGHT - first_band + 1;
+	ThreadPool::Get().ParallelFor(bands, 1, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int band = begin; band < end; ++band) {
+			int band_y0 = (first_band + band) * MeshRenderer::BAND_HEIGHT;
+			int band_y1 = std::min(band_y0 + MeshRenderer::BAND_HEIGHT, (int)height) - 1;
+
+			for (unsigned int i = 0; i < renderer.GetCount(); ++i) {
+				const MeshRenderer::Triangle& t = renderer.GetTriangle(i);
+				if (t.y1 < band_y0 || t.y0 > band_y1)
+					continue;
+				const bool flat = t.flat, textured = t.textured;
+				const float flat_shade = std::min(t.shade, 1.0f);
+				unsigned char flat_pixel[4];
+				PackColor(format, base * flat_shade, flat_pixel);
+
+				TriangleRasterizer::Rasterize(t.p[0], t.p[1], t.p[2], t.x0, band_y0, t.x1, band_y1, [&](int x, int y, int count) {
+					// The planes go in plain locals, as an array they would be stepped in memory
+					float fx = x - t.p[0].x, fy = y - t.p[0].y;
+					float pz = t.q0[Z] + t.dx[Z] * fx + t.dy[Z] * fy, dz = t.dx[Z];
+					float pw = t.q0[INV_W] + t.dx[INV_W] * fx + t.dy[INV_W] * fy, dw = t.dx[INV_W];
+					float ps = t.q0[SHADE] + t.dx[SHADE] * fx + t.dy[SHADE] * fy, ds = t.dx[SHADE];
+					float pu = t.q0[U] + t.dx[U] * fx + t.dy[U] * fy, du = t.dx[U];
+					float pv = t.q0[V] + t.dx[V] * fx + t.dy[V] * fy, dv = t.dx[V];
+					const float dw_y = t.dy[INV_W], du_y = t.dy[U], dv_y = t.dy[V];
+					float* z = depth.pixels + (size_t)y * width + x;
+
+					while (count > 0) {
+						unsigned int n;
+						unsigned char* p = GetSpan(x, y, n);
+						n = std::min(n, (unsigned int)count);
+						if (flat && !textured) {
+							for (unsigned int j = 0; j < n; ++j, p += bytes_per_pixel, ++z, pz += dz) {
+								if (pz < *z) {
+									*z = pz;
+									memcpy(p, flat_pixel, bytes_per_pixel);
+								}
+							}
+						}
+						else {
+							for (unsigned int j = 0; j < n; ++j, p += bytes_per_pixel, ++z) {
+								if (pz < *z) {
+									*z = pz;
+									// Back from the values divided by w, correct in perspective
+									float w = 1.0f / pw;
+									Color color = base * (flat ? flat_shade : std::min(ps * w, 1.0f));
+									if (textured) {
+										float u = pu * w, v = pv * w;
+										// Change of u and v to the next pixel, the derivatives of (u / w) / (1 / w)
+										float lod = texture->GetLevelOfDetail((du - u * dw) * w, (dv - v * dw) * w, (du_y - u * dw_y) * w, (dv_y - v * dw_y) * w);
+										Color texel = texture->Sample(u, v, lod);
+										for (int c = 0; c < 3; ++c)
+											color.v[c] = (unsigned char)((texel.v[c] * color.v[c] + 127) / 255);
+									}
+									PackColor(format, color, p);
+								}
+								pz += dz;
+								pw += dw;
+								ps += ds;
+								pu += du;
+								pv += dv;
+							}
+						}
+						x += n;
+						count -= n;
+					}
+				});
+			}
 		}
-		
-		y1++; //Para mover-se hacia abajo a lo largo del circulo
-		if (v <= 0) {
-			v += 2 * y1 + 1;
+	});
+}
+
+void Image::DrawStroke(const Vector2* points, unsigned int count, bool closed, float line_width, const Color& c,
+	Stroker::Join join, Stroker::Cap cap)
+{
+	// The geometry is rebuilt on every call, the stroker keeps its memory between them
+	static thread_local Stroker stroker;
+	stroker.Begin(line_width, join, cap);
+	stroker.Stroke(points, count, closed);
+	FillGeometry(stroker, c);
+}
+
+void Image::FillGeometry(Stroker& geometry, const Color& c)
+{
+	if (!pixels || !width || !height || geometry.IsEmpty())
+		return;
+
+	float min_x, min_y, max_x, max_y;
+	geometry.GetBounds(min_x, min_y, max_x, max_y);
+	int x0, y0, x1, y1;
+	TriangleRasterizer::GetPixelRange(min_x, max_x, width, x0, x1);
+	TriangleRasterizer::GetPixelRange(min_y, max_y, height, y0, y1);
+	MarkDirty(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+
+	unsigned char pixel[4];
+	PackColor(format, c, pixel);
+	geometry.Rasterize(0, 0, width - 1, height - 1, [&](int x, int y, int count) {
+		WriteSpan(x, y, count, pixel);
+	});
+}
+
+//**************************************
+// Anti-aliased primitives
+
+// The coverage of a pixel comes from the distance of its center to the edge of the shape, with a
+// one pixel wide ramp. It is close to what 4x supersampling gives, with one evaluation per pixel.
+static inline float CoverageOf(float inside)
+{
+	return std::min(std::max(inside + 0.5f, 0.0f), 1.0f);
+}
+
+static inline unsigned char CoverageByte(float coverage)
+{
+	return (unsigned char)(coverage * 255.0f + 0.5f);
+}
+
+// Row of coverage bytes reused by the calls of each thread
+static unsigned char* GetCoverageRow(unsigned int count)
+{
+	static thread_local std::vector<unsigned char> row;
+	if (row.size() < count)
+		row.resize(count);
+	return row.data();
+}
+
+// Grows min_x,max_x with the x of the segment p0-p1 between the rows y_lo and y_hi
+static void SegmentRowExtent(float x0, float y0, float x1, float y1, float y_lo, float y_hi, float& min_x, float& max_x)
+{
+	if (y0 > y1) {
+		std::swap(x0, x1);
+		std::swap(y0, y1);
+	}
+	if (y1 < y_lo || y0 > y_hi)
+		return;
+	float xa = x0, xb = x1;
+	if (y1 > y0) {
+		float k = (x1 - x0) / (y1 - y0);
+		xa = x0 + (std::max(y_lo, y0) - y0) * k;
+		xb = x0 + (std::min(y_hi, y1) - y0) * k;
+	}
+	min_x = std::min(min_x, std::min(xa, xb));
+	max_x = std::max(max_x, std::max(xa, xb));
+}
+
+// floor and ceil of a coordinate kept in [lo, hi] first, so far away values and NaN never overflow the int
+static inline int FloorClamped(float v, int lo, int hi)
+{
+	return (int)std::floor(std::min((float)hi, std::max((float)lo, v)));
+}
+
+static inline int CeilClamped(float v, int lo, int hi)
+{
+	return (int)std::ceil(std::min((float)hi, std::max((float)lo, v)));
+}
+
+// Blends a premultiplied color over count pixels of row y with their coverage, skipping the empty ends.
+// The caller clips and marks the area as dirty.
+static void BlendCoverageRow(Image& image, int x, int y, const unsigned char* coverage, int count, uint32_t color)
+{
+	int begin = 0, end = count;
+	while (begin < end && !coverage[begin])
+		begin++;
+	while (end > begin && !coverage[end - 1])
+		end--;
+	for (x += begin, coverage += begin; begin < end; ) {
+		unsigned int n;
+		unsigned char* p = image.GetSpan(x, y, n);
+		n = std::min(n, (unsigned int)(end - begin));
+		Compositor::CompositeRow(p, image.format, color, coverage, n, Image::BLEND_OVER);
+		x += n;
+		coverage += n;
+		begin += n;
+	}
+}
+
+// Segments of one stroke drawn by StrokeSegmentsAA, a line or the outline of a triangle
+#define MAX_STROKE_SEGMENTS 3
+
+// Strokes the segments points[i]-points[i + 1] with round ends as a single shape. The coverage of a pixel comes
+// from its distance to the closest segment and it is blended once, so where the segments meet nothing is
+// blended twice and the corners are not heavier than the rest. With closed the last point joins the first one.
+static void StrokeSegmentsAA(Image& image, const Vector2* points, int count, bool closed, const Color& c, float line_width)
+{
+	int segments = closed ? count : count - 1;
+	if (segments < 1 || segments > MAX_STROKE_SEGMENTS)
+		return;
+
+	// Distance from the segments to the centers that get some coverage
+	float half = std::max(line_width, 1.0f) * 0.5f;
+	float reach = half + 0.5f;
+	float x0[MAX_STROKE_SEGMENTS], y0[MAX_STROKE_SEGMENTS], dx[MAX_STROKE_SEGMENTS], dy[MAX_STROKE_SEGMENTS], inv_length2[MAX_STROKE_SEGMENTS];
+	float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+	for (int i = 0; i < segments; ++i) {
+		const Vector2& a = points[i];
+		const Vector2& b = points[(i + 1) % count];
+		x0[i] = a.x;
+		y0[i] = a.y;
+		dx[i] = b.x - a.x;
+		dy[i] = b.y - a.y;
+		float length2 = dx[i] * dx[i] + dy[i] * dy[i];
+		inv_length2[i] = length2 > 0.0f ? 1.0f / length2 : 0.0f;
+		min_x = std::min(min_x, std::min(a.x, b.x));
+		max_x = std::max(max_x, std::max(a.x, b.x));
+		min_y = std::min(min_y, std::min(a.y, b.y));
+		max_y = std::max(max_y, std::max(a.y, b.y));
+	}
+	uint32_t color = Compositor::PremultiplyColor(c, 255);
+
+	int row_lo, row_hi, col_lo, col_hi;
+	TriangleRasterizer::GetPixelRange(min_y - reach, max_y + reach, image.height, row_lo, row_hi);
+	TriangleRasterizer::GetPixelRange(min_x - reach, max_x + reach, image.width, col_lo, col_hi);
+	row_lo = std::max(row_lo, 0);
+	row_hi = std::min(row_hi, (int)image.height - 1);
+	col_lo = std::max(col_lo, 0);
+	col_hi = std::min(col_hi, (int)image.width - 1);
+	if (row_lo > row_hi || col_lo > col_hi)
+		return;
+	image.MarkDirty(col_lo, row_lo, col_hi - col_lo + 1, row_hi - row_lo + 1);
+
+	for (int y = row_lo; y <= row_hi; ++y) {
+		// Columns each segment can reach in this row, the ones that overlap are merged
+		int spans[MAX_STROKE_SEGMENTS][2];
+		int num_spans = 0;
+		for (int i = 0; i < segments; ++i) {
+			float row_min = FLT_MAX, row_max = -FLT_MAX;
+			SegmentRowExtent(x0[i], y0[i], x0[i] + dx[i], y0[i] + dy[i], y - reach, y + reach, row_min, row_max);
+			if (row_min > row_max)
+				continue;
+			int xa = FloorClamped(row_min - reach, col_lo, col_hi + 1);
+			int xb = CeilClamped(row_max + reach, col_lo - 1, col_hi);
+			if (xa > xb)
+				continue;
+			int k = num_spans++;
+			for (; k > 0 && spans[k - 1][0] > xa; --k) {
+				spans[k][0] = spans[k - 1][0];
+				spans[k][1] = spans[k - 1][1];
+			}
+			spans[k][0] = xa;
+			spans[k][1] = xb;
 		}
-		else {
-			x1--;
-			v += 2 * (y1 - x1 + 1);
 
+		for (int s = 0; s < num_spans; ) {
+			int xa = spans[s][0], xb = spans[s][1];
+			for (++s; s < num_spans && spans[s][0] <= xb + 1; ++s)
+				xb = std::max(xb, spans[s][1]);
+
+			unsigned char* coverage = GetCoverageRow(xb - xa + 1);
+			for (int x = xa; x <= xb; ++x) {
+				float d2 = FLT_MAX;
+				for (int i = 0; i < segments; ++i) {
+					float px = x - x0[i], py = y - y0[i];
+					float t = std::min(std::max((px * dx[i] + py * dy[i]) * inv_length2[i], 0.0f), 1.0f);
+					float ex = px - t * dx[i], ey = py - t * dy[i];
+					d2 = std::min(d2, ex * ex + ey * ey);
+				}
+				coverage[x - xa] = CoverageByte(CoverageOf(half - std::sqrt(d2)));
+			}
+			BlendCoverageRow(image, xa, y, coverage, xb - xa + 1, color);
 		}
 	}
 }
 
+void Image::DrawLineAA(float x0, float y0, float x1, float y1, const Color& c, float line_width)
+{
+	if (!pixels || !width || !height)
+		return;
 
-void Image::DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor) {
-	
-	int table_size = height;
-	std::vector<Cell> table;
-	table.resize(table_size);
+	Vector2 points[2] = { Vector2(x0, y0), Vector2(x1, y1) };
+	StrokeSegmentsAA(*this, points, 2, false, c, line_width);
+}
 
-	ScanLineDDA(p0.x, p0.y, p1.x, p1.y, table);
-	ScanLineDDA(p1.x, p1.y, p2.x, p2.y, table);
-	ScanLineDDA(p2.x, p2.y, p0.x, p0.y, table);
+void Image::DrawCircleAA(float x, float y, float r, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor)
+{
+	if (!pixels || !width || !height)
+		return;
 
-	
+	// As DrawCircle: the fill goes up to r and the border covers the next borderWidth pixels
+	float inner = r - 0.5f;
+	float outer = r + std::max(borderWidth, 0) - 0.5f;
+	float reach = outer + 0.5f;
+	float solid = inner - 0.5f; // Centers closer than this are fully inside the fill
+	uint32_t fill_color = Compositor::PremultiplyColor(fillColor, 255);
+	uint32_t border_color = Compositor::PremultiplyColor(borderColor, 255);
+	unsigned char fill_pixel[4];
+	PackColor(format, fillColor, fill_pixel);
+
+	int row_lo, row_hi, col_lo, col_hi;
+	TriangleRasterizer::GetPixelRange(y - reach, y + reach, height, row_lo, row_hi);
+	TriangleRasterizer::GetPixelRange(x - reach, x + reach, width, col_lo, col_hi);
+	row_lo = std::max(row_lo, 0);
+	row_hi = std::min(row_hi, (int)height - 1);
+	col_lo = std::max(col_lo, 0);
+	col_hi = std::min(col_hi, (int)width - 1);
+	if (row_lo > row_hi || col_lo > col_hi)
+		return;
+	MarkDirty(col_lo, row_lo, col_hi - col_lo + 1, row_hi - row_lo + 1);
+
+	for (int j = row_lo; j <= row_hi; ++j) {
+		float dy = j - y;
+		if (fabsf(dy) > reach)
+			continue;
+		float extent = std::sqrt(reach * reach - dy * dy);
+		int xa = FloorClamped(x - extent, col_lo, col_hi + 1);
+		int xb = CeilClamped(x + extent, col_lo - 1, col_hi);
+		if (xa > xb)
+			continue;
+
+		// The pixels in [sa,sb] are all fill, only the two ends need coverage
+		int sa = xb + 1, sb = xb;
+		if (fabsf(dy) < solid) {
+			float solid_extent = std::sqrt(solid * solid - dy * dy);
+			sa = CeilClamped(x - solid_extent, xa, xb + 1);
+			sb = FloorClamped(x + solid_extent, xa - 1, xb);
+			if (sa > sb)
+				sa = xb + 1, sb = xb;
+		}
 
-	// Fill the triangle using a different color
-	if (isFilled) {
-		DrawLineDDA(p0.x, p0.y, p1.x, p1.y, borderColor);
-		DrawLineDDA(p1.x, p1.y, p2.x, p2.y, borderColor);
-		DrawLineDDA(p2.x, p2.y, p0.x, p0.y, borderColor);
+		for (int side = 0; side < 2; ++side) {
+			int a = side ? sb + 1 : xa;
+			int b = side ? xb : sa - 1;
+			if (a > b)
+				continue;
+
+			int count = b - a + 1;
+			unsigned char* coverage = GetCoverageRow(2 * count);
+			unsigned char* fill = coverage;
+			unsigned char* border = coverage + count;
+			for (int i = 0; i < count; ++i) {
+				float dx = a + i - x;
+				float d = std::sqrt(dx * dx + dy * dy);
+				float fill_coverage = CoverageOf(inner - d);
+				fill[i] = CoverageByte(fill_coverage);
+				// Over the fill the border hides its edge, two partial coverages would leave a seam
+				if (isFilled)
+					border[i] = fill_coverage < 1.0f ? CoverageByte(CoverageOf(outer - d)) : 0;
+				else
+					border[i] = CoverageByte(CoverageOf(outer - d) - fill_coverage);
+			}
+			if (isFilled)
+				BlendCoverageRow(*this, a, j, fill, count, fill_color);
+			if (borderWidth > 0)
+				BlendCoverageRow(*this, a, j, border, count, border_color);
+		}
+		if (isFilled && sa <= sb)
+			WriteSpan(sa, j, sb - sa + 1, fill_pixel);
+	}
+}
 
-		for (int y = 0; y < height; ++y) {
-			if (table[y].minx <= table[y].maxx) {
-				for (int x = table[y].minx; x <= table[y].maxx; ++x) {
+void Image::DrawTriangleAA(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor)
+{
+	if (!pixels || !width || !height)
+		return;
 
-						SetPixelSafe(x, y, fillColor);
-					
+	float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+	if (isFilled && area != 0.0f) {
+		// Unit normals pointing inside, so the distance of a center to every edge is positive inside
+		const Vector2* p[3] = { &p0, &p1, &p2 };
+		float nx[3], ny[3], offset[3];
+		for (int e = 0; e < 3; ++e) {
+			const Vector2& a = *p[e];
+			const Vector2& b = *p[(e + 1) % 3];
+			float ex = b.x - a.x, ey = b.y - a.y;
+			float scale = (area > 0.0f ? 1.0f : -1.0f) / std::sqrt(ex * ex + ey * ey);
+			nx[e] = -ey * scale;
+			ny[e] = ex * scale;
+			offset[e] = -(a.x * nx[e] + a.y * ny[e]);
+		}
+		uint32_t color = Compositor::PremultiplyColor(fillColor, 255);
+		unsigned char fill_pixel[4];
+		PackColor(format, fillColor, fill_pixel);
+
+		float min_x = std::min(p0.x, std::min(p1.x, p2.x)), max_x = std::max(p0.x, std::max(p1.x, p2.x));
+		float min_y = std::min(p0.y, std::min(p1.y, p2.y)), max_y = std::max(p0.y, std::max(p1.y, p2.y));
+		int row_lo, row_hi, col_lo, col_hi;
+		TriangleRasterizer::GetPixelRange(min_y - 0.5f, max_y + 0.5f, height, row_lo, row_hi);
+		TriangleRasterizer::GetPixelRange(min_x - 0.5f, max_x + 0.5f, width, col_lo, col_hi);
+		row_lo = std::max(row_lo, 0);
+		row_hi = std::min(row_hi, (int)height - 1);
+		col_lo = std::max(col_lo, 0);
+		col_hi = std::min(col_hi, (int)width - 1);
+		if (row_lo <= row_hi && col_lo <= col_hi)
+			MarkDirty(col_lo, row_lo, col_hi - col_lo + 1, row_hi - row_lo + 1);
+
+		for (int y = row_lo; y <= row_hi; ++y) {
+			float row_min = FLT_MAX, row_max = -FLT_MAX;
+			for (int e = 0; e < 3; ++e)
+				SegmentRowExtent(p[e]->x, p[e]->y, p[(e + 1) % 3]->x, p[(e + 1) % 3]->y, y - 1.0f, y + 1.0f, row_min, row_max);
+			// Also kept within half a pixel of the bounding box, the offset edges overshoot at sharp corners
+			int xa = FloorClamped(row_min - 1.0f, col_lo, col_hi + 1);
+			int xb = CeilClamped(row_max + 1.0f, col_lo - 1, col_hi);
+			if (row_min > row_max || xa > xb)
+				continue;
+
+			// Every distance is linear in x, so the pixels at least half a pixel inside all edges are one run
+			float sa = (float)xa, sb = (float)xb;
+			for (int e = 0; e < 3; ++e) {
+				float c = y * ny[e] + offset[e];
+				if (nx[e] > 0.0f)
+					sa = std::max(sa, std::ceil((0.5f - c) / nx[e]));
+				else if (nx[e] < 0.0f)
+					sb = std::min(sb, std::floor((0.5f - c) / nx[e]));
+				else if (c < 0.5f)
+					sa = sb + 1.0f;
+			}
+			int solid_a = sa <= sb ? (int)sa : xb + 1;
+			int solid_b = sa <= sb ? (int)sb : xb;
+
+			for (int side = 0; side < 2; ++side) {
+				int a = side ? solid_b + 1 : xa;
+				int b = side ? xb : solid_a - 1;
+				if (a > b)
+					continue;
+				unsigned char* coverage = GetCoverageRow(b - a + 1);
+				for (int x = a; x <= b; ++x) {
+					float d = FLT_MAX;
+					for (int e = 0; e < 3; ++e)
+						d = std::min(d, x * nx[e] + y * ny[e] + offset[e]);
+					coverage[x - a] = CoverageByte(CoverageOf(d));
 				}
+				BlendCoverageRow(*this, a, y, coverage, b - a + 1, color);
 			}
+			if (solid_a <= solid_b)
+				WriteSpan(solid_a, y, solid_b - solid_a + 1, fill_pixel);
 		}
 	}
 
-
-	// Draw the border of the triangle
-	for (int i = 0; i < borderWidth; i++) {
-		DrawLineDDA(p0.x - i, p0.y - i, p1.x - i, p1.y - i, borderColor);
-		DrawLineDDA(p1.x - i, p1.y - i, p2.x - i, p2.y - i, borderColor);
-		DrawLineDDA(p2.x - i, p2.y - i, p0.x - i, p0.y - i, borderColor);
+	// The three sides are one closed outline, so the corners are blended once
+	if (borderWidth > 0) {
+		Vector2 corners[3] = { p0, p1, p2 };
+		StrokeSegmentsAA(*this, corners, 3, true, borderColor, (float)borderWidth);
 	}
 }
 
+void Image::DrawImage(const Image& image, int x, int y, bool top) {
+	if (image.layout == TILED) {
+		Image linear = image;
+		linear.SetLayout(LINEAR);
+		DrawImage(linear.GetView(), x, y, top);
+		return;
+	}
+	DrawImage(image.GetView(), x, y, top);
+}
 
-void Image::ScanLineDDA(int x0, int y0, int x1, int y1,
-	std::vector<Cell>& table) {
+void Image::DrawImage(const ImageView& image, int x, int y, bool top) {
+	// With top the first row goes to y and the next ones go up
+	if (top)
+		Blit(image, x, y - (int)image.height + 1, Blitter::FLIP_Y);
+	else
+		Blit(image, x, y);
+}
 
-	// Calculate dx, dy and the largest leg of the triangle
-	float dx = x1 - x0;
-	float dy = y1 - y0;
-	float d = std::max(std::abs(dx), std::abs(dy));
+void Image::Blit(const ImageView& image, int x, int y, int flags, const Color& key)
+{
+	MarkDirty(x, y, image.width, image.height);
+	if (layout == LINEAR) {
+		Blitter::Blit(GetView(), x, y, image, flags, key);
+		return;
+	}
 
-	// Calculate the direction step vector v
-	float vx = dx / d;
-	float vy = dy / d;
+	// Every tile is a small linear view, the blitter clips the image against each one
+	int x0 = std::max(x, 0), y0 = std::max(y, 0);
+	int x1 = x + (int)image.width, y1 = y + (int)image.height;
+	if (x1 <= x0 || y1 <= y0)
+		return;
+	ForEachTile(x0, y0, x1 - x0, y1 - y0, [&](unsigned int tx, unsigned int ty, unsigned int w, unsigned int h, unsigned char* data, unsigned int tile_stride) {
+		Blitter::Blit(ImageView(data, w, h, tile_stride, format), x - (int)tx, y - (int)ty, image, flags, key);
+	});
+}
 
-	// Start drawing the line
-	float x = static_cast<float>(x0);
-	float y = static_cast<float>(y0);
+void Image::Composite(const ImageView& image, int x, int y, BlendMode mode, unsigned int opacity)
+{
+	MarkDirty(x, y, image.width, image.height);
+	if (layout == LINEAR) {
+		Compositor::Composite(GetView(), x, y, image, mode, opacity);
+		return;
+	}
 
-	for (int i = 0; i <= d; ++i) {
-		// Update min and max X values in the table
-		int currentY = static_cast<int>(y);
-		table[currentY].minx = std::min(table[currentY].minx, static_cast<int>(std::floor(x)));
-		table[currentY].maxx = std::max(table[currentY].maxx, static_cast<int>(std::floor(x)));
+	int x0 = std::max(x, 0), y0 = std::max(y, 0);
+	int x1 = x + (int)image.width, y1 = y + (int)image.height;
+	if (x1 <= x0 || y1 <= y0)
+		return;
+	ForEachTile(x0, y0, x1 - x0, y1 - y0, [&](unsigned int tx, unsigned int ty, unsigned int w, unsigned int h, unsigned char* data, unsigned int tile_stride) {
+		Compositor::Composite(ImageView(data, w, h, tile_stride, format), x - (int)tx, y - (int)ty, image, mode, opacity);
+	});
+}
 
-		// Increment x and y by v
-		x += vx;
-		y += vy;
+void Image::BlendSpan(int x, int y, int count, const Color& c, unsigned int alpha, BlendMode mode, const unsigned char* mask)
+{
+	if (y < 0 || y >= (int)height || alpha == 0)
+		return;
+	int x0 = std::max(x, 0);
+	int x1 = std::min(x + count, (int)width);
+	if (x0 >= x1)
+		return;
+	MarkDirty(x0, y, x1 - x0, 1);
+
+	uint32_t color = Compositor::PremultiplyColor(c, alpha);
+	if (mask)
+		mask += x0 - x;
+
+	// GetSpan returns whole rows when LINEAR and the part inside a tile when TILED
+	while (x0 < x1) {
+		unsigned int n;
+		unsigned char* p = GetSpan(x0, y, n);
+		n = std::min(n, (unsigned int)(x1 - x0));
+		Compositor::CompositeRow(p, format, color, mask, n, mode);
+		x0 += n;
+		if (mask)
+			mask += n;
 	}
 }
 
+void Image::FillSpan(int x, int y, int count, const Color& c)
+{
+	if (y < 0 || y >= (int)height)
+		return;
+	int x0 = std::max(x, 0);
+	int x1 = std::min(x + count, (int)width);
+	if (x0 >= x1)
+		return;
+	MarkDirty(x0, y, x1 - x0, 1);
 
-void Image:: DrawImage(const Image& image, int x, int y, bool top) {
-	for (int i = 0; i < image.width; ++i) {
-		for (int j = 0; j < image.height; ++j) {
-			if (top) {
-				SetPixelSafe(x+i, y-j, image.GetPixelSafe(i, j));
-			}
+	unsigned char pixel[4];
+	PackColor(format, c, pixel);
+	WriteSpan(x0, y, x1 - x0, pixel);
+}
 
-			else {
-				SetPixelSafe(x+i, y + j, image.GetPixelSafe(i, j));
-			}
-			
+// Writes the packed pixel over count contiguous pixels
+static void FillPacked(unsigned char* p, const unsigned char* pixel, unsigned int bytes_per_pixel, size_t count)
+{
+	if (bytes_per_pixel == 4) {
+		uint32_t value;
+		memcpy(&value, pixel, 4);
+		PixelKernels::Fill32((uint32_t*)p, value, count);
+	}
+	else if (bytes_per_pixel == 3)
+		PixelKernels::Fill24(p, pixel, count);
+	else
+		PixelKernels::Fill8(p, pixel[0], count);
+}
+
+void Image::WriteSpan(unsigned int x, unsigned int y, unsigned int count, const unsigned char* pixel)
+{
+	while (count) {
+		unsigned int n;
+		unsigned char* p = GetSpan(x, y, n);
+		n = std::min(n, count);
+		FillPacked(p, pixel, bytes_per_pixel, n);
+		x += n;
+		count -= n;
+	}
+}
+
+void Image::Premultiply()
+{
+	assert(format == RGBA8);
+	MarkAllDirty();
+	ForEachTile([&](unsigned int x0, unsigned int y0, unsigned int w, unsigned int h, unsigned char* data, unsigned int tile_stride) {
+		for (unsigned int y = 0; y < h; ++y) {
+			uint32_t* row = (uint32_t*)(data + (size_t)y * tile_stride);
+			Compositor::Premultiply(row, row, w);
 		}
+	});
+}
+
+//**************************************
+// ImageView
+
+ImageView ImageView::GetArea(int x, int y, int w, int h) const
+{
+	int x0 = std::max(x, 0), y0 = std::max(y, 0);
+	int x1 = std::min(x + w, (int)width), y1 = std::min(y + h, (int)height);
+	if (x0 >= x1 || y0 >= y1)
+		return ImageView(pixels, 0, 0, stride, format);
+	return ImageView(GetPixelPtr(x0, y0), x1 - x0, y1 - y0, stride, format);
+}
+
+void ImageView::Fill(const Color& c) const
+{
+	if (IsEmpty())
+		return;
+
+	// Contiguous rows are filled in a single call
+	unsigned char pixel[4];
+	Image::PackColor(format, c, pixel);
+	bool contiguous = stride == width * bytes_per_pixel;
+	unsigned int rows = contiguous ? 1 : height;
+	size_t count = contiguous ? (size_t)width * height : width;
+	for (unsigned int y = 0; y < rows; ++y)
+		FillPacked(GetRow(y), pixel, bytes_per_pixel, count);
+}
+
+void ImageView::FillSpan(int x, int y, int count, const Color& c) const
+{
+	if (IsEmpty() || y < 0 || y >= (int)height)
+		return;
+	int64_t x0 = std::max(x, 0), x1 = std::min((int64_t)x + count, (int64_t)width);
+	if (x0 >= x1)
+		return;
+	unsigned char pixel[4];
+	Image::PackColor(format, c, pixel);
+	FillPacked(GetPixelPtr((unsigned int)x0, y), pixel, bytes_per_pixel, (size_t)(x1 - x0));
+}
+
+void ImageView::FillRect(int x, int y, int w, int h, const Color& c) const
+{
+	GetArea(x, y, w, h).Fill(c);
+}
+
+void ImageView::DrawLine(int x0, int y0, int x1, int y1, const Color& c) const
+{
+	if (IsEmpty())
+		return;
+	unsigned char pixel[4];
+	Image::PackColor(format, c, pixel);
+	LineRasterizer::Rasterize(x0, y0, x1, y1, 0, 0, width - 1, height - 1, [&](int x, int y, int count) {
+		FillPacked(GetPixelPtr(x, y), pixel, bytes_per_pixel, count);
+	});
+}
+
+void ImageView::FillTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& c) const
+{
+	if (IsEmpty())
+		return;
+	unsigned char pixel[4];
+	Image::PackColor(format, c, pixel);
+	TriangleRasterizer::Rasterize(p0, p1, p2, 0, 0, width - 1, height - 1, [&](int x, int y, int count) {
+		FillPacked(GetPixelPtr(x, y), pixel, bytes_per_pixel, count);
+	});
+}
+
+void ImageView::FillEllipse(int x, int y, int rx, int ry, const Color& c) const
+{
+	if (IsEmpty())
+		return;
+	unsigned char pixel[4];
+	Image::PackColor(format, c, pixel);
+	int box[4];
+	RasterizeEllipse(x, y, rx, ry, -1, -1, width, height, box, [&](int x0, int row, int count) {
+		FillPacked(GetPixelPtr(x0, row), pixel, bytes_per_pixel, count);
+	});
+}
+
+void ImageView::FillRing(int x, int y, int r0, int r1, const Color& c) const
+{
+	if (IsEmpty())
+		return;
+	unsigned char pixel[4];
+	Image::PackColor(format, c, pixel);
+	int hole = r0 > 0 ? r0 - 1 : -1;
+	int box[4];
+	RasterizeEllipse(x, y, r1, r1, hole, hole, width, height, box, [&](int x0, int row, int count) {
+		FillPacked(GetPixelPtr(x0, row), pixel, bytes_per_pixel, count);
+	});
+}
+
+void ImageView::FlipY() const
+{
+	for (unsigned int y = 0; y < height / 2; ++y)
+		PixelKernels::Swap(GetRow(y), GetRow(height - y - 1), width * bytes_per_pixel);
+}
+
+void ImageView::CopyFrom(const ImageView& src) const
+{
+	unsigned int w = std::min(width, src.width);
+	unsigned int h = std::min(height, src.height);
+	if (!w || !pixels || !src.pixels)
+		return;
+	if (format == src.format)
+		PixelKernels::CopyRows(pixels, stride, src.pixels, src.stride, (size_t)w * bytes_per_pixel, h);
+	else {
+		for (unsigned int y = 0; y < h; ++y)
+			Image::ConvertPixels(src.GetRow(y), src.format, GetRow(y), format, w);
 	}
-			
 }
 
 
@@ -568,9 +1726,9 @@ void ParticleSystem:: Render(Image* framebuffer) {
 			int x = static_cast<int>(particles[i].position.x);
 			int y = static_cast<int>(particles[i].position.y);
 
-			if (x >= 0 && x < 800 && y >= 0 && y < 600) {
-				framebuffer->SetPixelSafe(x, y, particles[i].color);
-			}
+			// Particles fade out during their last second
+			unsigned int alpha = (unsigned int)(clamp(particles[i].ttl, 0.0f, 1.0f) * 255.0f);
+			framebuffer->BlendPixel(x, y, particles[i].color, alpha);
 		}
 	}
 }
@@ -605,23 +1763,11 @@ void ParticleSystem::Update(float dt) {
 	}
 }
 
-#ifndef IGNORE_LAMBDAS
-
-// You can apply and algorithm for two images and store the result in the first one
-// ForEachPixel( img, img2, [](Color a, Color b) { return a + b; } );
-template <typename F>
-void ForEachPixel(Image& img, const Image& img2, F f) {
-	for(unsigned int pos = 0; pos < img.width * img.height; ++pos)
-		img.pixels[pos] = f( img.pixels[pos], img2.pixels[pos] );
-}
-
-#endif
-
 FloatImage::FloatImage(unsigned int width, unsigned int height)
 {
 	this->width = width;
 	this->height = height;
-	pixels = new float[width * height];
+	pixels = (float*)PixelPool::Alloc(width * height * sizeof(float));
 	memset(pixels, 0, width * height * sizeof(float));
 }
 
@@ -633,7 +1779,7 @@ FloatImage::FloatImage(const FloatImage& c) {
 	height = c.height;
 	if (c.pixels)
 	{
-		pixels = new float[width * height];
+		pixels = (float*)PixelPool::Alloc(width * height * sizeof(float));
 		memcpy(pixels, c.pixels, width * height * sizeof(float));
 	}
 }
@@ -641,37 +1787,69 @@ FloatImage::FloatImage(const FloatImage& c) {
 // Assign operator
 FloatImage& FloatImage::operator = (const FloatImage& c)
 {
-	if (pixels) delete pixels;
+	if (this == &c)
+		return *this;
+
+	if (pixels) PixelPool::Free(pixels, width * height * sizeof(float));
 	pixels = NULL;
 
 	width = c.width;
 	height = c.height;
 	if (c.pixels)
 	{
-		pixels = new float[width * height * sizeof(float)];
+		pixels = (float*)PixelPool::Alloc(width * height * sizeof(float));
 		memcpy(pixels, c.pixels, width * height * sizeof(float));
 	}
 	return *this;
 }
 
+// Move constructor
+FloatImage::FloatImage(FloatImage&& c)
+{
+	width = c.width;
+	height = c.height;
+	pixels = c.pixels;
+
+	c.pixels = NULL;
+	c.width = c.height = 0;
+}
+
+// Move assign operator
+FloatImage& FloatImage::operator = (FloatImage&& c)
+{
+	if (this == &c)
+		return *this;
+
+	if (pixels) PixelPool::Free(pixels, width * height * sizeof(float));
+
+	width = c.width;
+	height = c.height;
+	pixels = c.pixels;
+
+	c.pixels = NULL;
+	c.width = c.height = 0;
+	return *this;
+}
+
 FloatImage::~FloatImage()
 {
 	if (pixels)
-		delete pixels;
+		PixelPool::Free(pixels, width * height * sizeof(float));
 }
 
 // Change image size (the old one will remain in the top-left corner)
 void FloatImage::Resize(unsigned int width, unsigned int height)
 {
-	float* new_pixels = new float[width * height];
+	float* new_pixels = (float*)PixelPool::Alloc(width * height * sizeof(float));
+	memset(new_pixels, 0, width * height * sizeof(float));
 	unsigned int min_width = this->width > width ? width : this->width;
 	unsigned int min_height = this->height > height ? height : this->height;
 
-	for (unsigned int x = 0; x < min_width; ++x)
-		for (unsigned int y = 0; y < min_height; ++y)
-			new_pixels[y * width + x] = GetPixel(x, y);
+	for (unsigned int y = 0; y < min_height; ++y)
+		memcpy(new_pixels + y * width, pixels + y * this->width, min_width * sizeof(float));
 
-	delete pixels;
+	if (pixels)
+		PixelPool::Free(pixels, this->width * this->height * sizeof(float));
 	this->width = width;
 	this->height = height;
 	pixels = new_pixels;
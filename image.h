@@ -8,7 +8,15 @@
 #include <string.h>
 #include <stdio.h>
 #include <iostream>
+#include <climits>
+#include <cassert>
+#include <atomic>
+#include <algorithm>
 #include "framework.h"
+#include "thread_pool.h"
+#include "stroker.h"
+#include "triangle_batch.h"
+#include "mesh_renderer.h"
 
 //remove unsafe warnings
 #ifndef _CRT_SECURE_NO_WARNINGS
@@ -17,10 +25,18 @@
 #endif
 
 class FloatImage;
+class ImageView;
 class Entity;
 class Camera;
 class Button;
 
+// Reference counted block of pixels, shared by the copies of an Image until one of them writes
+struct PixelBuffer {
+	std::atomic<int> refs;
+	size_t size;
+	unsigned char* data;
+};
+
 // A matrix of pixels
 class Image
 {
@@ -33,69 +49,243 @@ class Image
 	} TGAInfo;
 
 public:
+	// Storage formats for the pixels. RGBA8 and RGBX8 use 4 bytes per pixel and
+	// pad every row to a multiple of 64 bytes, so rows start on a cache line.
+	// RGBX8 behaves like RGBA8 but the fourth byte is always 255 (opaque).
+	enum PixelFormat { RGB8, RGBA8, RGBX8, GRAY8 };
+
+	// Memory layout of the pixels. LINEAR stores whole rows one after another,
+	// TILED stores square tiles of TILE_SIZE x TILE_SIZE pixels (row-major inside
+	// each tile), so vertical neighbours stay in the same few cache lines.
+	enum PixelLayout { LINEAR, TILED };
+	static const unsigned int TILE_SHIFT = 6;
+	static const unsigned int TILE_SIZE = 1 << TILE_SHIFT;
+	static const unsigned int TILE_MASK = TILE_SIZE - 1;
+
+	// Area written since the dirty list was last cleared
+	struct DirtyRect { int x, y, w, h; };
+	// Overlapping rectangles are merged, when the list is full the new one joins the closest
+	static const unsigned int MAX_DIRTY_RECTS = 16;
+
+	// Filters used by Scale, from the fastest to the smoothest
+	enum ResampleFilter { NEAREST, BILINEAR, BICUBIC, LANCZOS3 };
+
+	// Compositing modes for premultiplied alpha (see Compositor)
+	enum BlendMode { BLEND_OVER, BLEND_ADD, BLEND_MULTIPLY, BLEND_SCREEN, BLEND_DARKEN, BLEND_LIGHTEN };
+
 	unsigned int width;
 	unsigned int height;
-	unsigned int bytes_per_pixel = 3; // Bits per pixel
+	unsigned int bytes_per_pixel = 3; // Bytes per pixel
+	unsigned int stride = 0; // Bytes per row, including padding (bytes per tile row when TILED)
+	PixelFormat format = RGB8;
+	PixelLayout layout = LINEAR;
+	unsigned int tiles_x = 0; // Tiles per row of tiles when TILED
 
-	Color* pixels;
+	// Points to the shared buffer, call Detach() before writing through it directly
+	unsigned char* pixels;
+	PixelBuffer* buffer = NULL;
 
 	// Constructors
 	Image();
-	Image(unsigned int width, unsigned int height);
+	Image(unsigned int width, unsigned int height, PixelFormat format = RGB8, PixelLayout layout = LINEAR);
 	Image(const Image& c);
+	Image(Image&& c);
+	explicit Image(const ImageView& view); // Copy of the pixels of a view
 	Image& operator = (const Image& c); // Assign operator
+	Image& operator = (Image&& c); // Move assign operator
 
 	// Destructor
 	~Image();
 
-	void Render();
+	void Render(); // Draws all the pixels with glDrawPixels, see Presenter for the streaming path
+
+	// Dirty rectangles, what Presenter uploads. The primitives, loads and bulk operations mark what they write,
+	// but SetPixel and the raw pointers and views do not: call MarkDirty after writing through them.
+	void MarkDirty(int x, int y, int w, int h);
+	void MarkAllDirty() { num_dirty_rects = 0; MarkDirty(0, 0, width, height); }
+	void ClearDirty() { num_dirty_rects = 0; }
+	bool IsDirty() const { return num_dirty_rects > 0; }
+	const DirtyRect* GetDirtyRects() const { return dirty_rects; }
+	unsigned int GetNumDirtyRects() const { return num_dirty_rects; }
+
+	// Format helpers
+	static unsigned int GetBytesPerPixel(PixelFormat format) { return format == RGB8 ? 3 : (format == GRAY8 ? 1 : 4); }
+	static unsigned int GetStride(PixelFormat format, unsigned int width);
+	// Only RGBA8 stores the alpha, RGBX8 keeps its fourth byte at 255 and the other formats have none
+	static void PackColor(PixelFormat format, const Color& c, unsigned char alpha, unsigned char* dst) {
+		switch (format) {
+			case RGB8: dst[0] = c.r; dst[1] = c.g; dst[2] = c.b; break;
+			case RGBA8: dst[0] = c.r; dst[1] = c.g; dst[2] = c.b; dst[3] = alpha; break;
+			case RGBX8: dst[0] = c.r; dst[1] = c.g; dst[2] = c.b; dst[3] = 255; break;
+			case GRAY8: dst[0] = (unsigned char)((c.r * 77 + c.g * 150 + c.b * 29) >> 8); break;
+		}
+	}
+	static void PackColor(PixelFormat format, const Color& c, unsigned char* dst) { PackColor(format, c, 255, dst); }
+	static unsigned char UnpackAlpha(PixelFormat format, const unsigned char* src) { return format == RGBA8 ? src[3] : 255; }
+	static Color UnpackColor(PixelFormat format, const unsigned char* src) {
+		Color c;
+		if (format == GRAY8) { c.r = c.g = c.b = src[0]; }
+		else { c.r = src[0]; c.g = src[1]; c.b = src[2]; }
+		return c;
+	}
+	// Converts count pixels from one format to another (alpha is kept between RGBA8 images)
+	static void ConvertPixels(const unsigned char* src, PixelFormat src_format, unsigned char* dst, PixelFormat dst_format, unsigned int count);
+
+	// Changes the storage format or layout, converting the current content
+	void SetFormat(PixelFormat format);
+	void SetLayout(PixelLayout layout);
+
+	// Copy on write: make sure no other image shares the buffer before modifying it
+	bool IsShared() const { return buffer && buffer->refs.load(std::memory_order_acquire) > 1; }
+	void Detach(bool keep_content = true) { if (IsShared()) Unshare(keep_content); }
+
+	// Byte offset of the pixel x,y inside the buffer, for any layout
+	size_t GetPixelOffset(unsigned int x, unsigned int y) const {
+		if (layout == LINEAR)
+			return (size_t)y * stride + x * bytes_per_pixel;
+		size_t tile = (size_t)(y >> TILE_SHIFT) * tiles_x + (x >> TILE_SHIFT);
+		return tile * TILE_SIZE * stride + (y & TILE_MASK) * stride + (x & TILE_MASK) * bytes_per_pixel;
+	}
+
+	// Raw access to the bytes of a pixel (the non const version detaches the buffer)
+	unsigned char* GetPixelPtr(unsigned int x, unsigned int y) { Detach(); return pixels + GetPixelOffset(x, y); }
+	const unsigned char* GetPixelPtr(unsigned int x, unsigned int y) const { return pixels + GetPixelOffset(x, y); }
+
+	// Raw access to the bytes of a row, only for LINEAR images
+	unsigned char* GetRow(unsigned int y) { assert(layout == LINEAR); Detach(); return pixels + (size_t)y * stride; }
+	const unsigned char* GetRow(unsigned int y) const { assert(layout == LINEAR); return pixels + (size_t)y * stride; }
+
+	// Non owning views of the pixels, only for LINEAR images. The area is clipped to the image.
+	// The non const versions detach the buffer, the views of a const image are only for reading.
+	ImageView GetView();
+	ImageView GetView(int x, int y, int w, int h);
+	ImageView GetView() const;
+	ImageView GetView(int x, int y, int w, int h) const;
+
+	// Returns the pixel x,y and in count how many pixels follow it contiguously in the same row
+	unsigned char* GetSpan(unsigned int x, unsigned int y, unsigned int& count) {
+		count = layout == LINEAR ? width - x : std::min(TILE_SIZE - (x & TILE_MASK), width - x);
+		return GetPixelPtr(x, y);
+	}
+	const unsigned char* GetSpan(unsigned int x, unsigned int y, unsigned int& count) const {
+		count = layout == LINEAR ? width - x : std::min(TILE_SIZE - (x & TILE_MASK), width - x);
+		return GetPixelPtr(x, y);
+	}
 
 	// Get the pixel at position x,y
-	Color GetPixel(unsigned int x, unsigned int y) const { return pixels[ y * width + x ]; }
-	Color& GetPixelRef(unsigned int x, unsigned int y)	{ return pixels[ y * width + x ]; }
+	Color GetPixel(unsigned int x, unsigned int y) const { return UnpackColor(format, GetPixelPtr(x, y)); }
+	// Alpha of the pixel x,y, 255 for the formats without alpha
+	unsigned char GetAlpha(unsigned int x, unsigned int y) const { return UnpackAlpha(format, GetPixelPtr(x, y)); }
+	// Only valid for formats that store r,g,b in the first 3 bytes of each pixel
+	Color& GetPixelRef(unsigned int x, unsigned int y) { assert(format != GRAY8); return *(Color*)GetPixelPtr(x, y); }
 	Color GetPixelSafe(unsigned int x, unsigned int y) const {	
 		x = clamp((unsigned int)x, 0, width-1); 
 		y = clamp((unsigned int)y, 0, height-1); 
-		return pixels[ y * width + x ]; 
+		return GetPixel(x, y); 
 	}
 
 	// Set the pixel at position x,y with value C
-	void SetPixel(unsigned int x, unsigned int y, const Color& c) { pixels[ y * width + x ] = c; }
-	void SetPixelSafe(unsigned int x, unsigned int y, const Color& c) const { if(x < 0 || x > width-1) return; if(y < 0 || y > height-1) return; pixels[ y * width + x ] = c; }
+	void SetPixel(unsigned int x, unsigned int y, const Color& c) { PackColor(format, c, GetPixelPtr(x, y)); }
+	void SetPixelSafe(unsigned int x, unsigned int y, const Color& c) { if(x < 0 || x > width-1) return; if(y < 0 || y > height-1) return; PackColor(format, c, GetPixelPtr(x, y)); }
+	// Same with an alpha, that only RGBA8 images keep
+	void SetPixel(unsigned int x, unsigned int y, const Color& c, unsigned char alpha) { PackColor(format, c, alpha, GetPixelPtr(x, y)); }
+	void SetPixelSafe(unsigned int x, unsigned int y, const Color& c, unsigned char alpha) { if (x >= width || y >= height) return; PackColor(format, c, alpha, GetPixelPtr(x, y)); }
+
+	// Walks the area x,y,w,h (clipped to the image) one tile at a time, in both layouts.
+	// The callback receives the tile area and the bytes of its first pixel:
+	//   f(unsigned int x0, unsigned int y0, unsigned int w, unsigned int h, unsigned char* data, unsigned int tile_stride)
+	// where row j of the tile starts at data + j * tile_stride
+	template <typename F>
+	void ForEachTile(unsigned int x, unsigned int y, unsigned int w, unsigned int h, F f)
+	{
+		if (x >= width || y >= height)
+			return;
+		unsigned int x_end = std::min(x + w, width);
+		unsigned int y_end = std::min(y + h, height);
+		Detach();
+		for (unsigned int ty = y; ty < y_end; ty = (ty | TILE_MASK) + 1) {
+			unsigned int th = std::min((ty | TILE_MASK) + 1, y_end) - ty;
+			for (unsigned int tx = x; tx < x_end; tx = (tx | TILE_MASK) + 1) {
+				unsigned int tw = std::min((tx | TILE_MASK) + 1, x_end) - tx;
+				f(tx, ty, tw, th, pixels + GetPixelOffset(tx, ty), stride);
+			}
+		}
+	}
+	template <typename F>
+	void ForEachTile(F f) { ForEachTile(0, 0, width, height, f); }
 
 	void Resize(unsigned int width, unsigned int height);
-	void Scale(unsigned int width, unsigned int height);
+	void Scale(unsigned int width, unsigned int height, ResampleFilter filter = BILINEAR); // Resample the content to the new size
 	
 	void FlipY(); // Flip the image top-down
 
 	// Fill the image with the color C
-	void Fill(const Color& c) { for(unsigned int pos = 0; pos < width*height; ++pos) pixels[pos] = c; }
+	void Fill(const Color& c);
 
 	// Returns a new image with the area from (startx,starty) of size width,height
-	Image GetArea(unsigned int start_x, unsigned int start_y, unsigned int width, unsigned int height);
+	// (pixels outside this image are black). Use GetView to work on an area without copying it.
+	Image GetArea(unsigned int start_x, unsigned int start_y, unsigned int width, unsigned int height) const;
 
-	// Save or load images from the hard drive
+	// Save or load images from the hard drive. The filenames are inside res/ next to the executable (see absResPath),
+	// SaveTGA takes filename as it is when in_res is false
 	bool LoadPNG(const char* filename, bool flip_y = true);
 	bool LoadTGA(const char* filename, bool flip_y = false);
-	bool SaveTGA(const char* filename);
+	bool SaveTGA(const char* filename, bool in_res = true);
+	static bool SaveTGA(const char* filename, const ImageView& view, bool in_res = true);
 
 
 
 	void DrawLineDDA(int x0, int y0, int x1, int y1, const Color& c);
+	// Fills the rectangle clipped to the image, one span per visible row
+	void FillRect(int x, int y, int w, int h, const Color& c);
 	void DrawRect(int x, int y, int w, int h, const Color& c);
 	void DrawRectUpdate(int x, int y, int w, int h, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor);
 	void DrawCircle(int x, int y, int r, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor);
 
-	void DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor);
-	struct Cell {
-		int minx = INT_MAX;
-		int maxx = INT_MIN;
-	};
-
-	void ScanLineDDA(int x0, int y0, int x1, int y1,
-		std::vector<Cell>& table);
+	// Filled ellipses, disks and rings as exact spans, every row clipped once and written with the span fill.
+	// A pixel is in the disk of radius r when the distance of its center rounds to r or less.
+	void FillEllipse(int x, int y, int rx, int ry, const Color& c);
+	void FillDisk(int x, int y, int r, const Color& c) { FillEllipse(x, y, r, r, c); }
+	// The pixels at distances that round to r0 ... r1, the disk r1 without the disk r0 - 1
+	void FillRing(int x, int y, int r0, int r1, const Color& c);
 
+	void DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor);
+	// Fills the pixels whose center is inside the triangle, with the top-left rule for the ones on an edge
+	void FillTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& c);
+	// Draws all the triangles of the batch, in the order they were added, with its bins split over the thread pool
+	void DrawTriangles(TriangleBatch& batch);
+	// Renders the mesh on the CPU through the renderer, only where it is nearer than the depth buffer, which keeps the
+	// depth in [0, 1] of every pixel. Fill it with 1 before the first mesh of a frame, it is resized to the image if needed.
+	void DrawMesh(MeshRenderer& renderer, const Mesh& mesh, const Matrix44& model, Camera& camera, FloatImage& depth);
+
+	// Thick lines and outlines as filled geometry, each pixel is written once whatever the width
+	void DrawStroke(const Vector2* points, unsigned int count, bool closed, float line_width, const Color& c,
+		Stroker::Join join = Stroker::JOIN_MITER, Stroker::Cap cap = Stroker::CAP_BUTT);
+	// Fills the geometry built with a stroker
+	void FillGeometry(Stroker& geometry, const Color& c);
+
+	// Anti-aliased versions, blended over the image with the coverage of every pixel.
+	// Integer coordinates are pixel centers, so they line up with the aliased ones.
+	void DrawLineAA(float x0, float y0, float x1, float y1, const Color& c, float line_width = 1.0f);
+	void DrawCircleAA(float x, float y, float r, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor);
+	void DrawTriangleAA(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor);
+
+	// Draws image with its top-left corner at x,y, or bottom-up from row y when top is set
 	void DrawImage(const Image& image, int x, int y, bool top);
+	void DrawImage(const ImageView& image, int x, int y, bool top);
+	// Copies image with its top-left corner at x,y, clipped to this image (flags and key are explained in Blitter)
+	void Blit(const ImageView& image, int x, int y, int flags = 0, const Color& key = Color::BLACK);
+
+	// Composites a premultiplied RGBA8 image at x,y, clipped to this image
+	void Composite(const ImageView& image, int x, int y, BlendMode mode = BLEND_OVER, unsigned int opacity = 255);
+	// Blends the color with the given alpha over count pixels of row y starting at x (clipped).
+	// mask is optional, one coverage byte for each of the count pixels.
+	void BlendSpan(int x, int y, int count, const Color& c, unsigned int alpha, BlendMode mode = BLEND_OVER, const unsigned char* mask = NULL);
+	void BlendPixel(int x, int y, const Color& c, unsigned int alpha, BlendMode mode = BLEND_OVER) { BlendSpan(x, y, 1, c, alpha, mode); }
+	// Sets count pixels of row y starting at x to the color (clipped)
+	void FillSpan(int x, int y, int count, const Color& c);
+	// Converts the content of an RGBA8 image to premultiplied alpha, as Composite expects
+	void Premultiply();
 
 	// Used to easy code
 	#ifndef IGNORE_LAMBDAS
@@ -106,13 +296,150 @@ public:
 	template <typename F>
 	Image& ForEachPixel( F callback )
 	{
-		for(unsigned int pos = 0; pos < width*height; ++pos)
-			pixels[pos] = callback(pixels[pos]);
+		MarkAllDirty();
+		ForEachTile([&](unsigned int x0, unsigned int y0, unsigned int w, unsigned int h, unsigned char* data, unsigned int tile_stride) {
+			for(unsigned int y = 0; y < h; ++y) {
+				unsigned char* p = data + (size_t)y * tile_stride;
+				for(unsigned int x = 0; x < w; ++x, p += bytes_per_pixel)
+					PackColor(format, callback(UnpackColor(format, p)), p);
+			}
+		});
+		return *this;
+	}
+
+	// Same as ForEachPixel but the image is split in bands of rows that run on the thread pool,
+	// so the callback must be safe to call from several threads. Small images run serially.
+	template <typename F>
+	Image& ParallelForEachPixel( F callback )
+	{
+		if ((size_t)width * height < PARALLEL_MIN_PIXELS)
+			return ForEachPixel(callback);
+
+		Detach();
+		MarkAllDirty(); // Not from the bands, the list is not thread safe
+		unsigned int band = GetBandHeight();
+		ThreadPool::Get().ParallelFor((height + band - 1) / band, 1, [&](unsigned int begin, unsigned int end) {
+			ForEachTile(0, begin * band, width, (end - begin) * band, [&](unsigned int x0, unsigned int y0, unsigned int w, unsigned int h, unsigned char* data, unsigned int tile_stride) {
+				for(unsigned int y = 0; y < h; ++y) {
+					unsigned char* p = data + (size_t)y * tile_stride;
+					for(unsigned int x = 0; x < w; ++x, p += bytes_per_pixel)
+						PackColor(format, callback(UnpackColor(format, p)), p);
+				}
+			});
+		});
+		return *this;
+	}
+	#endif
+
+	// Images below this size are not worth waking up the thread pool
+	static const unsigned int PARALLEL_MIN_PIXELS = 256 * 256;
+	// Rows per band for the parallel loops, a multiple of TILE_SIZE when TILED
+	unsigned int GetBandHeight() const;
+
+protected:
+	DirtyRect dirty_rects[MAX_DIRTY_RECTS];
+	unsigned int num_dirty_rects = 0;
+
+	size_t ComputeLayout(); // Updates bytes_per_pixel, stride and tiles_x, returns the buffer size
+	void SetBuffer(PixelBuffer* new_buffer);
+	void Unshare(bool keep_content);
+	void CopyDirty(const Image& c);
+	// Writes a packed pixel over count pixels of row y from x, with no clipping or marking
+	void WriteSpan(unsigned int x, unsigned int y, unsigned int count, const unsigned char* pixel);
+	// The ellipse rx,ry without the ellipse hole_rx,hole_ry (no hole when they are negative)
+	void FillEllipseSpans(int x, int y, int rx, int ry, int hole_rx, int hole_ry, const Color& c);
+};
+
+// Non owning window into rows of pixels: a pointer, a size and the bytes from one row to the next.
+// It can point into a LINEAR Image (see Image::GetView) or any other buffer. It never copies or frees
+// the pixels, so the owner must stay alive and keep its size while the view is used.
+class ImageView
+{
+public:
+	unsigned char* pixels = NULL;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int stride = 0; // Bytes from one row to the next
+	Image::PixelFormat format = Image::RGB8;
+	unsigned int bytes_per_pixel = 3;
+
+	ImageView() {}
+	ImageView(unsigned char* pixels, unsigned int width, unsigned int height, unsigned int stride, Image::PixelFormat format)
+		: pixels(pixels), width(width), height(height), stride(stride), format(format), bytes_per_pixel(Image::GetBytesPerPixel(format)) {}
+
+	bool IsEmpty() const { return !pixels || !width || !height; }
+
+	// A view works like a pointer, the pixels can be written through a const view
+	unsigned char* GetRow(unsigned int y) const { return pixels + (size_t)y * stride; }
+	unsigned char* GetPixelPtr(unsigned int x, unsigned int y) const { return GetRow(y) + x * bytes_per_pixel; }
+	Color GetPixel(unsigned int x, unsigned int y) const { return Image::UnpackColor(format, GetPixelPtr(x, y)); }
+	void SetPixel(unsigned int x, unsigned int y, const Color& c) const { Image::PackColor(format, c, GetPixelPtr(x, y)); }
+	void SetPixelSafe(int x, int y, const Color& c) const { if (x >= 0 && y >= 0 && x < (int)width && y < (int)height) SetPixel(x, y, c); }
+
+	// View of the area x,y,w,h clipped to this view, sharing the same pixels
+	ImageView GetArea(int x, int y, int w, int h) const;
+
+	void Fill(const Color& c) const;
+	void FlipY() const;
+
+	// The span primitives of Image, clipped to the view and with the same pixels, so drawing code can work
+	// on a region of an image (or any buffer) in place. Nothing is marked dirty, see Image::MarkDirty.
+	void FillSpan(int x, int y, int count, const Color& c) const;
+	void FillRect(int x, int y, int w, int h, const Color& c) const;
+	void DrawLine(int x0, int y0, int x1, int y1, const Color& c) const; // Same pixels as Image::DrawLineDDA
+	void FillTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& c) const;
+	void FillEllipse(int x, int y, int rx, int ry, const Color& c) const;
+	void FillDisk(int x, int y, int r, const Color& c) const { FillEllipse(x, y, r, r, c); }
+	void FillRing(int x, int y, int r0, int r1, const Color& c) const;
+	// Copies src into the top-left corner converting the format, only the area both views cover.
+	// The views must not overlap.
+	void CopyFrom(const ImageView& src) const;
+
+	#ifndef IGNORE_LAMBDAS
+	template <typename F>
+	const ImageView& ForEachPixel( F callback ) const
+	{
+		for (unsigned int y = 0; y < height; ++y) {
+			unsigned char* p = GetRow(y);
+			for (unsigned int x = 0; x < width; ++x, p += bytes_per_pixel)
+				Image::PackColor(format, callback(Image::UnpackColor(format, p)), p);
+		}
 		return *this;
 	}
 	#endif
 };
 
+#ifndef IGNORE_LAMBDAS
+
+// You can apply and algorithm for two images and store the result in the first one
+// ForEachPixel( img, img2, [](Color a, Color b) { return a + b; } );
+template <typename F>
+void ForEachPixel(Image& img, const Image& img2, F f) {
+	img.MarkAllDirty();
+	for(unsigned int y = 0; y < img.height; ++y)
+		for(unsigned int x = 0; x < img.width; ++x)
+			img.SetPixel(x, y, f( img.GetPixel(x, y), img2.GetPixel(x, y) ));
+}
+
+// Parallel version, the callback must be safe to call from several threads
+template <typename F>
+void ParallelForEachPixel(Image& img, const Image& img2, F f) {
+	if ((size_t)img.width * img.height < Image::PARALLEL_MIN_PIXELS)
+		return ForEachPixel(img, img2, f);
+
+	img.Detach();
+	img.MarkAllDirty();
+	unsigned int band = img.GetBandHeight();
+	ThreadPool::Get().ParallelFor((img.height + band - 1) / band, 1, [&](unsigned int begin, unsigned int end) {
+		unsigned int y_end = std::min(end * band, img.height);
+		for(unsigned int y = begin * band; y < y_end; ++y)
+			for(unsigned int x = 0; x < img.width; ++x)
+				img.SetPixel(x, y, f( img.GetPixel(x, y), img2.GetPixel(x, y) ));
+	});
+}
+
+#endif
+
 // Image storing one float per pixel instead of a 3 or 4 component Color
 
 class FloatImage
@@ -126,7 +453,9 @@ public:
 	FloatImage() { width = height = 0; pixels = NULL; }
 	FloatImage(unsigned int width, unsigned int height);
 	FloatImage(const FloatImage& c);
+	FloatImage(FloatImage&& c);
 	FloatImage& operator = (const FloatImage& c); //assign operator
+	FloatImage& operator = (FloatImage&& c); //move assign operator
 
 	//destructor
 	~FloatImage();
@@ -0,0 +1,63 @@
+/*
+	+ This file defines the input queue, that carries the SDL events from the main thread to the simulation thread.
+	+ SDL only reads the window events on the thread that created it, so the main thread does nothing else than wait
+	  for them and push them here. Update, Render and the handlers run on the simulation thread, so a slow frame or a
+	  slow handler delays the frames but never the reading of the input.
+	+ Every push also copies the keyboard and mouse state SDL had after those events, since SDL_GetKeyboardState and
+	  SDL_GetMouseState belong to the main thread too.
+*/
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "main/includes.h"
+
+class InputQueue
+{
+public:
+	struct State {
+		Uint8 keys[SDL_NUM_SCANCODES] = {};
+		Uint32 mouse_buttons = 0;
+		int mouse_x = 0, mouse_y = 0;
+	};
+
+	// Main thread. Adds the events and the state that goes with them, and wakes the simulation thread
+	void Push(const SDL_Event* events, unsigned int count, const State& state)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.insert(pending.end(), events, events + count);
+			latest = state;
+		}
+		wake.notify_one();
+	}
+
+	// Simulation thread. Sleeps until there are events or seconds go by, forever when seconds < 0
+	void Wait(double seconds)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (seconds < 0)
+			wake.wait(lock, [&] { return !pending.empty(); });
+		else
+			wake.wait_for(lock, std::chrono::duration<double>(seconds), [&] { return !pending.empty(); });
+	}
+
+	// Simulation thread. Moves the waiting events to events (swapping the buffers, so nothing is allocated
+	// once they are big enough) and copies the newest state
+	void Pop(std::vector<SDL_Event>& events, State& state)
+	{
+		events.clear();
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.swap(events);
+		state = latest;
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<SDL_Event> pending;
+	State latest;
+};
@@ -0,0 +1,101 @@
+/*
+	+ This file defines the line rasterizer, an integer Bresenham walk with the clipping done before it starts.
+	+ The visible part of the segment is found analytically, so a long line that runs mostly outside the
+	  clip rectangle only costs its visible pixels, and the pixels are the same ones the full walk would give.
+	+ The pixels come out as horizontal runs, so flat lines are written as spans instead of one by one.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+
+class LineRasterizer
+{
+public:
+	// Calls span(int x, int y, int count) for the pixels of the segment p0-p1 (both ends included) that fall
+	// inside [min_x, max_x] x [min_y, max_y], as runs of count pixels of row y starting at x and going right.
+	// The result does not depend on the order of the ends.
+	template <typename F>
+	static void Rasterize(int x0, int y0, int x1, int y1, int min_x, int min_y, int max_x, int max_y, F span)
+	{
+		if (min_x > max_x || min_y > max_y)
+			return;
+
+		int64_t dx = (int64_t)x1 - x0, dy = (int64_t)y1 - y0;
+		bool x_major = (dx < 0 ? -dx : dx) >= (dy < 0 ? -dy : dy);
+
+		// Walk always from the lower end of the major axis
+		if ((x_major && dx < 0) || (!x_major && dy < 0)) {
+			std::swap(x0, x1);
+			std::swap(y0, y1);
+			dx = -dx;
+			dy = -dy;
+		}
+
+		if (x_major) {
+			Walk(x0, y0, dx, dy, min_x, max_x, min_y, max_y, [&](int64_t major, int64_t minor, int64_t count) {
+				span((int)major, (int)minor, (int)count);
+			});
+		}
+		else {
+			// Same walk with the axes exchanged, every run is a single pixel
+			Walk(y0, x0, dy, dx, min_y, max_y, min_x, max_x, [&](int64_t major, int64_t minor, int64_t count) {
+				for (int64_t i = 0; i < count; ++i)
+					span((int)minor, (int)(major + i), 1);
+			});
+		}
+	}
+
+private:
+	static int64_t CeilDiv(int64_t a, int64_t b) { return a >= 0 ? (a + b - 1) / b : -((-a) / b); }
+
+	// Walks major from a0 to a0 + da (da >= 0 and da >= |db|), with the minor offset of step t being
+	// floor((2 t |db| + da) / (2 da)), the midpoint rounding of Bresenham. Calls run(major, minor, count).
+	template <typename F>
+	static void Walk(int64_t a0, int64_t b0, int64_t da, int64_t db, int64_t min_a, int64_t max_a, int64_t min_b, int64_t max_b, F run)
+	{
+		int64_t sb = db < 0 ? -1 : 1;
+		int64_t adb = db < 0 ? -db : db;
+
+		// Steps inside the segment and the major range
+		int64_t t_lo = std::max<int64_t>(0, min_a - a0);
+		int64_t t_hi = std::min<int64_t>(da, max_a - a0);
+
+		// Minor offsets inside the minor range
+		int64_t m_lo = sb > 0 ? min_b - b0 : b0 - max_b;
+		int64_t m_hi = sb > 0 ? max_b - b0 : b0 - min_b;
+		if (adb == 0) {
+			if (m_lo > 0 || m_hi < 0)
+				return;
+		}
+		else {
+			// First step whose offset reaches m_lo, last step whose offset is still m_hi
+			t_lo = std::max(t_lo, CeilDiv(2 * da * m_lo - da, 2 * adb));
+			t_hi = std::min(t_hi, CeilDiv(2 * da * (m_hi + 1) - da, 2 * adb) - 1);
+		}
+		if (t_lo > t_hi)
+			return;
+		if (da == 0) {
+			run(a0, b0, 1);
+			return;
+		}
+
+		// Error term of the first visible step, then the usual incremental walk
+		int64_t two_da = 2 * da, two_db = 2 * adb;
+		int64_t num = t_lo * two_db + da;
+		int64_t m = num / two_da;
+		int64_t r = num % two_da;
+		int64_t run_start = t_lo;
+		for (int64_t t = t_lo; t < t_hi; ++t) {
+			r += two_db;
+			if (r >= two_da) {
+				run(a0 + run_start, b0 + sb * m, t - run_start + 1);
+				r -= two_da;
+				m++;
+				run_start = t + 1;
+			}
+		}
+		run(a0 + run_start, b0 + sb * m, t_hi - run_start + 1);
+	}
+};
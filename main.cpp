@@ -1,8 +1,32 @@
 #include "framework/application.h"
 #include "framework/utils.h"
 
+// Renders without a window: main --headless <key> <frames> <output.tga>
+// The key selects the demo like in the app (1 to 6), every frame advances 1/60 seconds.
+// The output path is used as given (relative to the working directory), not inside res/ like the save button
+static int runHeadless(int argc, char **argv)
+{
+	int key = argc > 2 ? atoi(argv[2]) : 5;
+	int frames = argc > 3 ? atoi(argv[3]) : 1;
+	const char* output = argc > 4 ? argv[4] : "output.tga";
+
+	Application* app = new Application("Computer Graphics", 1280, 720, true);
+	app->Init();
+	app->SimulateKey('0' + key);
+	for (int i = 0; i < frames; ++i)
+		app->Tick(1.0f / 60.0f);
+
+	bool saved = app->framebuffer.SaveTGA(output, false);
+	std::cout << (saved ? "Saved " : "Error saving ") << output << std::endl;
+	delete app;
+	return saved ? 0 : 1;
+}
+
 int main(int argc, char **argv)
 {
+	if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+		return runHeadless(argc, argv);
+
 	// Launch the app (app is a global variable)
 	Application* app = new Application( "Computer Graphics", 1280, 720);
 	app->Init();
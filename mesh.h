@@ -27,7 +27,7 @@ public:
 
 	bool LoadOBJ(const char* filename);
 
-	const std::vector<Vector3>& GetVertices() { return vertices; }
-	const std::vector<Vector3>& GetNormals() { return normals; }
-	const std::vector<Vector2>& GetUVs() { return uvs; }
+	const std::vector<Vector3>& GetVertices() const { return vertices; }
+	const std::vector<Vector3>& GetNormals() const { return normals; }
+	const std::vector<Vector2>& GetUVs() const { return uvs; }
 };
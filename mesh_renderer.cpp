@@ -0,0 +1,199 @@
+#include "mesh_renderer.h"
+#include "mesh.h"
+#include "camera.h"
+#include "texture_sampler.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+// At most one new vertex per plane of the view volume
+#define MAX_CLIP_VERTICES 9
+
+// Distance to a plane of the view volume, scaled by w, inside when >= 0
+static float PlaneDistance(const Vector4& p, int plane)
+{
+	switch (plane) {
+	case 0: return p.w + p.x;
+	case 1: return p.w - p.x;
+	case 2: return p.w + p.y;
+	case 3: return p.w - p.y;
+	case 4: return p.w + p.z;
+	default: return p.w - p.z;
+	}
+}
+
+// One bit for every plane the point is outside of
+static int OutCode(const Vector4& p)
+{
+	int code = 0;
+	for (int plane = 0; plane < 6; ++plane)
+		if (PlaneDistance(p, plane) < 0.0f)
+			code |= 1 << plane;
+	return code;
+}
+
+float MeshRenderer::Shade(const Vector3& normal, const Vector3& light) const
+{
+	return ambient + (1.0f - ambient) * std::max(normal.Dot(light), 0.0f);
+}
+
+void MeshRenderer::Setup(const Mesh& mesh, const Matrix44& model, Camera& camera, unsigned int width, unsigned int height)
+{
+	this->width = width;
+	this->height = height;
+	triangles.clear();
+	bounds_x0 = bounds_y0 = INT_MAX;
+	bounds_x1 = bounds_y1 = INT_MIN;
+
+	const std::vector<Vector3>& positions = mesh.GetVertices();
+	const std::vector<Vector3>& normals = mesh.GetNormals();
+	const std::vector<Vector2>& uvs = mesh.GetUVs();
+	unsigned int count = (unsigned int)positions.size() / 3 * 3;
+	bool smooth = shading == SHADING_GOURAUD && normals.size() >= count;
+	bool textured = texture && !texture->IsEmpty() && uvs.size() >= count;
+
+	// The matrices are combined once, in the order of this Matrix44 the model goes first
+	Matrix44 model_view_projection = model * camera.viewprojection_matrix;
+	// Normals only rotate, uniform scales are undone by normalizing them
+	Matrix44 rotation = model;
+	rotation.m[12] = rotation.m[13] = rotation.m[14] = 0.0f;
+	Vector3 light = light_direction;
+	light.Normalize();
+
+	// Vertex pass, straight over the arrays of the mesh
+	vertices.resize(count);
+	for (unsigned int i = 0; i < count; ++i) {
+		const Vector3& p = positions[i];
+		vertices[i].position = model_view_projection * Vector4(p.x, p.y, p.z, 1.0f);
+		vertices[i].shade = 0.0f;
+		vertices[i].u = textured ? uvs[i].x : 0.0f;
+		vertices[i].v = textured ? uvs[i].y : 0.0f;
+		if (smooth) {
+			Vector3 n = rotation * normals[i];
+			float length = n.Length();
+			vertices[i].shade = length > 0.0f ? Shade(n / length, light) : ambient;
+		}
+	}
+
+	// Primitive pass: the triangles outside a plane are dropped whole, only the ones across one are clipped
+	for (unsigned int i = 0; i < count; i += 3) {
+		ClipVertex v[3] = { vertices[i], vertices[i + 1], vertices[i + 2] };
+		int code0 = OutCode(v[0].position), code1 = OutCode(v[1].position), code2 = OutCode(v[2].position);
+		if (code0 & code1 & code2)
+			continue;
+
+		if (!smooth) {
+			// Normal of the face, counter-clockwise triangles face outwards
+			Vector3 n = rotation * (positions[i + 1] - positions[i]).Cross(positions[i + 2] - positions[i]);
+			float length = n.Length();
+			// On the three vertices, the first one after clipping may be a new one
+			v[0].shade = v[1].shade = v[2].shade = length > 0.0f ? Shade(n / length, light) : ambient;
+		}
+
+		if (code0 | code1 | code2)
+			ClipTriangle(v[0], v[1], v[2], !smooth, textured);
+		else
+			AddTriangle(v[0], v[1], v[2], !smooth, textured);
+	}
+}
+
+void MeshRenderer::ClipTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, bool flat, bool textured)
+{
+	// Sutherland-Hodgman, the polygon goes back and forth between the two arrays
+	ClipVertex buffers[2][MAX_CLIP_VERTICES];
+	ClipVertex* polygon = buffers[0];
+	ClipVertex* clipped = buffers[1];
+	polygon[0] = a;
+	polygon[1] = b;
+	polygon[2] = c;
+	int count = 3;
+
+	for (int plane = 0; plane < 6 && count >= 3; ++plane) {
+		int clipped_count = 0;
+		for (int i = 0; i < count; ++i) {
+			const ClipVertex& p0 = polygon[i];
+			const ClipVertex& p1 = polygon[(i + 1) % count];
+			float d0 = PlaneDistance(p0.position, plane), d1 = PlaneDistance(p1.position, plane);
+			if (d0 >= 0.0f)
+				clipped[clipped_count++] = p0;
+			if ((d0 >= 0.0f) != (d1 >= 0.0f)) {
+				float t = d0 / (d0 - d1);
+				ClipVertex& p = clipped[clipped_count++];
+				for (int k = 0; k < 4; ++k)
+					p.position.v[k] = p0.position.v[k] + (p1.position.v[k] - p0.position.v[k]) * t;
+				p.shade = p0.shade + (p1.shade - p0.shade) * t;
+				p.u = p0.u + (p1.u - p0.u) * t;
+				p.v = p0.v + (p1.v - p0.v) * t;
+			}
+		}
+		std::swap(polygon, clipped);
+		count = clipped_count;
+	}
+
+	// The polygon is convex, a fan from its first vertex
+	for (int i = 1; i + 1 < count; ++i)
+		AddTriangle(polygon[0], polygon[i], polygon[i + 1], flat, textured);
+}
+
+void MeshRenderer::AddTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, bool flat, bool textured)
+{
+	const ClipVertex* clip[3] = { &a, &b, &c };
+	Triangle t;
+	t.flat = flat;
+	t.textured = textured;
+	t.shade = a.shade;
+	float q[3][PLANE_COUNT];
+	for (int k = 0; k < 3; ++k) {
+		const Vector4& p = clip[k]->position;
+		if (!(p.w > 0.0f))
+			return;
+		// Normalized device coordinates to pixel centers, -1 and 1 are the edges of the image
+		float inv_w = 1.0f / p.w;
+		t.p[k].x = (p.x * inv_w + 1.0f) * 0.5f * width - 0.5f;
+		t.p[k].y = (p.y * inv_w + 1.0f) * 0.5f * height - 0.5f;
+		q[k][PLANE_Z] = p.z * inv_w * 0.5f + 0.5f;
+		q[k][PLANE_INV_W] = inv_w;
+		q[k][PLANE_SHADE] = clip[k]->shade * inv_w;
+		q[k][PLANE_U] = clip[k]->u * inv_w;
+		q[k][PLANE_V] = clip[k]->v * inv_w;
+	}
+
+	float ax = t.p[1].x - t.p[0].x, ay = t.p[1].y - t.p[0].y;
+	float bx = t.p[2].x - t.p[0].x, by = t.p[2].y - t.p[0].y;
+	float area = ax * by - bx * ay;
+	if (area == 0.0f || (cull_back_faces && area < 0.0f))
+		return;
+
+	// Box of the pixels the triangle can touch, clipped to the image
+	float min_x = std::min(t.p[0].x, std::min(t.p[1].x, t.p[2].x)), max_x = std::max(t.p[0].x, std::max(t.p[1].x, t.p[2].x));
+	float min_y = std::min(t.p[0].y, std::min(t.p[1].y, t.p[2].y)), max_y = std::max(t.p[0].y, std::max(t.p[1].y, t.p[2].y));
+	t.x0 = std::max((int)std::floor(std::max(min_x, -1.0f)), 0);
+	t.y0 = std::max((int)std::floor(std::max(min_y, -1.0f)), 0);
+	t.x1 = std::min((int)std::ceil(std::min(max_x, (float)width)), (int)width - 1);
+	t.y1 = std::min((int)std::ceil(std::min(max_y, (float)height)), (int)height - 1);
+	if (t.x0 > t.x1 || t.y0 > t.y1)
+		return;
+
+	for (int i = 0; i < PLANE_COUNT; ++i) {
+		float q1 = q[1][i] - q[0][i], q2 = q[2][i] - q[0][i];
+		t.q0[i] = q[0][i];
+		t.dx[i] = (q1 * by - q2 * ay) / area;
+		t.dy[i] = (q2 * ax - q1 * bx) / area;
+	}
+
+	bounds_x0 = std::min(bounds_x0, t.x0);
+	bounds_y0 = std::min(bounds_y0, t.y0);
+	bounds_x1 = std::max(bounds_x1, t.x1);
+	bounds_y1 = std::max(bounds_y1, t.y1);
+	triangles.push_back(t);
+}
+
+bool MeshRenderer::GetBounds(int& x0, int& y0, int& x1, int& y1) const
+{
+	x0 = bounds_x0;
+	y0 = bounds_y0;
+	x1 = bounds_x1;
+	y1 = bounds_y1;
+	return x0 <= x1 && y0 <= y1;
+}
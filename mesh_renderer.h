@@ -0,0 +1,74 @@
+/*
+	+ This file defines the mesh renderer, the front-end of the CPU pipeline that draws a Mesh into an Image without any GPU.
+	+ All the vertices are transformed to clip space in one pass over the arrays of the mesh, lit per vertex or per face.
+	+ Every triangle is clipped against the view volume in homogeneous coordinates, projected to pixels and culled by
+	  its orientation on screen, counter-clockwise being the front as in OpenGL.
+	+ Image::DrawMesh rasterizes the result with a depth test against a FloatImage, interpolating 1 / w and the
+	  attributes divided by w, so they are correct in perspective. Bands of rows are rasterized in parallel, each
+	  one with all the triangles that touch it in order, so no two threads share a pixel of the image or the depth.
+	+ With a texture set, meshes with texture coordinates are textured and the texture is multiplied by the light.
+*/
+
+#pragma once
+
+#include <vector>
+#include "framework.h"
+
+class Mesh;
+class Camera;
+class TextureSampler;
+
+class MeshRenderer
+{
+public:
+	enum Shading { SHADING_FLAT, SHADING_GOURAUD };
+
+	Shading shading = SHADING_GOURAUD;
+	bool cull_back_faces = true;
+	Color color = Color(255, 255, 255);
+	Vector3 light_direction = Vector3(0.3f, 0.5f, 1.0f); // Towards the light, in world space
+	float ambient = 0.2f;
+	const TextureSampler* texture = NULL;
+
+	// Rows of the image rasterized together by a thread
+	static const int BAND_HEIGHT = 32;
+
+	// Values interpolated across a triangle, each one is a plane on screen q0 + dx (x - p[0].x) + dy (y - p[0].y).
+	// The depth in [0, 1] is linear on screen, the others are divided by w and go back with 1 / w at every pixel.
+	enum { PLANE_Z, PLANE_INV_W, PLANE_SHADE, PLANE_U, PLANE_V, PLANE_COUNT };
+
+	struct Triangle {
+		Vector2 p[3];
+		int x0, y0, x1, y1; // Pixels it can touch, clipped to the image
+		// Flat triangles have the same light in all their pixels, in shade
+		bool flat, textured;
+		float shade;
+		float q0[PLANE_COUNT], dx[PLANE_COUNT], dy[PLANE_COUNT];
+	};
+
+	// Transforms, clips, projects and culls the triangles of the mesh for an image of width x height.
+	// The model matrix places the mesh in the world, the camera has to be up to date.
+	void Setup(const Mesh& mesh, const Matrix44& model, Camera& camera, unsigned int width, unsigned int height);
+
+	unsigned int GetCount() const { return (unsigned int)triangles.size(); }
+	const Triangle& GetTriangle(unsigned int i) const { return triangles[i]; }
+	// Pixels touched by the triangles, false when there are none
+	bool GetBounds(int& x0, int& y0, int& x1, int& y1) const;
+
+private:
+	// Vertex in clip space, inside the view volume when -w <= x, y, z <= w
+	struct ClipVertex {
+		Vector4 position;
+		float shade, u, v;
+	};
+
+	std::vector<ClipVertex> vertices; // Output of the vertex pass, kept for the next frame
+	std::vector<Triangle> triangles;
+	unsigned int width = 0, height = 0;
+	int bounds_x0 = 0, bounds_y0 = 0, bounds_x1 = -1, bounds_y1 = -1;
+
+	// Light of a unit normal in world space
+	float Shade(const Vector3& normal, const Vector3& light) const;
+	void ClipTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, bool flat, bool textured);
+	void AddTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, bool flat, bool textured);
+};
@@ -0,0 +1,914 @@
+#include "pixel_kernels.h"
+
+#include <string.h>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#define KERNELS_X86
+	#include <emmintrin.h>
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+#endif
+
+// GCC and Clang need the AVX2 functions to be marked, MSVC accepts the intrinsics anywhere
+#if defined(KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+	#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+	#define TARGET_AVX2
+#endif
+
+// Fills bigger than this skip the cache, the data would not fit anyway
+#define STREAMING_THRESHOLD (1024 * 1024)
+
+// Read by kernels on every pool thread, -1 until the first call detects it
+static std::atomic<int> current_level(-1);
+
+static PixelKernels::Level DetectLevel()
+{
+#if !defined(KERNELS_X86)
+	return PixelKernels::SCALAR;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] >= 7) {
+		__cpuid(info, 1);
+		bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+		__cpuidex(info, 7, 0);
+		if (os_saves_ymm && (info[1] & (1 << 5)))
+			return PixelKernels::AVX2;
+	}
+	return PixelKernels::SSE2;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? PixelKernels::AVX2 : PixelKernels::SSE2;
+#endif
+}
+
+PixelKernels::Level PixelKernels::GetLevel()
+{
+	int level = current_level.load(std::memory_order_relaxed);
+	if (level < 0) {
+		// Threads racing here all detect the same level
+		level = DetectLevel();
+		current_level.store(level, std::memory_order_relaxed);
+	}
+	return (Level)level;
+}
+
+void PixelKernels::SetLevel(Level level)
+{
+	// Never go above what the CPU supports
+	Level max_level = DetectLevel();
+	current_level.store(level > max_level ? max_level : level, std::memory_order_relaxed);
+}
+
+const char* PixelKernels::GetLevelName(Level level)
+{
+	switch (level) {
+		case SCALAR: return "scalar";
+		case SSE2: return "sse2";
+		case AVX2: return "avx2";
+	}
+	return "unknown";
+}
+
+//**************************************
+// Scalar versions, also used for the tails of the SIMD loops
+
+static void Fill32Scalar(uint32_t* dst, uint32_t value, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+		dst[i] = value;
+}
+
+static void Fill24Scalar(unsigned char* dst, const unsigned char* rgb, size_t count)
+{
+	for (size_t i = 0; i < count; ++i, dst += 3) {
+		dst[0] = rgb[0];
+		dst[1] = rgb[1];
+		dst[2] = rgb[2];
+	}
+}
+
+static void ConvertRGBToRGBXScalar(uint32_t* dst, const unsigned char* src, size_t count)
+{
+	unsigned char* d = (unsigned char*)dst;
+	for (size_t i = 0; i < count; ++i, src += 3, d += 4) {
+		d[0] = src[0]; d[1] = src[1]; d[2] = src[2]; d[3] = 255;
+	}
+}
+
+static void ConvertRGBXToRGBScalar(unsigned char* dst, const uint32_t* src, size_t count)
+{
+	const unsigned char* s = (const unsigned char*)src;
+	for (size_t i = 0; i < count; ++i, s += 4, dst += 3) {
+		dst[0] = s[0]; dst[1] = s[1]; dst[2] = s[2];
+	}
+}
+
+static void ConvertRGBXToGrayScalar(unsigned char* dst, const uint32_t* src, size_t count)
+{
+	const unsigned char* s = (const unsigned char*)src;
+	for (size_t i = 0; i < count; ++i, s += 4)
+		dst[i] = (unsigned char)((s[0] * 77 + s[1] * 150 + s[2] * 29) >> 8);
+}
+
+static void ConvertRGBToGrayScalar(unsigned char* dst, const unsigned char* src, size_t count)
+{
+	for (size_t i = 0; i < count; ++i, src += 3)
+		dst[i] = (unsigned char)((src[0] * 77 + src[1] * 150 + src[2] * 29) >> 8);
+}
+
+static void ConvertGrayToRGBScalar(unsigned char* dst, const unsigned char* src, size_t count)
+{
+	for (size_t i = 0; i < count; ++i, dst += 3)
+		dst[0] = dst[1] = dst[2] = src[i];
+}
+
+static void ConvertGrayToRGBXScalar(uint32_t* dst, const unsigned char* src, size_t count)
+{
+	unsigned char* d = (unsigned char*)dst;
+	for (size_t i = 0; i < count; ++i, d += 4) {
+		d[0] = d[1] = d[2] = src[i]; d[3] = 255;
+	}
+}
+
+static void SwapRedBlue24Scalar(unsigned char* dst, const unsigned char* src, size_t count)
+{
+	for (size_t i = 0; i < count; ++i, src += 3, dst += 3) {
+		unsigned char r = src[0];
+		dst[1] = src[1];
+		dst[0] = src[2];
+		dst[2] = r;
+	}
+}
+
+static void SwapRedBlue32Scalar(uint32_t* dst, const uint32_t* src, size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t v = src[i];
+		dst[i] = (v & 0xFF00FF00u) | ((v >> 16) & 0xFFu) | ((v & 0xFFu) << 16);
+	}
+}
+
+static void CopyColorKey32Scalar(uint32_t* dst, const uint32_t* src, uint32_t key, size_t count)
+{
+	key &= 0x00FFFFFFu;
+	for (size_t i = 0; i < count; ++i)
+		if ((src[i] & 0x00FFFFFFu) != key)
+			dst[i] = src[i];
+}
+
+// Exact division by 255 of v + 128, valid for v <= 255 * 255
+static inline unsigned int Div255(unsigned int v)
+{
+	v += 128;
+	return (v + (v >> 8)) >> 8;
+}
+
+static void BlendBytesScalar(unsigned char* dst, const unsigned char* src, unsigned int alpha, size_t bytes)
+{
+	unsigned int inv_alpha = 255 - alpha;
+	for (size_t i = 0; i < bytes; ++i)
+		dst[i] = (unsigned char)Div255(src[i] * alpha + dst[i] * inv_alpha);
+}
+
+static void BlendPixels32Scalar(uint32_t* dst, const uint32_t* src, size_t count)
+{
+	unsigned char* d = (unsigned char*)dst;
+	const unsigned char* s = (const unsigned char*)src;
+	for (size_t i = 0; i < count; ++i, d += 4, s += 4) {
+		unsigned int a = s[3], inv_a = 255 - a;
+		d[0] = (unsigned char)Div255(s[0] * a + d[0] * inv_a);
+		d[1] = (unsigned char)Div255(s[1] * a + d[1] * inv_a);
+		d[2] = (unsigned char)Div255(s[2] * a + d[2] * inv_a);
+		d[3] = (unsigned char)Div255(255 * a + d[3] * inv_a);
+	}
+}
+
+static void BlendPixels24Scalar(unsigned char* dst, const uint32_t* src, size_t count)
+{
+	const unsigned char* s = (const unsigned char*)src;
+	for (size_t i = 0; i < count; ++i, dst += 3, s += 4) {
+		unsigned int a = s[3], inv_a = 255 - a;
+		dst[0] = (unsigned char)Div255(s[0] * a + dst[0] * inv_a);
+		dst[1] = (unsigned char)Div255(s[1] * a + dst[1] * inv_a);
+		dst[2] = (unsigned char)Div255(s[2] * a + dst[2] * inv_a);
+	}
+}
+
+#ifdef KERNELS_X86
+
+//**************************************
+// SSE2 versions
+
+// (src * alpha + dst * inv_alpha) / 255 on 8 16-bit lanes
+static inline __m128i Lerp16SSE2(__m128i d, __m128i s, __m128i alpha, __m128i inv_alpha)
+{
+	__m128i v = _mm_add_epi16(_mm_mullo_epi16(s, alpha), _mm_mullo_epi16(d, inv_alpha));
+	v = _mm_add_epi16(v, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+}
+
+static inline __m128i LerpBytesSSE2(__m128i d, __m128i s, __m128i alpha, __m128i inv_alpha)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = Lerp16SSE2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero), alpha, inv_alpha);
+	__m128i hi = Lerp16SSE2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero), alpha, inv_alpha);
+	return _mm_packus_epi16(lo, hi);
+}
+
+// 12 bytes, 4 RGB pixels, without touching memory past them
+static inline __m128i Load12SSE2(const unsigned char* p)
+{
+	int last;
+	memcpy(&last, p + 8, 4);
+	return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)p), _mm_cvtsi32_si128(last));
+}
+
+static inline void Store12SSE2(unsigned char* p, __m128i v)
+{
+	_mm_storel_epi64((__m128i*)p, v);
+	int last = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+	memcpy(p + 8, &last, 4);
+}
+
+// 4 RGB pixels in the low 12 bytes to one pixel per 32-bit lane, the fourth byte of each lane is left undefined.
+// SSE2 has no byte shuffle, the pixels are shifted down to the bottom lane and interleaved.
+static inline __m128i ExpandRGBSSE2(__m128i v)
+{
+	__m128i p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+	__m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+	return _mm_unpacklo_epi64(p01, p23);
+}
+
+// The opposite, the fourth bytes are dropped and the 4 pixels end up in the low 12 bytes
+static inline __m128i PackRGBSSE2(__m128i v)
+{
+	// In each 64-bit half the odd pixel moves down a byte, next to the even one
+	__m128i even = _mm_and_si128(v, _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF));
+	__m128i odd = _mm_and_si128(_mm_srli_epi64(v, 8), _mm_set_epi32(0xFFFF, (int)0xFF000000u, 0xFFFF, (int)0xFF000000u));
+	__m128i t = _mm_or_si128(even, odd);
+	return _mm_or_si128(_mm_move_epi64(t), _mm_slli_si128(_mm_srli_si128(t, 8), 6));
+}
+
+// Gray of 4 pixels, one per 32-bit lane, as the 4 bytes of the result
+static inline int Gray4SSE2(__m128i s)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i weights = _mm_setr_epi16(77, 150, 29, 0, 77, 150, 29, 0);
+	// r*77 + g*150 and b*29 for each pixel, then add the two halves
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(s, zero), weights);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(s, zero), weights);
+	lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+	hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+	lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 2, 0));
+	hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 2, 0));
+	__m128i sum = _mm_srli_epi32(_mm_unpacklo_epi64(lo, hi), 8);
+	sum = _mm_packs_epi32(sum, sum);
+	sum = _mm_packus_epi16(sum, sum);
+	return _mm_cvtsi128_si32(sum);
+}
+
+// Non premultiplied s over d for 4 pixels, the alpha of d moves towards 255
+static inline __m128i BlendOver4SSE2(__m128i d, __m128i s)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i all = _mm_set1_epi16(255);
+
+	// Broadcast the alpha of every pixel to its 4 channels
+	__m128i s_lo = _mm_unpacklo_epi8(s, zero);
+	__m128i s_hi = _mm_unpackhi_epi8(s, zero);
+	__m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+	s = _mm_or_si128(s, _mm_set1_epi32((int)0xFF000000u));
+	__m128i lo = Lerp16SSE2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero), a_lo, _mm_sub_epi16(all, a_lo));
+	__m128i hi = Lerp16SSE2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero), a_hi, _mm_sub_epi16(all, a_hi));
+	return _mm_packus_epi16(lo, hi);
+}
+
+static void Fill32SSE2(uint32_t* dst, uint32_t value, size_t count)
+{
+	size_t i = 0;
+	for (; i < count && ((uintptr_t)(dst + i) & 15); ++i)
+		dst[i] = value;
+
+	__m128i v = _mm_set1_epi32((int)value);
+	if (count * 4 >= STREAMING_THRESHOLD) {
+		for (; i + 16 <= count; i += 16) {
+			_mm_stream_si128((__m128i*)(dst + i), v);
+			_mm_stream_si128((__m128i*)(dst + i + 4), v);
+			_mm_stream_si128((__m128i*)(dst + i + 8), v);
+			_mm_stream_si128((__m128i*)(dst + i + 12), v);
+		}
+		_mm_sfence();
+	}
+	for (; i + 4 <= count; i += 4)
+		_mm_store_si128((__m128i*)(dst + i), v);
+
+	Fill32Scalar(dst + i, value, count - i);
+}
+
+static void Fill24SSE2(unsigned char* dst, const unsigned char* rgb, size_t count)
+{
+	// 16 pixels are exactly three 16-byte vectors
+	unsigned char pattern[48];
+	Fill24Scalar(pattern, rgb, 16);
+	__m128i p0 = _mm_loadu_si128((const __m128i*)pattern);
+	__m128i p1 = _mm_loadu_si128((const __m128i*)(pattern + 16));
+	__m128i p2 = _mm_loadu_si128((const __m128i*)(pattern + 32));
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16, dst += 48) {
+		_mm_storeu_si128((__m128i*)dst, p0);
+		_mm_storeu_si128((__m128i*)(dst + 16), p1);
+		_mm_storeu_si128((__m128i*)(dst + 32), p2);
+	}
+	Fill24Scalar(dst, rgb, count - i);
+}
+
+static void SwapSSE2(unsigned char* a, unsigned char* b, size_t bytes)
+{
+	size_t i = 0;
+	for (; i + 32 <= bytes; i += 32) {
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(a + i + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(b + i));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(b + i + 16));
+		_mm_storeu_si128((__m128i*)(a + i), b0);
+		_mm_storeu_si128((__m128i*)(a + i + 16), b1);
+		_mm_storeu_si128((__m128i*)(b + i), a0);
+		_mm_storeu_si128((__m128i*)(b + i + 16), a1);
+	}
+	for (; i < bytes; ++i) {
+		unsigned char t = a[i];
+		a[i] = b[i];
+		b[i] = t;
+	}
+}
+
+static void ConvertRGBAToRGBXSSE2(uint32_t* dst, const uint32_t* src, size_t count)
+{
+	__m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_loadu_si128((const __m128i*)(src + i)), alpha));
+	for (; i < count; ++i)
+		dst[i] = src[i] | 0xFF000000u;
+}
+
+static void ConvertRGBToRGBXSSE2(uint32_t* dst, const unsigned char* src, size_t count)
+{
+	__m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4, src += 12)
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(ExpandRGBSSE2(Load12SSE2(src)), alpha));
+	ConvertRGBToRGBXScalar(dst + i, src, count - i);
+}
+
+static void ConvertRGBXToRGBSSE2(unsigned char* dst, const uint32_t* src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4, dst += 12)
+		Store12SSE2(dst, PackRGBSSE2(_mm_loadu_si128((const __m128i*)(src + i))));
+	ConvertRGBXToRGBScalar(dst, src + i, count - i);
+}
+
+static void ConvertRGBXToGraySSE2(unsigned char* dst, const uint32_t* src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		int v = Gray4SSE2(_mm_loadu_si128((const __m128i*)(src + i)));
+		memcpy(dst + i, &v, 4);
+	}
+	ConvertRGBXToGrayScalar(dst + i, src + i, count - i);
+}
+
+static void ConvertRGBToGraySSE2(unsigned char* dst, const unsigned char* src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4, src += 12) {
+		int v = Gray4SSE2(ExpandRGBSSE2(Load12SSE2(src)));
+		memcpy(dst + i, &v, 4);
+	}
+	ConvertRGBToGrayScalar(dst + i, src, count - i);
+}
+
+static void ConvertGrayToRGBXSSE2(uint32_t* dst, const unsigned char* src, size_t count)
+{
+	__m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i g = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i g_lo = _mm_unpacklo_epi8(g, g);
+		__m128i g_hi = _mm_unpackhi_epi8(g, g);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_unpacklo_epi16(g_lo, g_lo), alpha));
+		_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_or_si128(_mm_unpackhi_epi16(g_lo, g_lo), alpha));
+		_mm_storeu_si128((__m128i*)(dst + i + 8), _mm_or_si128(_mm_unpacklo_epi16(g_hi, g_hi), alpha));
+		_mm_storeu_si128((__m128i*)(dst + i + 12), _mm_or_si128(_mm_unpackhi_epi16(g_hi, g_hi), alpha));
+	}
+	ConvertGrayToRGBXScalar(dst + i, src + i, count - i);
+}
+
+static void ConvertGrayToRGBSSE2(unsigned char* dst, const unsigned char* src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16, dst += 48) {
+		__m128i g = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i g_lo = _mm_unpacklo_epi8(g, g);
+		__m128i g_hi = _mm_unpackhi_epi8(g, g);
+		Store12SSE2(dst, PackRGBSSE2(_mm_unpacklo_epi16(g_lo, g_lo)));
+		Store12SSE2(dst + 12, PackRGBSSE2(_mm_unpackhi_epi16(g_lo, g_lo)));
+		Store12SSE2(dst + 24, PackRGBSSE2(_mm_unpacklo_epi16(g_hi, g_hi)));
+		Store12SSE2(dst + 36, PackRGBSSE2(_mm_unpackhi_epi16(g_hi, g_hi)));
+	}
+	ConvertGrayToRGBScalar(dst, src + i, count - i);
+}
+
+static void SwapRedBlue24SSE2(unsigned char* dst, const unsigned char* src, size_t count)
+{
+	// As the AVX2 version, 5 pixels per step. Without a byte shuffle, red and blue are the bytes
+	// two places away, selected by masks on the pixel positions.
+	const __m128i red = _mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, 0);
+	const __m128i blue = _mm_setr_epi8(0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0);
+	const __m128i green = _mm_setr_epi8(0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, -1);
+	size_t i = 0;
+	for (; i + 6 <= count; i += 5, src += 15, dst += 15) {
+		__m128i v = _mm_loadu_si128((const __m128i*)src);
+		__m128i r = _mm_or_si128(_mm_and_si128(_mm_srli_si128(v, 2), red), _mm_and_si128(_mm_slli_si128(v, 2), blue));
+		_mm_storeu_si128((__m128i*)dst, _mm_or_si128(r, _mm_and_si128(v, green)));
+	}
+	SwapRedBlue24Scalar(dst, src, count - i);
+}
+
+static void SwapRedBlue32SSE2(uint32_t* dst, const uint32_t* src, size_t count)
+{
+	__m128i mask_ga = _mm_set1_epi32((int)0xFF00FF00u);
+	__m128i mask_low = _mm_set1_epi32(0xFF);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i r = _mm_or_si128(_mm_and_si128(v, mask_ga), _mm_and_si128(_mm_srli_epi32(v, 16), mask_low));
+		r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(v, mask_low), 16));
+		_mm_storeu_si128((__m128i*)(dst + i), r);
+	}
+	SwapRedBlue32Scalar(dst + i, src + i, count - i);
+}
+
+static void CopyColorKey32SSE2(uint32_t* dst, const uint32_t* src, uint32_t key, size_t count)
+{
+	__m128i mask = _mm_set1_epi32(0x00FFFFFF);
+	__m128i k = _mm_set1_epi32((int)(key & 0x00FFFFFFu));
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i keep = _mm_cmpeq_epi32(_mm_and_si128(s, mask), k);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, s)));
+	}
+	CopyColorKey32Scalar(dst + i, src + i, key, count - i);
+}
+
+static void BlendConstant32SSE2(uint32_t* dst, uint32_t color, unsigned int alpha, size_t count)
+{
+	__m128i c = _mm_set1_epi32((int)color);
+	__m128i a = _mm_set1_epi16((short)alpha);
+	__m128i inv_a = _mm_set1_epi16((short)(255 - alpha));
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		_mm_storeu_si128((__m128i*)(dst + i), LerpBytesSSE2(d, c, a, inv_a));
+	}
+	for (; i < count; ++i)
+		BlendBytesScalar((unsigned char*)(dst + i), (const unsigned char*)&color, alpha, 4);
+}
+
+static void BlendConstant24SSE2(unsigned char* dst, const unsigned char* rgb, unsigned int alpha, size_t count)
+{
+	unsigned char pattern[48];
+	Fill24Scalar(pattern, rgb, 16);
+	__m128i p0 = _mm_loadu_si128((const __m128i*)pattern);
+	__m128i p1 = _mm_loadu_si128((const __m128i*)(pattern + 16));
+	__m128i p2 = _mm_loadu_si128((const __m128i*)(pattern + 32));
+	__m128i a = _mm_set1_epi16((short)alpha);
+	__m128i inv_a = _mm_set1_epi16((short)(255 - alpha));
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16, dst += 48) {
+		_mm_storeu_si128((__m128i*)dst, LerpBytesSSE2(_mm_loadu_si128((const __m128i*)dst), p0, a, inv_a));
+		_mm_storeu_si128((__m128i*)(dst + 16), LerpBytesSSE2(_mm_loadu_si128((const __m128i*)(dst + 16)), p1, a, inv_a));
+		_mm_storeu_si128((__m128i*)(dst + 32), LerpBytesSSE2(_mm_loadu_si128((const __m128i*)(dst + 32)), p2, a, inv_a));
+	}
+	for (; i < count; ++i, dst += 3)
+		BlendBytesScalar(dst, rgb, alpha, 3);
+}
+
+static void BlendPixels32SSE2(uint32_t* dst, const uint32_t* src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		_mm_storeu_si128((__m128i*)(dst + i), BlendOver4SSE2(d, s));
+	}
+	BlendPixels32Scalar(dst + i, src + i, count - i);
+}
+
+static void BlendPixels24SSE2(unsigned char* dst, const uint32_t* src, size_t count)
+{
+	// The pixels of dst are widened to 32 bits, their undefined fourth byte is dropped again
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4, dst += 12) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i d = ExpandRGBSSE2(Load12SSE2(dst));
+		Store12SSE2(dst, PackRGBSSE2(BlendOver4SSE2(d, s)));
+	}
+	BlendPixels24Scalar(dst, src + i, count - i);
+}
+
+//**************************************
+// AVX2 versions (they also use SSSE3 shuffles, which every AVX2 CPU has)
+
+TARGET_AVX2 static inline __m256i Lerp16AVX2(__m256i d, __m256i s, __m256i alpha, __m256i inv_alpha)
+{
+	__m256i v = _mm256_add_epi16(_mm256_mullo_epi16(s, alpha), _mm256_mullo_epi16(d, inv_alpha));
+	v = _mm256_add_epi16(v, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(v, _mm256_srli_epi16(v, 8)), 8);
+}
+
+TARGET_AVX2 static void Fill32AVX2(uint32_t* dst, uint32_t value, size_t count)
+{
+	size_t i = 0;
+	for (; i < count && ((uintptr_t)(dst + i) & 31); ++i)
+		dst[i] = value;
+
+	__m256i v = _mm256_set1_epi32((int)value);
+	if (count * 4 >= STREAMING_THRESHOLD) {
+		for (; i + 32 <= count; i += 32) {
+			_mm256_stream_si256((__m256i*)(dst + i), v);
+			_mm256_stream_si256((__m256i*)(dst + i + 8), v);
+			_mm256_stream_si256((__m256i*)(dst + i + 16), v);
+			_mm256_stream_si256((__m256i*)(dst + i + 24), v);
+		}
+		_mm_sfence();
+	}
+	for (; i + 8 <= count; i += 8)
+		_mm256_store_si256((__m256i*)(dst + i), v);
+
+	Fill32Scalar(dst + i, value, count - i);
+}
+
+TARGET_AVX2 static void Fill24AVX2(unsigned char* dst, const unsigned char* rgb, size_t count)
+{
+	// 32 pixels are exactly three 32-byte vectors
+	unsigned char pattern[96];
+	Fill24Scalar(pattern, rgb, 32);
+	__m256i p0 = _mm256_loadu_si256((const __m256i*)pattern);
+	__m256i p1 = _mm256_loadu_si256((const __m256i*)(pattern + 32));
+	__m256i p2 = _mm256_loadu_si256((const __m256i*)(pattern + 64));
+
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32, dst += 96) {
+		_mm256_storeu_si256((__m256i*)dst, p0);
+		_mm256_storeu_si256((__m256i*)(dst + 32), p1);
+		_mm256_storeu_si256((__m256i*)(dst + 64), p2);
+	}
+	Fill24Scalar(dst, rgb, count - i);
+}
+
+TARGET_AVX2 static void ConvertRGBToRGBXAVX2(uint32_t* dst, const unsigned char* src, size_t count)
+{
+	const __m128i mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16, src += 48) {
+		__m128i a = _mm_loadu_si128((const __m128i*)src);
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(src + 32));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_shuffle_epi8(a, mask), alpha));
+		_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), mask), alpha));
+		_mm_storeu_si128((__m128i*)(dst + i + 8), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), mask), alpha));
+		_mm_storeu_si128((__m128i*)(dst + i + 12), _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), mask), alpha));
+	}
+	ConvertRGBToRGBXScalar(dst + i, src, count - i);
+}
+
+TARGET_AVX2 static void ConvertRGBXToRGBAVX2(unsigned char* dst, const uint32_t* src, size_t count)
+{
+	const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16, dst += 48) {
+		__m128i s0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i)), mask);
+		__m128i s1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i + 4)), mask);
+		__m128i s2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i + 8)), mask);
+		__m128i s3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i + 12)), mask);
+		_mm_storeu_si128((__m128i*)dst, _mm_or_si128(s0, _mm_slli_si128(s1, 12)));
+		_mm_storeu_si128((__m128i*)(dst + 16), _mm_or_si128(_mm_srli_si128(s1, 4), _mm_slli_si128(s2, 8)));
+		_mm_storeu_si128((__m128i*)(dst + 32), _mm_or_si128(_mm_srli_si128(s2, 8), _mm_slli_si128(s3, 4)));
+	}
+	ConvertRGBXToRGBScalar(dst, src + i, count - i);
+}
+
+TARGET_AVX2 static void SwapRedBlue24AVX2(unsigned char* dst, const unsigned char* src, size_t count)
+{
+	// 5 pixels per step, the 16th byte is copied untouched and rewritten by the next step
+	const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+	size_t i = 0;
+	for (; i + 6 <= count; i += 5, src += 15, dst += 15)
+		_mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), mask));
+	SwapRedBlue24Scalar(dst, src, count - i);
+}
+
+TARGET_AVX2 static void SwapRedBlue32AVX2(uint32_t* dst, const uint32_t* src, size_t count)
+{
+	const __m256i mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src + i)), mask));
+	SwapRedBlue32Scalar(dst + i, src + i, count - i);
+}
+
+TARGET_AVX2 static void CopyColorKey32AVX2(uint32_t* dst, const uint32_t* src, uint32_t key, size_t count)
+{
+	__m256i mask = _mm256_set1_epi32(0x00FFFFFF);
+	__m256i k = _mm256_set1_epi32((int)(key & 0x00FFFFFFu));
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+		__m256i keep = _mm256_cmpeq_epi32(_mm256_and_si256(s, mask), k);
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(s, d, keep));
+	}
+	CopyColorKey32SSE2(dst + i, src + i, key, count - i);
+}
+
+TARGET_AVX2 static void BlendConstant32AVX2(uint32_t* dst, uint32_t color, unsigned int alpha, size_t count)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i c = _mm256_set1_epi32((int)color);
+	__m256i c_lo = _mm256_unpacklo_epi8(c, zero);
+	__m256i c_hi = _mm256_unpackhi_epi8(c, zero);
+	__m256i a = _mm256_set1_epi16((short)alpha);
+	__m256i inv_a = _mm256_set1_epi16((short)(255 - alpha));
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+		__m256i lo = Lerp16AVX2(_mm256_unpacklo_epi8(d, zero), c_lo, a, inv_a);
+		__m256i hi = Lerp16AVX2(_mm256_unpackhi_epi8(d, zero), c_hi, a, inv_a);
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+	BlendConstant32SSE2(dst + i, color, alpha, count - i);
+}
+
+TARGET_AVX2 static void BlendPixels32AVX2(uint32_t* dst, const uint32_t* src, size_t count)
+{
+	const __m256i alpha_mask = _mm256_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1,
+		3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+	__m256i zero = _mm256_setzero_si256();
+	__m256i opaque = _mm256_set1_epi32((int)0xFF000000u);
+	__m256i all = _mm256_set1_epi16(255);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+
+		// Each 128-bit lane holds 4 pixels: 0,1 go to the low half and 2,3 to the high half
+		__m256i a_lo = _mm256_shuffle_epi8(s, alpha_mask);
+		__m256i a_hi = _mm256_shuffle_epi8(_mm256_srli_si256(s, 8), alpha_mask);
+
+		s = _mm256_or_si256(s, opaque);
+		__m256i lo = Lerp16AVX2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero), a_lo, _mm256_sub_epi16(all, a_lo));
+		__m256i hi = Lerp16AVX2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero), a_hi, _mm256_sub_epi16(all, a_hi));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+	BlendPixels32SSE2(dst + i, src + i, count - i);
+}
+
+#endif
+
+//**************************************
+// Dispatch
+
+void PixelKernels::Fill32(uint32_t* dst, uint32_t value, size_t count)
+{
+#ifdef KERNELS_X86
+	Level level = GetLevel();
+	if (level >= AVX2) return Fill32AVX2(dst, value, count);
+	if (level >= SSE2) return Fill32SSE2(dst, value, count);
+#endif
+	Fill32Scalar(dst, value, count);
+}
+
+void PixelKernels::Fill24(unsigned char* dst, const unsigned char* rgb, size_t count)
+{
+#ifdef KERNELS_X86
+	Level level = GetLevel();
+	if (level >= AVX2) return Fill24AVX2(dst, rgb, count);
+	if (level >= SSE2) return Fill24SSE2(dst, rgb, count);
+#endif
+	Fill24Scalar(dst, rgb, count);
+}
+
+void PixelKernels::Fill8(unsigned char* dst, unsigned char value, size_t count)
+{
+	memset(dst, value, count);
+}
+
+void PixelKernels::Copy(void* dst, const void* src, size_t bytes)
+{
+#ifdef KERNELS_X86
+	// Big aligned copies are written around the cache
+	if (bytes >= STREAMING_THRESHOLD && GetLevel() >= SSE2 && ((uintptr_t)dst & 15) == 0) {
+		unsigned char* d = (unsigned char*)dst;
+		const unsigned char* s = (const unsigned char*)src;
+		size_t i = 0;
+		for (; i + 64 <= bytes; i += 64) {
+			__m128i v0 = _mm_loadu_si128((const __m128i*)(s + i));
+			__m128i v1 = _mm_loadu_si128((const __m128i*)(s + i + 16));
+			__m128i v2 = _mm_loadu_si128((const __m128i*)(s + i + 32));
+			__m128i v3 = _mm_loadu_si128((const __m128i*)(s + i + 48));
+			_mm_stream_si128((__m128i*)(d + i), v0);
+			_mm_stream_si128((__m128i*)(d + i + 16), v1);
+			_mm_stream_si128((__m128i*)(d + i + 32), v2);
+			_mm_stream_si128((__m128i*)(d + i + 48), v3);
+		}
+		_mm_sfence();
+		memcpy(d + i, s + i, bytes - i);
+		return;
+	}
+#endif
+	memcpy(dst, src, bytes);
+}
+
+void PixelKernels::CopyRows(unsigned char* dst, size_t dst_stride, const unsigned char* src, size_t src_stride, size_t row_bytes, unsigned int rows)
+{
+	if (dst_stride == row_bytes && src_stride == row_bytes) {
+		Copy(dst, src, row_bytes * rows);
+		return;
+	}
+	for (unsigned int y = 0; y < rows; ++y)
+		memcpy(dst + y * dst_stride, src + y * src_stride, row_bytes);
+}
+
+void PixelKernels::Swap(void* a, void* b, size_t bytes)
+{
+#ifdef KERNELS_X86
+	if (GetLevel() >= SSE2)
+		return SwapSSE2((unsigned char*)a, (unsigned char*)b, bytes);
+#endif
+	unsigned char* pa = (unsigned char*)a;
+	unsigned char* pb = (unsigned char*)b;
+	for (size_t i = 0; i < bytes; ++i) {
+		unsigned char t = pa[i];
+		pa[i] = pb[i];
+		pb[i] = t;
+	}
+}
+
+void PixelKernels::ConvertRGBToRGBX(uint32_t* dst, const unsigned char* src, size_t count)
+{
+#ifdef KERNELS_X86
+	Level level = GetLevel();
+	if (level >= AVX2) return ConvertRGBToRGBXAVX2(dst, src, count);
+	if (level >= SSE2) return ConvertRGBToRGBXSSE2(dst, src, count);
+#endif
+	ConvertRGBToRGBXScalar(dst, src, count);
+}
+
+void PixelKernels::ConvertRGBXToRGB(unsigned char* dst, const uint32_t* src, size_t count)
+{
+#ifdef KERNELS_X86
+	Level level = GetLevel();
+	if (level >= AVX2) return ConvertRGBXToRGBAVX2(dst, src, count);
+	if (level >= SSE2) return ConvertRGBXToRGBSSE2(dst, src, count);
+#endif
+	ConvertRGBXToRGBScalar(dst, src, count);
+}
+
+void PixelKernels::ConvertRGBAToRGBX(uint32_t* dst, const uint32_t* src, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetLevel() >= SSE2)
+		return ConvertRGBAToRGBXSSE2(dst, src, count);
+#endif
+	for (size_t i = 0; i < count; ++i)
+		dst[i] = src[i] | 0xFF000000u;
+}
+
+void PixelKernels::ConvertRGBXToGray(unsigned char* dst, const uint32_t* src, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetLevel() >= SSE2)
+		return ConvertRGBXToGraySSE2(dst, src, count);
+#endif
+	ConvertRGBXToGrayScalar(dst, src, count);
+}
+
+void PixelKernels::ConvertRGBToGray(unsigned char* dst, const unsigned char* src, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetLevel() >= SSE2)
+		return ConvertRGBToGraySSE2(dst, src, count);
+#endif
+	ConvertRGBToGrayScalar(dst, src, count);
+}
+
+void PixelKernels::ConvertGrayToRGBX(uint32_t* dst, const unsigned char* src, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetLevel() >= SSE2)
+		return ConvertGrayToRGBXSSE2(dst, src, count);
+#endif
+	ConvertGrayToRGBXScalar(dst, src, count);
+}
+
+void PixelKernels::ConvertGrayToRGB(unsigned char* dst, const unsigned char* src, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetLevel() >= SSE2)
+		return ConvertGrayToRGBSSE2(dst, src, count);
+#endif
+	ConvertGrayToRGBScalar(dst, src, count);
+}
+
+void PixelKernels::SwapRedBlue24(unsigned char* dst, const unsigned char* src, size_t count)
+{
+#ifdef KERNELS_X86
+	Level level = GetLevel();
+	if (level >= AVX2) return SwapRedBlue24AVX2(dst, src, count);
+	if (level >= SSE2) return SwapRedBlue24SSE2(dst, src, count);
+#endif
+	SwapRedBlue24Scalar(dst, src, count);
+}
+
+void PixelKernels::SwapRedBlue32(uint32_t* dst, const uint32_t* src, size_t count)
+{
+#ifdef KERNELS_X86
+	Level level = GetLevel();
+	if (level >= AVX2) return SwapRedBlue32AVX2(dst, src, count);
+	if (level >= SSE2) return SwapRedBlue32SSE2(dst, src, count);
+#endif
+	SwapRedBlue32Scalar(dst, src, count);
+}
+
+void PixelKernels::CopyColorKey32(uint32_t* dst, const uint32_t* src, uint32_t key, size_t count)
+{
+#ifdef KERNELS_X86
+	Level level = GetLevel();
+	if (level >= AVX2) return CopyColorKey32AVX2(dst, src, key, count);
+	if (level >= SSE2) return CopyColorKey32SSE2(dst, src, key, count);
+#endif
+	CopyColorKey32Scalar(dst, src, key, count);
+}
+
+void PixelKernels::CopyColorKey24(unsigned char* dst, const unsigned char* src, const unsigned char* key, size_t count)
+{
+	for (size_t i = 0; i < count; ++i, dst += 3, src += 3)
+		if (src[0] != key[0] || src[1] != key[1] || src[2] != key[2]) {
+			dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2];
+		}
+}
+
+void PixelKernels::BlendConstant32(uint32_t* dst, uint32_t color, unsigned int alpha, size_t count)
+{
+#ifdef KERNELS_X86
+	Level level = GetLevel();
+	if (level >= AVX2) return BlendConstant32AVX2(dst, color, alpha, count);
+	if (level >= SSE2) return BlendConstant32SSE2(dst, color, alpha, count);
+#endif
+	for (size_t i = 0; i < count; ++i)
+		BlendBytesScalar((unsigned char*)(dst + i), (const unsigned char*)&color, alpha, 4);
+}
+
+void PixelKernels::BlendConstant24(unsigned char* dst, const unsigned char* rgb, unsigned int alpha, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetLevel() >= SSE2)
+		return BlendConstant24SSE2(dst, rgb, alpha, count);
+#endif
+	for (size_t i = 0; i < count; ++i, dst += 3)
+		BlendBytesScalar(dst, rgb, alpha, 3);
+}
+
+void PixelKernels::BlendPixels32(uint32_t* dst, const uint32_t* src, size_t count)
+{
+#ifdef KERNELS_X86
+	Level level = GetLevel();
+	if (level >= AVX2) return BlendPixels32AVX2(dst, src, count);
+	if (level >= SSE2) return BlendPixels32SSE2(dst, src, count);
+#endif
+	BlendPixels32Scalar(dst, src, count);
+}
+
+void PixelKernels::BlendPixels24(unsigned char* dst, const uint32_t* src, size_t count)
+{
+#ifdef KERNELS_X86
+	if (GetLevel() >= SSE2)
+		return BlendPixels24SSE2(dst, src, count);
+#endif
+	BlendPixels24Scalar(dst, src, count);
+}
@@ -0,0 +1,55 @@
+/*
+	+ This file defines the bulk pixel kernels used by Image: fill, copy, format conversion and blending.
+	+ Every kernel has a scalar version and SSE2/AVX2 versions for x86, the best one is picked at runtime.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+class PixelKernels
+{
+public:
+	// Instruction sets, from slowest to fastest
+	enum Level { SCALAR, SSE2, AVX2 };
+
+	// The level is detected the first time a kernel runs, it can be lowered to compare implementations
+	static Level GetLevel();
+	static void SetLevel(Level level);
+	static const char* GetLevelName(Level level);
+
+	// Fill count pixels with the same value
+	static void Fill32(uint32_t* dst, uint32_t value, size_t count);
+	static void Fill24(unsigned char* dst, const unsigned char* rgb, size_t count);
+	static void Fill8(unsigned char* dst, unsigned char value, size_t count);
+
+	// Copy bytes, big copies bypass the cache
+	static void Copy(void* dst, const void* src, size_t bytes);
+	static void CopyRows(unsigned char* dst, size_t dst_stride, const unsigned char* src, size_t src_stride, size_t row_bytes, unsigned int rows);
+	// Exchange the content of two non overlapping buffers (used to flip images)
+	static void Swap(void* a, void* b, size_t bytes);
+
+	// Format conversion of count pixels. RGBX means 4 bytes per pixel with the fourth set to 255
+	static void ConvertRGBToRGBX(uint32_t* dst, const unsigned char* src, size_t count);
+	static void ConvertRGBXToRGB(unsigned char* dst, const uint32_t* src, size_t count);
+	static void ConvertRGBAToRGBX(uint32_t* dst, const uint32_t* src, size_t count);
+	static void ConvertRGBXToGray(unsigned char* dst, const uint32_t* src, size_t count);
+	static void ConvertRGBToGray(unsigned char* dst, const unsigned char* src, size_t count);
+	static void ConvertGrayToRGBX(uint32_t* dst, const unsigned char* src, size_t count);
+	static void ConvertGrayToRGB(unsigned char* dst, const unsigned char* src, size_t count);
+	// Copy count pixels, skipping the ones whose r,g,b match the key (the fourth byte is ignored)
+	static void CopyColorKey32(uint32_t* dst, const uint32_t* src, uint32_t key, size_t count);
+	static void CopyColorKey24(unsigned char* dst, const unsigned char* src, const unsigned char* key, size_t count);
+
+	// Exchange the red and blue channels (TGA files store BGR)
+	static void SwapRedBlue24(unsigned char* dst, const unsigned char* src, size_t count);
+	static void SwapRedBlue32(uint32_t* dst, const uint32_t* src, size_t count);
+
+	// dst = dst + (color - dst) * alpha / 255 on every channel
+	static void BlendConstant32(uint32_t* dst, uint32_t color, unsigned int alpha, size_t count);
+	static void BlendConstant24(unsigned char* dst, const unsigned char* rgb, unsigned int alpha, size_t count);
+	// Non premultiplied src over dst, using the alpha stored in the fourth byte of src
+	static void BlendPixels32(uint32_t* dst, const uint32_t* src, size_t count);
+	static void BlendPixels24(unsigned char* dst, const uint32_t* src, size_t count);
+};
@@ -0,0 +1,138 @@
+#include "pixel_pool.h"
+
+#include <vector>
+#include <mutex>
+#include <stdlib.h>
+
+#ifdef WIN32
+	#include <malloc.h>
+#elif defined(__linux__)
+	#include <sys/mman.h>
+#endif
+
+// Classes grow in quarter steps of a power of two, so a buffer never wastes more than 25%
+#define MIN_CLASS_SIZE 256
+#define NUM_CLASSES (1 + 4 * 40)
+
+// Limits of what we keep around after a Free
+#define MAX_BUFFERS_PER_CLASS 8
+#define MAX_CACHED_BYTES ((size_t)512 * 1024 * 1024)
+
+static std::mutex pool_mutex;
+static std::vector<void*> free_lists[NUM_CLASSES];
+static PixelPool::Stats pool_stats;
+
+static int HighestBit(size_t v)
+{
+	int k = 0;
+	while (v >>= 1)
+		++k;
+	return k;
+}
+
+static int GetClassIndex(size_t size, size_t& class_size)
+{
+	if (size <= MIN_CLASS_SIZE) {
+		class_size = MIN_CLASS_SIZE;
+		return 0;
+	}
+
+	int k = HighestBit(size - 1);
+	size_t step = (size_t)1 << (k - 2);
+	class_size = (size + step - 1) & ~(step - 1);
+	int index = 1 + (k - 8) * 4 + (int)(class_size / step - 5);
+	return index < NUM_CLASSES ? index : -1;
+}
+
+static void* SystemAlloc(size_t size)
+{
+	size_t alignment = size >= PixelPool::HUGE_PAGE_SIZE ? PixelPool::HUGE_PAGE_SIZE : PixelPool::CACHE_LINE_SIZE;
+	void* ptr = NULL;
+#ifdef WIN32
+	ptr = _aligned_malloc(size, alignment);
+#else
+	if (posix_memalign(&ptr, alignment, size) != 0)
+		return NULL;
+	#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	if (alignment == PixelPool::HUGE_PAGE_SIZE)
+		madvise(ptr, size, MADV_HUGEPAGE);
+	#endif
+#endif
+	return ptr;
+}
+
+static void SystemFree(void* ptr)
+{
+#ifdef WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+size_t PixelPool::GetClassSize(size_t size)
+{
+	size_t class_size;
+	GetClassIndex(size, class_size);
+	return class_size;
+}
+
+void* PixelPool::Alloc(size_t size)
+{
+	size_t class_size;
+	int index = GetClassIndex(size, class_size);
+
+	{
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		pool_stats.bytes_in_use += class_size;
+		if (index >= 0 && !free_lists[index].empty()) {
+			void* ptr = free_lists[index].back();
+			free_lists[index].pop_back();
+			pool_stats.bytes_cached -= class_size;
+			pool_stats.pool_hits++;
+			return ptr;
+		}
+		pool_stats.system_allocs++;
+	}
+
+	return SystemAlloc(class_size);
+}
+
+void PixelPool::Free(void* ptr, size_t size)
+{
+	if (!ptr)
+		return;
+
+	size_t class_size;
+	int index = GetClassIndex(size, class_size);
+
+	{
+		std::lock_guard<std::mutex> lock(pool_mutex);
+		pool_stats.bytes_in_use -= class_size;
+		if (index >= 0 && free_lists[index].size() < MAX_BUFFERS_PER_CLASS &&
+			pool_stats.bytes_cached + class_size <= MAX_CACHED_BYTES) {
+			free_lists[index].push_back(ptr);
+			pool_stats.bytes_cached += class_size;
+			return;
+		}
+	}
+
+	SystemFree(ptr);
+}
+
+void PixelPool::Trim()
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	for (int i = 0; i < NUM_CLASSES; ++i) {
+		for (size_t j = 0; j < free_lists[i].size(); ++j)
+			SystemFree(free_lists[i][j]);
+		free_lists[i].clear();
+	}
+	pool_stats.bytes_cached = 0;
+}
+
+PixelPool::Stats PixelPool::GetStats()
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	return pool_stats;
+}
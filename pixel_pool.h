@@ -0,0 +1,36 @@
+/*
+	+ This file defines a pool allocator for pixel buffers.
+	+ Freed buffers are kept in size classes and handed back to the next request of a similar size,
+	  so temporaries (GetArea results, Scale buffers, flipped rows...) do not go to malloc every time.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+class PixelPool
+{
+public:
+	// Every buffer is aligned to a cache line, big buffers to a huge page
+	static const size_t CACHE_LINE_SIZE = 64;
+	static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	struct Stats {
+		size_t system_allocs = 0;	// Requests that had to go to the system allocator
+		size_t pool_hits = 0;		// Requests served with a cached buffer
+		size_t bytes_in_use = 0;	// Bytes handed out and not freed yet
+		size_t bytes_cached = 0;	// Bytes kept in the pool waiting to be reused
+	};
+
+	// Returns a buffer of at least size bytes, size must be passed again to Free
+	static void* Alloc(size_t size);
+	static void Free(void* ptr, size_t size);
+
+	// Returns all the cached buffers to the system
+	static void Trim();
+
+	static Stats GetStats();
+
+	// Size that will really be reserved for a request of size bytes
+	static size_t GetClassSize(size_t size);
+};
@@ -0,0 +1,178 @@
+#include "presenter.h"
+
+#include <iostream>
+
+// The texture is already the size of the viewport, so it is copied texel by texel
+static const char* present_vs =
+	"varying vec2 v_uv;\n"
+	"void main() {\n"
+	"	v_uv = gl_MultiTexCoord0.xy;\n"
+	"	gl_Position = vec4(gl_Vertex.xy, 0.0, 1.0);\n"
+	"}\n";
+
+static const char* present_fs =
+	"uniform sampler2D u_texture;\n"
+	"varying vec2 v_uv;\n"
+	"void main() {\n"
+	"	gl_FragColor = vec4(texture2D(u_texture, v_uv).rgb, 1.0);\n"
+	"}\n";
+
+Presenter::Presenter()
+{
+}
+
+Presenter::~Presenter()
+{
+	Release();
+}
+
+bool Presenter::Init()
+{
+	if (!shader.CompileFromMemory(present_vs, present_fs)) {
+		std::cerr << "Presenter: " << shader.GetInfoLog() << std::endl;
+		return false;
+	}
+	quad.CreateQuad();
+	glGenBuffers(2, pbos);
+	pbo_sizes[0] = pbo_sizes[1] = 0;
+	return true;
+}
+
+void Presenter::Release()
+{
+	if (pbos[0]) {
+		glDeleteBuffers(2, pbos);
+		pbos[0] = pbos[1] = 0;
+	}
+	if (texture.texture_id)
+		texture.Clear();
+	if (overlay_texture.texture_id)
+		overlay_texture.Clear();
+	shader.Release();
+	quad.Clear();
+}
+
+static GLenum GetGLFormat(const Image& image)
+{
+	if (image.format == Image::RGBA8 || image.format == Image::RGBX8) return GL_RGBA;
+	if (image.format == Image::GRAY8) return GL_LUMINANCE;
+	return GL_RGB;
+}
+
+void Presenter::Present(Image& image, Image* overlay, int overlay_x, int overlay_y)
+{
+	uploaded_bytes = 0;
+	if (!image.width || !image.height || !image.pixels)
+		return;
+
+	if (!pbos[0] && !Init()) {
+		// Without the shader the old path still works, only slower
+		image.Render();
+		image.ClearDirty();
+		return;
+	}
+
+	// A new texture, or one with a different size or format, needs the whole image
+	GLenum gl_format = GetGLFormat(image);
+	if (PrepareTexture(texture, image, gl_format))
+		image.MarkAllDirty();
+	if (image.IsDirty())
+		Upload(image, texture, gl_format);
+
+	// Row 0 of the image is the bottom of the viewport, like with glDrawPixels
+	shader.Enable();
+	shader.SetTexture("u_texture", &texture);
+	quad.Render();
+
+	if (overlay && overlay->width && overlay->height && overlay->pixels) {
+		// The overlay changes every time, it is sent whole
+		GLenum overlay_format = GetGLFormat(*overlay);
+		PrepareTexture(overlay_texture, *overlay, overlay_format);
+		overlay->MarkAllDirty();
+		Upload(*overlay, overlay_texture, overlay_format);
+
+		// The same quad, in a viewport that covers only the pixels of the overlay
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		float scale_x = (float)viewport[2] / image.width, scale_y = (float)viewport[3] / image.height;
+		glViewport(viewport[0] + (GLint)(overlay_x * scale_x), viewport[1] + (GLint)(overlay_y * scale_y),
+			(GLsizei)(overlay->width * scale_x), (GLsizei)(overlay->height * scale_y));
+		shader.SetTexture("u_texture", &overlay_texture);
+		quad.Render();
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	}
+
+	shader.Disable();
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+bool Presenter::PrepareTexture(Texture& target, const Image& image, GLenum gl_format)
+{
+	if (target.texture_id != 0 && target.width == image.width && target.height == image.height && target.format == gl_format)
+		return false;
+	target.Create(image.width, image.height, gl_format, GL_UNSIGNED_BYTE, false);
+	target.Upload(gl_format, GL_UNSIGNED_BYTE, false, NULL);
+	glBindTexture(GL_TEXTURE_2D, target.texture_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return true;
+}
+
+void Presenter::Upload(Image& image, Texture& target, GLenum gl_format)
+{
+	const Image& src = image;
+	const Image::DirtyRect* rects = src.GetDirtyRects();
+	unsigned int num_rects = src.GetNumDirtyRects();
+
+	// The rectangles are packed one after another, with rows aligned to 4 bytes as GL_UNPACK_ALIGNMENT expects
+	size_t size = 0;
+	for (unsigned int i = 0; i < num_rects; ++i)
+		size += (size_t)((rects[i].w * src.bytes_per_pixel + 3) & ~3u) * rects[i].h;
+
+	// Orphaning the storage lets the driver keep reading the previous data while it is replaced
+	GLuint pbo = pbos[current_pbo];
+	size_t& capacity = pbo_sizes[current_pbo];
+	current_pbo ^= 1;
+	capacity = std::max(capacity, size);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+	unsigned char* dst = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!dst) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return;
+	}
+
+	// GetSpan returns whole rows when LINEAR and the part inside a tile when TILED
+	for (unsigned int i = 0; i < num_rects; ++i) {
+		const Image::DirtyRect& r = rects[i];
+		size_t row_size = (r.w * src.bytes_per_pixel + 3) & ~3u;
+		for (int y = r.y; y < r.y + r.h; ++y, dst += row_size) {
+			unsigned char* d = dst;
+			for (unsigned int x = r.x, x_end = r.x + r.w; x < x_end; ) {
+				unsigned int n;
+				const unsigned char* s = src.GetSpan(x, y, n);
+				n = std::min(n, x_end - x);
+				memcpy(d, s, (size_t)n * src.bytes_per_pixel);
+				d += (size_t)n * src.bytes_per_pixel;
+				x += n;
+			}
+		}
+	}
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	// With a buffer bound the last argument is an offset inside it
+	glBindTexture(GL_TEXTURE_2D, target.texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	size_t offset = 0;
+	for (unsigned int i = 0; i < num_rects; ++i) {
+		const Image::DirtyRect& r = rects[i];
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.w, r.h, gl_format, GL_UNSIGNED_BYTE, (const void*)offset);
+		offset += (size_t)((r.w * src.bytes_per_pixel + 3) & ~3u) * r.h;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	uploaded_bytes += size;
+	image.ClearDirty();
+}
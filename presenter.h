@@ -0,0 +1,49 @@
+/*
+	+ This file defines the presenter, that shows an Image on the window through a persistent GL texture.
+	+ Only the dirty rectangles of the image are uploaded, streamed through two pixel buffer objects that
+	  are used in turns so the CPU fills one while the GPU can still be reading the other.
+	+ The texture is drawn with a fullscreen quad and a small shader.
+	+ An optional overlay, a small image such as the frame timer HUD, is drawn on top of it at a pixel position,
+	  so it never has to be written into the image itself.
+*/
+
+#pragma once
+
+#include "image.h"
+#include "texture.h"
+#include "shader.h"
+#include "mesh.h"
+
+class Presenter
+{
+public:
+	Presenter();
+	~Presenter();
+
+	// Uploads what changed in image since the last call (everything the first time or when the
+	// size or format changed), clears its dirty list and draws it over the viewport.
+	// The overlay, when given, is uploaded whole and drawn over the image with its pixel x,y at overlay_x,overlay_y.
+	void Present(Image& image, Image* overlay = NULL, int overlay_x = 0, int overlay_y = 0);
+
+	// Frees the GL objects, they are created again by the next Present
+	void Release();
+
+	// Bytes sent to the GPU by the last Present
+	size_t GetUploadedBytes() const { return uploaded_bytes; }
+
+protected:
+	Texture texture;
+	Texture overlay_texture;
+	Shader shader;
+	Mesh quad;
+
+	GLuint pbos[2] = { 0, 0 };
+	size_t pbo_sizes[2] = { 0, 0 };
+	unsigned int current_pbo = 0;
+	size_t uploaded_bytes = 0;
+
+	bool Init();
+	// Creates target again when it does not match the size and format of image, true when it did
+	bool PrepareTexture(Texture& target, const Image& image, GLenum gl_format);
+	void Upload(Image& image, Texture& target, GLenum gl_format);
+};
@@ -0,0 +1,150 @@
+#include "render_thread.h"
+#include "application.h"
+#include "shader.h"
+#include "utils.h"
+
+void RenderThread::Start(Application* app)
+{
+	this->app = app;
+	context = SDL_GL_GetCurrentContext();
+	if (frame_event == (Uint32)-1)
+		frame_event = SDL_RegisterEvents(1);
+
+	// A GL context can only be current in one thread
+	SDL_GL_MakeCurrent(app->window, NULL);
+	thread = std::thread(&RenderThread::Run, this);
+}
+
+void RenderThread::Stop()
+{
+	if (!thread.joinable())
+		return;
+
+	Command command;
+	command.type = QUIT;
+	Send(std::move(command));
+	thread.join();
+
+	SDL_GL_MakeCurrent(app->window, context);
+}
+
+void RenderThread::Send(Command&& command)
+{
+	// The frames never fill the queue, so this only waits in a burst of window events
+	while (!queue.Push(std::move(command)))
+		std::this_thread::yield();
+
+	{ std::lock_guard<std::mutex> lock(wake_mutex); }
+	wake.notify_one();
+}
+
+bool RenderThread::SubmitFrame(Image& frame, const Image* overlay, int overlay_x, int overlay_y)
+{
+	if (frames_in_flight.load(std::memory_order_acquire) >= MAX_FRAMES_IN_FLIGHT)
+		return false;
+
+	frames_in_flight.fetch_add(1, std::memory_order_acq_rel);
+	Command command;
+	command.type = PRESENT;
+	command.frame = frame; // Shares the pixels, the next write to frame detaches them
+	if (overlay) {
+		command.overlay = *overlay;
+		command.overlay_x = overlay_x;
+		command.overlay_y = overlay_y;
+	}
+	frame.ClearDirty();
+	Send(std::move(command));
+	return true;
+}
+
+void RenderThread::Resize(int width, int height)
+{
+	Command command;
+	command.type = RESIZE;
+	command.width = width;
+	command.height = height;
+	Send(std::move(command));
+}
+
+void RenderThread::ReloadShader(const char* filename)
+{
+	Command command;
+	command.type = RELOAD_SHADER;
+	command.filename = filename;
+	Send(std::move(command));
+}
+
+void RenderThread::Run()
+{
+	SDL_GL_MakeCurrent(app->window, context);
+
+	Command command;
+	Image frame, overlay;
+	int overlay_x = 0, overlay_y = 0;
+	bool quit = false;
+	while (!quit)
+	{
+		{
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			wake.wait(lock, [&] { return !queue.IsEmpty(); });
+		}
+
+		// Run everything that is waiting, keeping only the newest frame
+		unsigned int frames = 0;
+		while (queue.Pop(command))
+		{
+			switch (command.type)
+			{
+				case PRESENT:
+					// The areas of a skipped frame still have to reach the texture
+					if (frames) {
+						const Image::DirtyRect* rects = frame.GetDirtyRects();
+						for (unsigned int i = 0; i < frame.GetNumDirtyRects(); ++i)
+							command.frame.MarkDirty(rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+					}
+					frame = std::move(command.frame);
+					overlay = std::move(command.overlay);
+					overlay_x = command.overlay_x;
+					overlay_y = command.overlay_y;
+					frames++;
+					break;
+				case RESIZE:
+					glViewport(0, 0, command.width, command.height);
+					break;
+				case RELOAD_SHADER:
+					app->OnFileChanged(command.filename.c_str());
+					break;
+				case QUIT:
+					quit = true;
+					break;
+			}
+		}
+
+		if (frames) {
+			double start = FrameTimer::Now();
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			app->presenter.Present(frame, overlay.pixels ? &overlay : NULL, overlay_x, overlay_y);
+			double uploaded = FrameTimer::Now();
+			SDL_GL_SwapWindow(app->window);
+			app->frame_timer.Record(FrameTimer::UPLOAD, uploaded - start);
+			app->frame_timer.Record(FrameTimer::SWAP, FrameTimer::Now() - uploaded);
+
+			// Release the pixels so the simulation thread can write them in place again
+			frame = Image();
+			overlay = Image();
+			frames_in_flight.fetch_sub(frames, std::memory_order_acq_rel);
+			if (frame_event != (Uint32)-1) {
+				SDL_Event event;
+				SDL_zero(event);
+				event.type = frame_event;
+				SDL_PushEvent(&event);
+			}
+
+			#ifdef _DEBUG
+				checkGLErrors();
+			#endif
+		}
+	}
+
+	SDL_GL_MakeCurrent(app->window, NULL);
+}
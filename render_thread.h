@@ -0,0 +1,72 @@
+/*
+	+ This file defines the render thread, that owns the GL context and presents the frames of the application.
+	+ The simulation thread handles input, Update and the CPU drawing, then submits a copy of the framebuffer
+	  through a lock-free queue. Copies share the pixels until it writes again (copy on write),
+	  so at most MAX_FRAMES_IN_FLIGHT frames plus the one being drawn exist at any time.
+	+ A slow frame on one side never blocks the other: if the render thread falls behind it presents only the
+	  newest frame, uploading the dirty areas of the frames it skipped.
+*/
+
+#pragma once
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "main/includes.h"
+#include "image.h"
+#include "spsc_queue.h"
+
+class Application;
+
+class RenderThread
+{
+public:
+	enum CommandType { PRESENT, RESIZE, RELOAD_SHADER, QUIT };
+
+	struct Command {
+		CommandType type = PRESENT;
+		Image frame; // PRESENT
+		Image overlay; // PRESENT, empty when there is none
+		int overlay_x = 0, overlay_y = 0;
+		int width = 0, height = 0; // RESIZE
+		std::string filename; // RELOAD_SHADER
+	};
+
+	// Frames submitted and not presented yet, besides the one the simulation thread is drawing
+	static const unsigned int MAX_FRAMES_IN_FLIGHT = 2;
+
+	// Moves the GL context of the calling thread to a new thread that presents with app->presenter
+	void Start(Application* app);
+	// Presents what is left, waits for the thread and gives the GL context back to the caller.
+	// The queue has a single producer: Stop may only run once the thread that submits has stopped.
+	void Stop();
+
+	// Submits a copy of frame and clears its dirty list. When MAX_FRAMES_IN_FLIGHT are already waiting
+	// it returns false without blocking, the dirty areas stay in frame for the next try.
+	// The overlay, if any, is shown over the frame at overlay_x, overlay_y (see Presenter::Present).
+	bool SubmitFrame(Image& frame, const Image* overlay = NULL, int overlay_x = 0, int overlay_y = 0);
+	void Resize(int width, int height);
+	void ReloadShader(const char* filename);
+
+	unsigned int GetFramesInFlight() const { return frames_in_flight.load(std::memory_order_acquire); }
+	// SDL event type pushed every time presented frames leave the flight. It reaches the simulation thread
+	// through the input queue, so it sleeps until either input or room for a new frame arrives
+	Uint32 GetFrameEvent() const { return frame_event; }
+
+private:
+	Application* app = NULL;
+	SDL_GLContext context = NULL;
+	std::thread thread;
+
+	SPSCQueue<Command, 8> queue;
+	std::atomic<unsigned int> frames_in_flight{ 0 };
+	Uint32 frame_event = (Uint32)-1;
+
+	// Only to sleep while the queue is empty, the queue itself does not lock
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+
+	void Send(Command&& command);
+	void Run();
+};
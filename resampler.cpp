@@ -0,0 +1,436 @@
+#include "resampler.h"
+#include "pixel_kernels.h"
+#include "thread_pool.h"
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#define RESAMPLER_X86
+	#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+	#define M_PI 3.14159265358979323846
+#endif
+
+// Downscales by this factor or more go through the box reduction first
+#define BOX_REDUCE_FACTOR 4
+
+// Each job of the thread pool handles around this many pixels
+#define GRAIN_PIXELS (32 * 1024)
+
+#define WEIGHT_ONE (1 << Resampler::WEIGHT_BITS)
+#define WEIGHT_ROUND (1 << (Resampler::WEIGHT_BITS - 1))
+
+// Source pixels and weights used by every output pixel along one axis
+struct WeightTable
+{
+	std::vector<int> first; // First source pixel
+	std::vector<int> count; // Number of source pixels
+	std::vector<int16_t> weights; // max_taps weights per output pixel
+	int max_taps = 0;
+};
+
+static float Sinc(float x)
+{
+	if (x == 0.0f)
+		return 1.0f;
+	x *= (float)M_PI;
+	return sinf(x) / x;
+}
+
+float Resampler::GetSupport(Image::ResampleFilter filter)
+{
+	switch (filter) {
+		case Image::NEAREST: return 0.5f;
+		case Image::BILINEAR: return 1.0f;
+		case Image::BICUBIC: return 2.0f;
+		case Image::LANCZOS3: return 3.0f;
+	}
+	return 1.0f;
+}
+
+float Resampler::Evaluate(Image::ResampleFilter filter, float x)
+{
+	x = fabsf(x);
+	switch (filter) {
+		case Image::NEAREST:
+			return x < 0.5f ? 1.0f : 0.0f;
+		case Image::BILINEAR:
+			return x < 1.0f ? 1.0f - x : 0.0f;
+		case Image::BICUBIC: {
+			// Keys cubic with a = -0.5 (Catmull-Rom), sharp and without ringing on flat areas
+			const float a = -0.5f;
+			if (x < 1.0f)
+				return ((a + 2.0f) * x - (a + 3.0f)) * x * x + 1.0f;
+			if (x < 2.0f)
+				return ((a * x - 5.0f * a) * x + 8.0f * a) * x - 4.0f * a;
+			return 0.0f;
+		}
+		case Image::LANCZOS3:
+			return x < 3.0f ? Sinc(x) * Sinc(x / 3.0f) : 0.0f;
+	}
+	return 0.0f;
+}
+
+// scale is the size of an output pixel in input pixels, when downscaling the filter is stretched by it
+static void BuildWeights(WeightTable& table, unsigned int in_size, unsigned int out_size, float scale, Image::ResampleFilter filter)
+{
+	float filter_scale = std::max(scale, 1.0f);
+	float support = Resampler::GetSupport(filter) * filter_scale;
+
+	table.max_taps = (int)ceilf(support) * 2 + 1;
+	table.first.resize(out_size);
+	table.count.resize(out_size);
+	table.weights.assign((size_t)out_size * table.max_taps, 0);
+	std::vector<float> w(table.max_taps);
+
+	for (unsigned int i = 0; i < out_size; ++i) {
+		float center = (i + 0.5f) * scale;
+		int x0 = std::max((int)floorf(center - support + 0.5f), 0);
+		int x1 = std::min((int)floorf(center + support + 0.5f), (int)in_size);
+		int n = std::min(x1 - x0, table.max_taps);
+
+		float total = 0.0f;
+		for (int k = 0; k < n; ++k) {
+			w[k] = Resampler::Evaluate(filter, (x0 + k + 0.5f - center) / filter_scale);
+			total += w[k];
+		}
+		if (n <= 0 || total == 0.0f) {
+			// Nothing under the filter (only possible at the borders), take the closest pixel
+			x0 = std::min((int)center, (int)in_size - 1);
+			n = 1;
+			w[0] = total = 1.0f;
+		}
+
+		// Fixed point, the rounding error goes to the biggest weight so they always add up to one
+		int16_t* dst = &table.weights[(size_t)i * table.max_taps];
+		int sum = 0, biggest = 0;
+		for (int k = 0; k < n; ++k) {
+			dst[k] = (int16_t)lrintf(w[k] / total * WEIGHT_ONE);
+			sum += dst[k];
+			if (dst[k] > dst[biggest])
+				biggest = k;
+		}
+		dst[biggest] += (int16_t)(WEIGHT_ONE - sum);
+
+		// Zero weights at the ends only cost time
+		while (n > 1 && dst[n - 1] == 0)
+			--n;
+		while (n > 1 && dst[0] == 0) {
+			memmove(dst, dst + 1, (n - 1) * sizeof(int16_t));
+			dst[--n] = 0;
+			++x0;
+		}
+
+		table.first[i] = x0;
+		table.count[i] = n;
+	}
+}
+
+static void ParallelRows(unsigned int rows, unsigned int row_pixels, const std::function<void(unsigned int, unsigned int)>& f)
+{
+	ThreadPool::Get().ParallelFor(rows, std::max(1u, GRAIN_PIXELS / std::max(row_pixels, 1u)), f);
+}
+
+// Returns the row as RGBX, converting it in scratch when the image uses another format
+static const uint32_t* ReadRow(const ImageView& image, unsigned int y, uint32_t* scratch)
+{
+	const unsigned char* row = image.GetRow(y);
+	switch (image.format) {
+		case Image::RGB8: PixelKernels::ConvertRGBToRGBX(scratch, row, image.width); return scratch;
+		case Image::GRAY8: PixelKernels::ConvertGrayToRGBX(scratch, row, image.width); return scratch;
+		default: return (const uint32_t*)row;
+	}
+}
+
+static void WriteRow(const ImageView& image, unsigned int y, const uint32_t* rgbx)
+{
+	unsigned char* row = image.GetRow(y);
+	switch (image.format) {
+		case Image::RGB8: PixelKernels::ConvertRGBXToRGB(row, rgbx, image.width); break;
+		case Image::GRAY8: PixelKernels::ConvertRGBXToGray(row, rgbx, image.width); break;
+		default: memcpy(row, rgbx, (size_t)image.width * 4); break;
+	}
+}
+
+static inline unsigned char ClampWeighted(int v)
+{
+	v >>= Resampler::WEIGHT_BITS;
+	return (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+//**************************************
+// Nearest neighbour, copies the pixels in any format
+
+static void ResampleNearest(const ImageView& src, const ImageView& dst)
+{
+	unsigned int bpp = src.bytes_per_pixel;
+	std::vector<unsigned int> offsets(dst.width);
+	for (unsigned int x = 0; x < dst.width; ++x)
+		offsets[x] = (unsigned int)(((2 * (uint64_t)x + 1) * src.width) / (2 * (uint64_t)dst.width)) * bpp;
+
+	ParallelRows(dst.height, dst.width, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int y = begin; y < end; ++y) {
+			const unsigned char* in = src.GetRow((unsigned int)(((2 * (uint64_t)y + 1) * src.height) / (2 * (uint64_t)dst.height)));
+			unsigned char* out = dst.GetRow(y);
+			if (bpp == 4) {
+				for (unsigned int x = 0; x < dst.width; ++x)
+					((uint32_t*)out)[x] = *(const uint32_t*)(in + offsets[x]);
+			}
+			else if (bpp == 3) {
+				for (unsigned int x = 0; x < dst.width; ++x, out += 3) {
+					const unsigned char* p = in + offsets[x];
+					out[0] = p[0]; out[1] = p[1]; out[2] = p[2];
+				}
+			}
+			else {
+				for (unsigned int x = 0; x < dst.width; ++x)
+					out[x] = in[offsets[x]];
+			}
+		}
+	});
+}
+
+//**************************************
+// Box reduction, averages blocks of kx by ky pixels into an RGBX image.
+// The blocks on the right and bottom borders can be smaller.
+
+// out[i] = sums[i] / area, rounded. Both versions round the same float product so they give the same bytes.
+static void DivideSums(unsigned char* out, const uint32_t* sums, unsigned int area, unsigned int count, bool use_sse2)
+{
+	float scale = 1.0f / area;
+	unsigned int i = 0;
+#ifdef RESAMPLER_X86
+	if (use_sse2) {
+		const __m128 s = _mm_set1_ps(scale);
+		for (; i + 16 <= count; i += 16) {
+			__m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(sums + i))), s));
+			__m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(sums + i + 4))), s));
+			__m128i c = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(sums + i + 8))), s));
+			__m128i d = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(sums + i + 12))), s));
+			_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+		}
+	}
+#endif
+	for (; i < count; ++i)
+		out[i] = (unsigned char)std::min(lrintf((float)(int)sums[i] * scale), 255L);
+}
+
+static void BoxReduce(const ImageView& src, const ImageView& dst, unsigned int kx, unsigned int ky, bool use_sse2)
+{
+	ParallelRows(dst.height, src.width * ky, [&](unsigned int begin, unsigned int end) {
+		std::vector<uint32_t> scratch(src.width);
+		std::vector<uint32_t> sums((size_t)src.width * 4);
+		for (unsigned int y = begin; y < end; ++y) {
+			unsigned int y0 = y * ky;
+			unsigned int y1 = std::min(y0 + ky, src.height);
+
+			// Add the rows of the block channel by channel, the compiler vectorizes this loop
+			std::fill(sums.begin(), sums.end(), 0);
+			for (unsigned int sy = y0; sy < y1; ++sy) {
+				const unsigned char* row = (const unsigned char*)ReadRow(src, sy, scratch.data());
+				for (size_t i = 0; i < sums.size(); ++i)
+					sums[i] += row[i];
+			}
+
+			// Add the columns of every block in place, then divide by the block area.
+			// Only the last block of the row can be narrower.
+			unsigned int full_blocks = src.width / kx;
+			uint32_t* block = sums.data();
+			if (kx > 1) {
+				for (unsigned int x = 0; x < dst.width; ++x) {
+					const uint32_t* s = sums.data() + (size_t)x * kx * 4;
+					unsigned int n = std::min(kx, src.width - x * kx);
+					uint32_t c0 = s[0], c1 = s[1], c2 = s[2], c3 = s[3];
+					for (unsigned int k = 1; k < n; ++k) {
+						c0 += s[k * 4]; c1 += s[k * 4 + 1]; c2 += s[k * 4 + 2]; c3 += s[k * 4 + 3];
+					}
+					block[x * 4] = c0; block[x * 4 + 1] = c1; block[x * 4 + 2] = c2; block[x * 4 + 3] = c3;
+				}
+			}
+
+			unsigned char* out = dst.GetRow(y);
+			DivideSums(out, block, kx * (y1 - y0), full_blocks * 4, use_sse2);
+			if (full_blocks < dst.width)
+				DivideSums(out + full_blocks * 4, block + full_blocks * 4, (src.width - full_blocks * kx) * (y1 - y0), (dst.width - full_blocks) * 4, use_sse2);
+		}
+	});
+}
+
+//**************************************
+// Convolution passes, everything is RGBX here
+
+static void HorizontalRowScalar(uint32_t* dst, const uint32_t* src, const WeightTable& table, unsigned int count)
+{
+	for (unsigned int x = 0; x < count; ++x) {
+		const unsigned char* p = (const unsigned char*)(src + table.first[x]);
+		const int16_t* w = &table.weights[(size_t)x * table.max_taps];
+		int sum[4] = { WEIGHT_ROUND, WEIGHT_ROUND, WEIGHT_ROUND, WEIGHT_ROUND };
+		for (int k = 0; k < table.count[x]; ++k, p += 4)
+			for (int i = 0; i < 4; ++i)
+				sum[i] += p[i] * w[k];
+		unsigned char* out = (unsigned char*)(dst + x);
+		for (int i = 0; i < 4; ++i)
+			out[i] = ClampWeighted(sum[i]);
+	}
+}
+
+static void VerticalRowScalar(uint32_t* dst, const uint32_t* const* rows, const int16_t* w, int n, unsigned int begin, unsigned int end)
+{
+	for (unsigned int x = begin; x < end; ++x) {
+		int sum[4] = { WEIGHT_ROUND, WEIGHT_ROUND, WEIGHT_ROUND, WEIGHT_ROUND };
+		for (int k = 0; k < n; ++k) {
+			const unsigned char* p = (const unsigned char*)(rows[k] + x);
+			for (int i = 0; i < 4; ++i)
+				sum[i] += p[i] * w[k];
+		}
+		unsigned char* out = (unsigned char*)(dst + x);
+		for (int i = 0; i < 4; ++i)
+			out[i] = ClampWeighted(sum[i]);
+	}
+}
+
+#ifdef RESAMPLER_X86
+
+// Two weights in the low and high half of every 32 bits, as _mm_madd_epi16 expects them
+static inline __m128i WeightPair(int16_t w0, int16_t w1)
+{
+	return _mm_set1_epi32((int)((uint32_t)(uint16_t)w0 | ((uint32_t)(uint16_t)w1 << 16)));
+}
+
+static void HorizontalRowSSE2(uint32_t* dst, const uint32_t* src, const WeightTable& table, unsigned int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(WEIGHT_ROUND);
+	for (unsigned int x = 0; x < count; ++x) {
+		const uint32_t* p = src + table.first[x];
+		const int16_t* w = &table.weights[(size_t)x * table.max_taps];
+		int n = table.count[x];
+		__m128i sum = round;
+		int k = 0;
+		for (; k + 1 < n; k += 2) {
+			// r0 r1 g0 g1 b0 b1 a0 a1 in 16 bits, so each madd adds the two taps of a channel
+			__m128i px = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)p[k]), _mm_cvtsi32_si128((int)p[k + 1]));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), WeightPair(w[k], w[k + 1])));
+		}
+		if (k < n) {
+			__m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)p[k]), zero), zero);
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(px, WeightPair(w[k], 0)));
+		}
+		sum = _mm_srai_epi32(sum, Resampler::WEIGHT_BITS);
+		sum = _mm_packs_epi32(sum, sum);
+		dst[x] = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+	}
+}
+
+static void VerticalRowSSE2(uint32_t* dst, const uint32_t* const* rows, const int16_t* w, int n, unsigned int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(WEIGHT_ROUND);
+	unsigned int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i s0 = round, s1 = round, s2 = round, s3 = round;
+		for (int k = 0; k < n; k += 2) {
+			// Interleave two rows so each madd adds the two taps of a channel, 4 pixels at a time
+			bool pair = k + 1 < n;
+			__m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+			__m128i b = pair ? _mm_loadu_si128((const __m128i*)(rows[k + 1] + x)) : zero;
+			__m128i ww = WeightPair(w[k], pair ? w[k + 1] : 0);
+			__m128i lo = _mm_unpacklo_epi8(a, b);
+			__m128i hi = _mm_unpackhi_epi8(a, b);
+			s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), ww));
+			s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), ww));
+			s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), ww));
+			s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), ww));
+		}
+		s0 = _mm_srai_epi32(s0, Resampler::WEIGHT_BITS);
+		s1 = _mm_srai_epi32(s1, Resampler::WEIGHT_BITS);
+		s2 = _mm_srai_epi32(s2, Resampler::WEIGHT_BITS);
+		s3 = _mm_srai_epi32(s3, Resampler::WEIGHT_BITS);
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(_mm_packs_epi32(s0, s1), _mm_packs_epi32(s2, s3)));
+	}
+	VerticalRowScalar(dst, rows, w, n, x, width);
+}
+
+#endif
+
+void Resampler::Resample(const ImageView& src, const ImageView& dst, Image::ResampleFilter filter)
+{
+	assert(src.format == dst.format);
+	if (!src.width || !src.height || !dst.width || !dst.height)
+		return;
+
+	if (filter == Image::NEAREST) {
+		ResampleNearest(src, dst);
+		return;
+	}
+
+	bool use_sse2 = false;
+#ifdef RESAMPLER_X86
+	use_sse2 = PixelKernels::GetLevel() >= PixelKernels::SSE2;
+#endif
+
+	// Big downscales are averaged by an integer factor first, leaving at least twice the final size to the filter
+	unsigned int kx = src.width >= dst.width * BOX_REDUCE_FACTOR ? src.width / (dst.width * 2) : 1;
+	unsigned int ky = src.height >= dst.height * BOX_REDUCE_FACTOR ? src.height / (dst.height * 2) : 1;
+	Image reduced;
+	ImageView input = src;
+	if (kx > 1 || ky > 1) {
+		reduced = Image((src.width + kx - 1) / kx, (src.height + ky - 1) / ky, Image::RGBX8);
+		input = reduced.GetView();
+		BoxReduce(src, input, kx, ky, use_sse2);
+	}
+
+	// The scale comes from the original size, a partial block on the border does not shift the image
+	WeightTable table_x, table_y;
+	BuildWeights(table_x, input.width, dst.width, src.width / (float)(kx * dst.width), filter);
+	BuildWeights(table_y, input.height, dst.height, src.height / (float)(ky * dst.height), filter);
+
+	// Horizontal pass, only over the rows that the vertical pass reads
+	int y_begin = input.height, y_end = 0;
+	for (unsigned int y = 0; y < dst.height; ++y) {
+		y_begin = std::min(y_begin, table_y.first[y]);
+		y_end = std::max(y_end, table_y.first[y] + table_y.count[y]);
+	}
+	Image temp_image(dst.width, y_end - y_begin, Image::RGBX8);
+	ImageView temp = temp_image.GetView();
+	ParallelRows(temp.height, std::max(input.width, dst.width), [&](unsigned int begin, unsigned int end) {
+		std::vector<uint32_t> scratch(input.width);
+		for (unsigned int y = begin; y < end; ++y) {
+			const uint32_t* in = ReadRow(input, y + y_begin, scratch.data());
+			uint32_t* out = (uint32_t*)temp.GetRow(y);
+#ifdef RESAMPLER_X86
+			if (use_sse2) {
+				HorizontalRowSSE2(out, in, table_x, dst.width);
+				continue;
+			}
+#endif
+			HorizontalRowScalar(out, in, table_x, dst.width);
+		}
+	});
+
+	// Vertical pass, straight into dst when it is already RGBX or RGBA
+	bool convert = dst.format == Image::RGB8 || dst.format == Image::GRAY8;
+	ParallelRows(dst.height, dst.width, [&](unsigned int begin, unsigned int end) {
+		std::vector<uint32_t> scratch(convert ? dst.width : 0);
+		std::vector<const uint32_t*> rows(table_y.max_taps);
+		for (unsigned int y = begin; y < end; ++y) {
+			int n = table_y.count[y];
+			for (int k = 0; k < n; ++k)
+				rows[k] = (const uint32_t*)temp.GetRow(table_y.first[y] - y_begin + k);
+			const int16_t* w = &table_y.weights[(size_t)y * table_y.max_taps];
+			uint32_t* out = convert ? scratch.data() : (uint32_t*)dst.GetRow(y);
+#ifdef RESAMPLER_X86
+			if (use_sse2)
+				VerticalRowSSE2(out, rows.data(), w, n, dst.width);
+			else
+#endif
+				VerticalRowScalar(out, rows.data(), w, n, 0, dst.width);
+			if (convert)
+				WriteRow(dst, y, out);
+		}
+	});
+}
@@ -0,0 +1,24 @@
+/*
+	+ This file defines the resampling engine used by Image::Scale.
+	+ Images are filtered in two separable passes (horizontal then vertical) using weight tables computed once per axis.
+	+ Big downscales are first reduced with a box filter by an integer factor, so the final filter only reads a few taps.
+*/
+
+#pragma once
+
+#include "image.h"
+
+class Resampler
+{
+public:
+	// Resample the pixels of src to the size of dst. Both views must use the same format.
+	static void Resample(const ImageView& src, const ImageView& dst, Image::ResampleFilter filter);
+
+	// Radius of the filter in pixels when upscaling (downscales stretch it by the scale factor)
+	static float GetSupport(Image::ResampleFilter filter);
+	// Weight of the filter at distance x from the sample center
+	static float Evaluate(Image::ResampleFilter filter, float x);
+
+	// Weights are fixed point with this many bits, so 1.0 is (1 << WEIGHT_BITS)
+	static const int WEIGHT_BITS = 14;
+};
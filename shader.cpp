@@ -8,6 +8,7 @@ Shader* Shader::current = NULL;
 Shader::Shader()
 {
 	compiled = false;
+	vs = fs = program = 0;
 }
 
 Shader::~Shader()
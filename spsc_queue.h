@@ -0,0 +1,49 @@
+/*
+	+ This file defines a lock-free queue for exactly one producer thread and one consumer thread.
+	+ It is a ring of CAPACITY slots with two counters: only the producer moves tail and only the consumer
+	  moves head, so a push or a pop is a couple of atomic loads and one store.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+template <typename T, unsigned int CAPACITY>
+class SPSCQueue
+{
+	static_assert(CAPACITY && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+public:
+	// Producer only. Returns false when the queue is full (item is left untouched)
+	bool Push(T&& item)
+	{
+		unsigned int t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == CAPACITY)
+			return false;
+		items[t & (CAPACITY - 1)] = std::move(item);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only. Returns false when the queue is empty
+	bool Pop(T& item)
+	{
+		unsigned int h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		item = std::move(items[h & (CAPACITY - 1)]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Approximate when called while the other thread works, exact from either side when it is idle
+	unsigned int GetSize() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+	bool IsEmpty() const { return GetSize() == 0; }
+
+private:
+	T items[CAPACITY];
+	// On different cache lines so the two threads do not fight for the same one
+	alignas(64) std::atomic<unsigned int> head{ 0 };
+	alignas(64) std::atomic<unsigned int> tail{ 0 };
+};
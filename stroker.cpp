@@ -0,0 +1,171 @@
+#include "stroker.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+void Stroker::Begin(float line_width, Join join, Cap cap, float miter_limit)
+{
+	half_width = std::max(line_width, 1.0f) * 0.5f;
+	this->join = join;
+	this->cap = cap;
+	this->miter_limit = miter_limit;
+	edges.clear();
+}
+
+void Stroker::AddPolygon(const Vector2* points, unsigned int count)
+{
+	if (count < 3)
+		return;
+
+	// Every piece goes counter-clockwise, so overlapping pieces add up instead of cancelling
+	float area = 0.0f;
+	for (unsigned int i = 0; i < count; ++i) {
+		const Vector2& a = points[i];
+		const Vector2& b = points[(i + 1) % count];
+		area += a.x * b.y - b.x * a.y;
+	}
+	int sign = area < 0.0f ? -1 : 1;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const Vector2& a = points[i];
+		const Vector2& b = points[(i + 1) % count];
+		if (a.y == b.y)
+			continue;
+		Edge e;
+		if (a.y < b.y) {
+			e.x0 = a.x; e.y0 = a.y; e.x1 = b.x; e.y1 = b.y;
+			e.winding = sign;
+		}
+		else {
+			e.x0 = b.x; e.y0 = b.y; e.x1 = a.x; e.y1 = a.y;
+			e.winding = -sign;
+		}
+		edges.push_back(e);
+	}
+}
+
+void Stroker::AddQuad(const Vector2& a, const Vector2& b, const Vector2& c, const Vector2& d)
+{
+	Vector2 quad[4] = { a, b, c, d };
+	AddPolygon(quad, 4);
+}
+
+void Stroker::GetCirclePoints(float x, float y, float r, std::vector<Vector2>& points, float max_error)
+{
+	// The distance from a chord to the circle is r (1 - cos(step / 2))
+	unsigned int count = 8;
+	if (r > max_error)
+		count = std::max(count, (unsigned int)std::ceil(M_PI / std::acos(1.0f - max_error / r)));
+	points.resize(count);
+	for (unsigned int i = 0; i < count; ++i) {
+		float angle = 2.0f * (float)M_PI * i / count;
+		points[i].set(x + r * std::cos(angle), y + r * std::sin(angle));
+	}
+}
+
+void Stroker::AddDot(const Vector2& p)
+{
+	GetCirclePoints(p.x, p.y, half_width, scratch);
+	AddPolygon(scratch.data(), (unsigned int)scratch.size());
+}
+
+// Fills the gap on the outer side of the vertex p between the segments with normals n0 and n1
+void Stroker::AddJoin(const Vector2& p, const Vector2& n0, const Vector2& n1, float turn)
+{
+	// The outer side is to the right of a left turn
+	float side = turn > 0.0f ? -half_width : half_width;
+	Vector2 a = p + n0 * side;
+	Vector2 b = p + n1 * side;
+
+	if (join == JOIN_ROUND) {
+		AddDot(p);
+		return;
+	}
+	if (join == JOIN_MITER) {
+		// The tip is along the bisector of the normals, at half_width / cos(angle / 2) from p.
+		// Its distance to the inner corner over the width is the ratio checked against the limit.
+		Vector2 m = n0 + n1;
+		float m2 = m.x * m.x + m.y * m.y;
+		if (m2 > 1e-6f && 2.0f / std::sqrt(m2) <= miter_limit) {
+			AddQuad(p, a, p + m * (2.0f * side / m2), b);
+			return;
+		}
+	}
+	Vector2 bevel[3] = { p, a, b };
+	AddPolygon(bevel, 3);
+}
+
+void Stroker::Stroke(const Vector2* points, unsigned int count, bool closed)
+{
+	// Consecutive repeated points have no direction, they are skipped
+	path.clear();
+	for (unsigned int i = 0; i < count; ++i)
+		if (path.empty() || points[i].x != path.back().x || points[i].y != path.back().y)
+			path.push_back(points[i]);
+	if (closed && path.size() > 1 && path.front().x == path.back().x && path.front().y == path.back().y)
+		path.pop_back();
+
+	unsigned int n = (unsigned int)path.size();
+	if (n == 0)
+		return;
+	if (n == 1) {
+		if (cap == CAP_ROUND)
+			AddDot(path[0]);
+		else if (cap == CAP_SQUARE) {
+			Vector2 dx(half_width, 0.0f), dy(0.0f, half_width);
+			AddQuad(path[0] - dx - dy, path[0] + dx - dy, path[0] + dx + dy, path[0] - dx + dy);
+		}
+		return;
+	}
+	if (n == 2)
+		closed = false;
+
+	unsigned int segments = closed ? n : n - 1;
+	Vector2 first_normal, previous_normal, previous_direction;
+	for (unsigned int i = 0; i < segments; ++i) {
+		Vector2 a = path[i];
+		Vector2 b = path[(i + 1) % n];
+		Vector2 d = (b - a) / (b - a).length();
+		Vector2 normal(-d.y, d.x);
+
+		// Square caps extend the open ends by half the width
+		if (!closed && cap == CAP_SQUARE) {
+			if (i == 0)
+				a -= d * half_width;
+			if (i == segments - 1)
+				b += d * half_width;
+		}
+
+		Vector2 offset = normal * half_width;
+		AddQuad(a + offset, b + offset, b - offset, a - offset);
+
+		if (i > 0)
+			AddJoin(path[i], previous_normal, normal, previous_direction.x * d.y - previous_direction.y * d.x);
+		else
+			first_normal = normal;
+		previous_normal = normal;
+		previous_direction = d;
+	}
+
+	if (closed) {
+		Vector2 d0(first_normal.y, -first_normal.x);
+		AddJoin(path[0], previous_normal, first_normal, previous_direction.x * d0.y - previous_direction.y * d0.x);
+	}
+	else if (cap == CAP_ROUND) {
+		AddDot(path[0]);
+		AddDot(path[n - 1]);
+	}
+}
+
+void Stroker::GetBounds(float& min_x, float& min_y, float& max_x, float& max_y) const
+{
+	min_x = min_y = 1e30f;
+	max_x = max_y = -1e30f;
+	for (const Edge& e : edges) {
+		min_x = std::min(min_x, std::min(e.x0, e.x1));
+		max_x = std::max(max_x, std::max(e.x0, e.x1));
+		min_y = std::min(min_y, e.y0);
+		max_y = std::max(max_y, e.y1);
+	}
+}
@@ -0,0 +1,134 @@
+/*
+	+ This file defines the stroker, that turns lines, polylines and outlines of any width into filled geometry.
+	+ Every segment becomes a quad and every vertex a join (miter, bevel or round), with caps at the open ends.
+	+ All the pieces are rasterized together with the nonzero rule, so each pixel is written once whatever the width.
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "framework.h"
+
+class Stroker
+{
+public:
+	enum Join { JOIN_MITER, JOIN_BEVEL, JOIN_ROUND };
+	enum Cap { CAP_BUTT, CAP_SQUARE, CAP_ROUND };
+
+	// Edge of a polygon going down in y (y0 < y1), winding is +1 or -1
+	struct Edge {
+		float x0, y0, x1, y1;
+		int winding;
+	};
+
+	// Clears the geometry and sets how the next strokes are built.
+	// Miters longer than miter_limit times the width fall back to bevels, as in SVG.
+	void Begin(float line_width, Join join = JOIN_MITER, Cap cap = CAP_BUTT, float miter_limit = 4.0f);
+
+	// Adds the stroke of the path through count points, closed back to the first one if closed is set
+	void Stroke(const Vector2* points, unsigned int count, bool closed);
+	// Adds a filled polygon, in any orientation
+	void AddPolygon(const Vector2* points, unsigned int count);
+	// Points of a circle with at most max_error pixels between the polygon and the curve
+	static void GetCirclePoints(float x, float y, float r, std::vector<Vector2>& points, float max_error = 0.1f);
+
+	const std::vector<Edge>& GetEdges() const { return edges; }
+	bool IsEmpty() const { return edges.empty(); }
+	// Bounding box of the geometry
+	void GetBounds(float& min_x, float& min_y, float& max_x, float& max_y) const;
+
+	// Calls span(int x, int y, int count) for the runs of pixels whose center is inside the geometry,
+	// clipped to [min_x, max_x] x [min_y, max_y]. Pixel centers are at integer coordinates.
+	template <typename F>
+	void Rasterize(int min_x, int min_y, int max_x, int max_y, F span);
+
+private:
+	struct Crossing {
+		float x;
+		int winding;
+		bool operator<(const Crossing& c) const { return x < c.x; }
+	};
+
+	float half_width = 0.5f;
+	Join join = JOIN_MITER;
+	Cap cap = CAP_BUTT;
+	float miter_limit = 4.0f;
+
+	std::vector<Edge> edges;
+	std::vector<Vector2> path; // Input of Stroke without repeated points
+	std::vector<Vector2> scratch; // Points of the round joins and caps
+	std::vector<unsigned int> order; // Edges sorted by their first row
+	std::vector<unsigned int> active;
+	std::vector<Crossing> crossings;
+
+	// ceil(v) kept in [lo, hi], clamped first so that far away coordinates and NaN never overflow the int
+	static int CeilClamped(float v, int lo, int hi)
+	{
+		if (!(v > (float)lo))
+			return lo;
+		return v < (float)hi ? (int)std::ceil(v) : hi;
+	}
+	void AddQuad(const Vector2& a, const Vector2& b, const Vector2& c, const Vector2& d);
+	void AddDot(const Vector2& p);
+	void AddJoin(const Vector2& p, const Vector2& n0, const Vector2& n1, float turn);
+};
+
+template <typename F>
+void Stroker::Rasterize(int min_x, int min_y, int max_x, int max_y, F span)
+{
+	if (edges.empty() || min_x > max_x || min_y > max_y)
+		return;
+
+	// An edge covers the rows with y0 <= y < y1
+	order.resize(edges.size());
+	for (unsigned int i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return edges[a].y0 < edges[b].y0; });
+
+	float bounds_y0 = edges[order[0]].y0, bounds_y1 = bounds_y0;
+	for (const Edge& e : edges)
+		bounds_y1 = std::max(bounds_y1, e.y1);
+	int y_begin = CeilClamped(bounds_y0, min_y, max_y + 1);
+	int y_end = CeilClamped(bounds_y1, min_y, max_y + 1) - 1;
+
+	active.clear();
+	unsigned int next = 0;
+	for (int y = y_begin; y <= y_end; ++y) {
+		float fy = (float)y;
+		while (next < order.size() && edges[order[next]].y0 <= fy)
+			active.push_back(order[next++]);
+
+		crossings.clear();
+		unsigned int kept = 0;
+		for (unsigned int i = 0; i < active.size(); ++i) {
+			const Edge& e = edges[active[i]];
+			if (e.y1 <= fy)
+				continue;
+			active[kept++] = active[i];
+			Crossing c;
+			c.x = e.x0 + (fy - e.y0) * (e.x1 - e.x0) / (e.y1 - e.y0);
+			c.winding = e.winding;
+			crossings.push_back(c);
+		}
+		active.resize(kept);
+		std::sort(crossings.begin(), crossings.end());
+
+		// The union of all the pieces: inside wherever the winding is not 0
+		int winding = 0;
+		float start = 0.0f;
+		for (const Crossing& c : crossings) {
+			int before = winding;
+			winding += c.winding;
+			if (before == 0 && winding != 0)
+				start = c.x;
+			else if (before != 0 && winding == 0) {
+				int x0 = CeilClamped(start, min_x, max_x + 1);
+				int x1 = CeilClamped(c.x, min_x, max_x + 1) - 1;
+				if (x0 <= x1)
+					span(x0, y, x1 - x0 + 1);
+			}
+		}
+	}
+}
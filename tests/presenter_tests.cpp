@@ -0,0 +1,136 @@
+/*
+	+ Check of the streaming upload of Presenter on a real GL driver, a separate program since it needs a GL context.
+	+ It runs without a window through an EGL context (Mesa llvmpipe works): build it with the framework sources
+	  and -lEGL -lGL, and run it with EGL_PLATFORM=surfaceless. The exit code is 1 if a pixel is wrong.
+	+ Every image is presented into a framebuffer of its own size and read back with glReadPixels, so each pixel
+	  on screen must be the pixel of the image.
+*/
+
+#include "framework/presenter.h"
+
+#include <EGL/egl.h>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+
+#define MAX_REPORTS 5
+
+static int failures = 0;
+
+static int Random(int lo, int hi) { return lo + rand() % (hi - lo + 1); }
+
+// Context without a window, with a framebuffer of width x height as the target
+static bool CreateContext(int width, int height)
+{
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (!eglInitialize(display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API))
+		return false;
+	EGLint attributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint num_configs = 0;
+	eglChooseConfig(display, attributes, &config, 1, &num_configs);
+	EGLContext context = eglCreateContext(display, num_configs ? config : NULL, EGL_NO_CONTEXT, NULL);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		return false;
+	glewExperimental = true;
+	glewInit(); // Can complain about GLX on an EGL context, the functions are loaded anyway
+
+	GLuint fbo, color;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenRenderbuffers(1, &color);
+	glBindRenderbuffer(GL_RENDERBUFFER, color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+	printf("%s, %s\n", glGetString(GL_VERSION), glGetString(GL_RENDERER));
+	return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+// Compares the framebuffer with image
+static void CheckScreen(const Image& image, const char* step)
+{
+	std::vector<unsigned char> screen((size_t)image.width * image.height * 4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, &screen[0]);
+	for (unsigned int y = 0; y < image.height; ++y)
+		for (unsigned int x = 0; x < image.width; ++x) {
+			const unsigned char* p = &screen[((size_t)y * image.width + x) * 4];
+			Color c = image.GetPixel(x, y);
+			if ((p[0] != c.r || p[1] != c.g || p[2] != c.b) && failures++ < MAX_REPORTS)
+				printf("%s, format %d layout %d: pixel %u,%u is %d %d %d instead of %d %d %d\n", step, (int)image.format,
+					(int)image.layout, x, y, p[0], p[1], p[2], c.r, c.g, c.b);
+		}
+}
+
+static Color RandomColor() { return Color(Random(0, 255), Random(0, 255), Random(0, 255)); }
+
+int main(int argc, char** argv)
+{
+	// Odd sizes, so the rows of the rectangles are not multiples of 4 bytes
+	const int width = 301, height = 157;
+	if (!CreateContext(width, height)) {
+		printf("No GL context\n");
+		return 2;
+	}
+	srand(1);
+
+	for (int format = Image::RGB8; format <= Image::GRAY8; ++format)
+		for (int layout = Image::LINEAR; layout <= Image::TILED; ++layout) {
+			Image image(width, height, (Image::PixelFormat)format, (Image::PixelLayout)layout);
+			for (int y = 0; y < height; ++y)
+				for (int x = 0; x < width; ++x)
+					image.SetPixel(x, y, RandomColor());
+			image.MarkAllDirty();
+
+			Presenter presenter;
+			glViewport(0, 0, width, height);
+			presenter.Present(image);
+			CheckScreen(image, "whole image");
+
+			// Enough rounds for both buffers to be used several times
+			for (int round = 0; round < 8; ++round) {
+				Image shown = image;
+
+				// A pixel written without MarkDirty is not uploaded, so the screen keeps the old one
+				int hidden_x = Random(0, width - 1), hidden_y = Random(0, height - 1);
+				image.SetPixel(hidden_x, hidden_y, RandomColor());
+
+				int rects = Random(1, 3);
+				size_t expected_bytes = 0;
+				for (int i = 0; i < rects; ++i) {
+					int x = Random(0, width - 1), y = Random(0, height - 1);
+					int w = Random(1, width - x), h = Random(1, height - y);
+					if (x <= hidden_x && hidden_x < x + w && y <= hidden_y && hidden_y < y + h)
+						continue;
+					image.FillRect(x, y, w, h, RandomColor());
+					shown.FillRect(x, y, w, h, image.GetPixel(x, y));
+				}
+				// Touching rectangles are joined, the union can reach the hidden pixel
+				for (unsigned int i = 0; i < image.GetNumDirtyRects(); ++i) {
+					const Image::DirtyRect& r = image.GetDirtyRects()[i];
+					expected_bytes += (size_t)((r.w * image.bytes_per_pixel + 3) & ~3u) * r.h;
+					if (r.x <= hidden_x && hidden_x < r.x + r.w && r.y <= hidden_y && hidden_y < r.y + r.h)
+						shown.SetPixel(hidden_x, hidden_y, image.GetPixel(hidden_x, hidden_y));
+				}
+
+				presenter.Present(image);
+				CheckScreen(shown, "dirty rectangles");
+				if (presenter.GetUploadedBytes() != expected_bytes && failures++ < MAX_REPORTS)
+					printf("format %d layout %d: %zu bytes uploaded instead of %zu\n", format, layout,
+						presenter.GetUploadedBytes(), expected_bytes);
+				if (image.IsDirty() && failures++ < MAX_REPORTS)
+					printf("format %d layout %d: the dirty list was not cleared\n", format, layout);
+
+				// Keep the hidden pixel as it is on screen, for the next round
+				image.SetPixel(hidden_x, hidden_y, shown.GetPixel(hidden_x, hidden_y));
+				image.ClearDirty();
+			}
+			presenter.Release();
+		}
+
+	GLenum error = glGetError();
+	if (error != GL_NO_ERROR && failures++ < MAX_REPORTS)
+		printf("GL error %x\n", error);
+	printf("presenter %s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+/*
+	+ Image::FillEllipse, FillDisk and FillRing against a test of every pixel.
+*/
+
+#include "tests.h"
+
+#include <climits>
+
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128 uint128;
+
+// Pixel dx,dy inside the ellipse rx,ry, the test of CheckCircles in 128 bits so any int radius fits
+static bool InsideEllipse(int64_t dx, int64_t dy, int64_t rx, int64_t ry)
+{
+	dx = dx < 0 ? -dx : dx;
+	dy = dy < 0 ? -dy : dy;
+	if (rx < 0 || ry < 0 || dx > rx || dy > ry)
+		return false;
+	uint128 a = 2 * rx + 1, b = 2 * ry + 1;
+	return (uint128)(2 * dx) * (2 * dx) * b * b <= a * a * (b * b - (uint128)(2 * dy) * (2 * dy));
+}
+
+// A center near the image or one radius away from it, so the edge of a huge shape crosses the image
+static int RandomCenter(int r)
+{
+	int64_t c = Random(-50, 150) + (int64_t)r * Random(-1, 1);
+	return c < INT_MIN || c > INT_MAX ? Random(-50, 150) : (int)c;
+}
+
+static int RandomRadius()
+{
+	switch (Random(0, 2)) {
+		case 0: return Random(0, 60);
+		case 1: return Random(20000, 1000000);
+		default: return INT_MAX - Random(0, 100);
+	}
+}
+#endif
+
+// Disks, ellipses and rings against a test of every pixel, in exact integers
+void CheckCircles()
+{
+	char what[256];
+
+	for (int i = 0; i < 3000; ++i) {
+		Image image = RandomCanvas(100);
+		int cx = Random(-50, 150), cy = Random(-50, 150), rx = Random(0, 60), ry = Random(0, 60), r0 = Random(0, 40);
+		int kind = i % 3;
+		if (kind == 0)
+			image.FillEllipse(cx, cy, rx, ry, Color(255, 255, 255));
+		else if (kind == 1)
+			image.FillDisk(cx, cy, rx, Color(255, 255, 255));
+		else
+			image.FillRing(cx, cy, r0, rx, Color(255, 255, 255));
+
+		// Inside when (dx / (rx + 1/2))^2 + (dy / (ry + 1/2))^2 <= 1, rings without what is inside the disk r0 - 1
+		int64_t ex = 2 * rx + 1, ey = 2 * (kind == 0 ? ry : rx) + 1;
+		for (unsigned int y = 0; y < image.height; ++y)
+			for (unsigned int x = 0; x < image.width; ++x) {
+				int64_t dx = 2 * ((int64_t)x - cx), dy = 2 * ((int64_t)y - cy);
+				bool inside = dx * dx * ey * ey + dy * dy * ex * ex <= ex * ex * ey * ey;
+				if (kind == 2 && r0 > 0 && dx * dx + dy * dy < (int64_t)(2 * r0 - 1) * (2 * r0 - 1))
+					inside = false;
+				if (inside != (image.GetPixel(x, y).r != 0)) {
+					snprintf(what, sizeof(what), "shape %d at %d,%d radii %d,%d inner %d: pixel %d,%d should be %s",
+						kind, cx, cy, rx, ry, r0, x, y, inside ? "set" : "clear");
+					Fail("circles", what);
+					y = image.height;
+					break;
+				}
+			}
+	}
+
+#ifdef __SIZEOF_INT128__
+	// Radii up to the int range, centers far outside
+	for (int i = 0; i < 3000; ++i) {
+		Image image = RandomCanvas(100);
+		int rx = RandomRadius(), ry = RandomRadius(), r0 = RandomRadius();
+		int cx = RandomCenter(rx), cy = RandomCenter(i % 2 ? ry : rx);
+		bool ring = i % 2 == 0;
+		if (ring)
+			image.FillRing(cx, cy, r0, rx, Color(255, 255, 255));
+		else
+			image.FillEllipse(cx, cy, rx, ry, Color(255, 255, 255));
+
+		for (unsigned int y = 0; y < image.height; ++y)
+			for (unsigned int x = 0; x < image.width; ++x) {
+				int64_t dx = (int64_t)x - cx, dy = (int64_t)y - cy;
+				bool inside = ring ? InsideEllipse(dx, dy, rx, rx) && !InsideEllipse(dx, dy, r0 - 1, r0 - 1) : InsideEllipse(dx, dy, rx, ry);
+				if (inside != (image.GetPixel(x, y).r != 0)) {
+					snprintf(what, sizeof(what), "%s at %d,%d radii %d,%d inner %d: pixel %d,%d should be %s",
+						ring ? "ring" : "ellipse", cx, cy, rx, ry, r0, x, y, inside ? "set" : "clear");
+					Fail("circles", what);
+					y = image.height;
+					break;
+				}
+			}
+	}
+#endif
+}
@@ -0,0 +1,47 @@
+/*
+	+ ImageView primitives against the same primitives of Image.
+*/
+
+#include "tests.h"
+
+// Drawing into a view of a region of a big image gives the pixels of drawing into an image of the region size,
+// and nothing outside the region changes
+void CheckImageView()
+{
+	char what[256];
+
+	for (int i = 0; i < 3000; ++i) {
+		Image::PixelFormat format = (Image::PixelFormat)Random(0, 3);
+		Image big(Random(1, 120), Random(1, 120), format), small;
+		big.Fill(Color(10, 20, 30));
+		int ax = Random(0, big.width - 1), ay = Random(0, big.height - 1);
+		ImageView view = big.GetView(ax, ay, Random(1, 100), Random(1, 100));
+		Image expected = big;
+		small = Image(view.width, view.height, format);
+		small.Fill(Color(10, 20, 30));
+
+		Color c(Random(0, 255), Random(0, 255), Random(0, 255));
+		int x0 = Random(-60, 160), y0 = Random(-60, 160), x1 = Random(-60, 160), y1 = Random(-60, 160);
+		int r0 = Random(0, 60), r1 = Random(0, 60);
+		Vector2 p0((float)x0, (float)y0), p1((float)x1, (float)y1), p2(Random(-600, 1600) / 10.0f, Random(-600, 1600) / 10.0f);
+		int kind = i % 7;
+		switch (kind) {
+			case 0: view.FillSpan(x0, y0, x1, c); small.FillSpan(x0, y0, x1, c); break;
+			case 1: view.FillRect(x0, y0, x1, y1, c); small.FillRect(x0, y0, x1, y1, c); break;
+			case 2: view.DrawLine(x0, y0, x1, y1, c); small.DrawLineDDA(x0, y0, x1, y1, c); break;
+			case 3: view.FillTriangle(p0, p1, p2, c); small.FillTriangle(p0, p1, p2, c); break;
+			case 4: view.FillEllipse(x0, y0, r0, r1, c); small.FillEllipse(x0, y0, r0, r1, c); break;
+			case 5: view.FillDisk(x0, y0, r0, c); small.FillDisk(x0, y0, r0, c); break;
+			case 6: view.FillRing(x0, y0, r0, r1, c); small.FillRing(x0, y0, r0, r1, c); break;
+		}
+
+		// The region of the expected image is the small one, the rest the untouched big one
+		ImageView region = expected.GetView(ax, ay, view.width, view.height);
+		region.CopyFrom(small.GetView());
+		if (!SamePixels(big, expected)) {
+			snprintf(what, sizeof(what), "primitive %d on a %ux%u view at %d,%d of %ux%u, format %d",
+				kind, view.width, view.height, ax, ay, big.width, big.height, (int)format);
+			Fail("image view", what);
+		}
+	}
+}
@@ -0,0 +1,63 @@
+/*
+	+ LineRasterizer, the clipped Bresenham walk, against the full walk of the segment.
+*/
+
+#include "tests.h"
+#include "framework/line_rasterizer.h"
+
+#include <set>
+
+// Clipped Bresenham walk against the full walk of the segment filtered by the clip rectangle
+void CheckLines()
+{
+	typedef std::set<std::pair<int, int>> PixelSet;
+	char what[256];
+
+	for (int i = 0; i < 100000; ++i) {
+		int range = i % 3 ? 40 : 4000;
+		int x0 = Random(-range, range), y0 = Random(-range, range), x1 = Random(-range, range), y1 = Random(-range, range);
+		if (i % 7 == 0) y1 = y0;
+		if (i % 11 == 0) x1 = x0;
+		int min_x = Random(-10, 10), min_y = Random(-10, 10);
+		int max_x = min_x + Random(-1, 25), max_y = min_y + Random(-1, 25);
+
+		// Full walk from the lower end of the major axis, minor offset rounded at the midpoint
+		PixelSet expected;
+		int64_t dx = (int64_t)x1 - x0, dy = (int64_t)y1 - y0;
+		bool x_major = llabs(dx) >= llabs(dy);
+		int ax = x0, ay = y0;
+		if ((x_major && dx < 0) || (!x_major && dy < 0)) {
+			ax = x1;
+			ay = y1;
+			dx = -dx;
+			dy = -dy;
+		}
+		int64_t major = x_major ? dx : dy, minor = x_major ? dy : dx;
+		for (int64_t t = 0; t <= major; ++t) {
+			int64_t m = major ? (2 * t * llabs(minor) + major) / (2 * major) : 0;
+			if (minor < 0)
+				m = -m;
+			int x = (int)(x_major ? ax + t : ax + m), y = (int)(x_major ? ay + m : ay + t);
+			if (x >= min_x && x <= max_x && y >= min_y && y <= max_y)
+				expected.insert(std::make_pair(x, y));
+		}
+
+		PixelSet forward, backward;
+		bool twice = false, empty_run = false;
+		LineRasterizer::Rasterize(x0, y0, x1, y1, min_x, min_y, max_x, max_y, [&](int x, int y, int count) {
+			empty_run |= count < 1;
+			for (int k = 0; k < count; ++k)
+				twice |= !forward.insert(std::make_pair(x + k, y)).second;
+		});
+		LineRasterizer::Rasterize(x1, y1, x0, y0, min_x, min_y, max_x, max_y, [&](int x, int y, int count) {
+			for (int k = 0; k < count; ++k)
+				backward.insert(std::make_pair(x + k, y));
+		});
+
+		if (forward != expected || backward != expected || twice || empty_run) {
+			snprintf(what, sizeof(what), "%d,%d - %d,%d clipped to %d,%d - %d,%d gives %d pixels instead of %d%s",
+				x0, y0, x1, y1, min_x, min_y, max_x, max_y, (int)forward.size(), (int)expected.size(), twice ? ", some twice" : "");
+			Fail("lines", what);
+		}
+	}
+}
@@ -0,0 +1,33 @@
+/*
+	+ ThreadPool::ParallelFor under many short jobs back to back.
+*/
+
+#include "tests.h"
+#include "framework/thread_pool.h"
+
+#include <vector>
+#include <atomic>
+
+// Every index of a ParallelFor runs exactly once, for any count and grain, back to back
+void CheckThreadPool()
+{
+	ThreadPool pool(4);
+	char what[256];
+
+	for (int i = 0; i < 20000; ++i) {
+		unsigned int count = i % 97, grain = 1 + i % 5;
+		std::vector<std::atomic<int>> hits(count);
+		for (std::atomic<int>& h : hits)
+			h = 0;
+		pool.ParallelFor(count, grain, [&](unsigned int begin, unsigned int end) {
+			for (unsigned int k = begin; k < end; ++k)
+				hits[k]++;
+		});
+		for (unsigned int k = 0; k < count; ++k)
+			if (hits[k] != 1) {
+				snprintf(what, sizeof(what), "index %u of %u (grain %u) ran %d times", k, count, grain, (int)hits[k]);
+				Fail("thread pool", what);
+				break;
+			}
+	}
+}
@@ -0,0 +1,41 @@
+/*
+	+ Triangle batches (TriangleBatch, Image::DrawTriangles) against the same triangles filled one by one.
+*/
+
+#include "tests.h"
+#include "framework/triangle_batch.h"
+
+#include <cmath>
+
+// Batches drawn in bins on the pool against the same triangles filled one by one
+void CheckTriangleBatch()
+{
+	TriangleBatch batch;
+	char what[256];
+
+	for (int i = 0; i < 300; ++i) {
+		Image image = RandomCanvas(300);
+		Image expected = image;
+		int range = i % 10 ? 400 : 100000;
+
+		batch.Clear();
+		int count = Random(1, 300);
+		for (int t = 0; t < count; ++t) {
+			Vector2 p0(Random(-range, range) / 4.0f + 100, Random(-range, range) / 4.0f + 100);
+			Vector2 p1 = p0 + Vector2(Random(-200, 200) / 4.0f, Random(-200, 200) / 4.0f);
+			Vector2 p2 = p0 + Vector2(Random(-200, 200) / 4.0f, Random(-200, 200) / 4.0f);
+			if (t % 50 == 49)
+				p1.x = NAN;
+			Color c(Random(0, 255), Random(0, 255), Random(0, 255));
+			batch.Add(p0, p1, p2, c);
+			expected.FillTriangle(p0, p1, p2, c);
+		}
+		image.DrawTriangles(batch);
+
+		if (!SamePixels(image, expected)) {
+			snprintf(what, sizeof(what), "%d triangles on %ux%u, format %d, layout %d differ from FillTriangle",
+				count, image.width, image.height, (int)image.format, (int)image.layout);
+			Fail("triangle batch", what);
+		}
+	}
+}
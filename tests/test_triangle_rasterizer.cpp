@@ -0,0 +1,74 @@
+/*
+	+ TriangleRasterizer on meshes of triangles that share edges and vertices.
+*/
+
+#include "tests.h"
+#include "framework/triangle_rasterizer.h"
+
+#include <vector>
+#include <cmath>
+
+// Side of c from the line a-b
+static float Cross(const Vector2& a, const Vector2& b, const Vector2& c) { return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x); }
+
+// A rectangle cut into jittered triangles must cover each pixel inside it exactly once and nothing outside
+void CheckSharedEdges()
+{
+	const int CELLS = 8;
+	char what[256];
+
+	for (int i = 0; i < 2000; ++i) {
+		int width = Random(1, 120), height = Random(1, 120);
+		std::vector<int> writes(width * height, 0);
+
+		// Corners off the pixel centers so no center is on the border, some of them off the image
+		float x0 = Random(-40, width) + 0.25f, y0 = Random(-40, height) + 0.25f;
+		float cell_w = (float)Random(6, 20), cell_h = (float)Random(6, 20);
+		float x1 = x0 + cell_w * CELLS + 0.5f, y1 = y0 + cell_h * CELLS + 0.5f;
+
+		// Inner vertices jittered by less than half a cell, so the quads stay simple, half of them on pixel centers to hit the ties
+		Vector2 grid[CELLS + 1][CELLS + 1];
+		for (int gy = 0; gy <= CELLS; ++gy)
+			for (int gx = 0; gx <= CELLS; ++gx) {
+				float x = gx == CELLS ? x1 : x0 + gx * cell_w, y = gy == CELLS ? y1 : y0 + gy * cell_h;
+				if (gx > 0 && gx < CELLS && gy > 0 && gy < CELLS) {
+					x += cell_w / 4 * (Random(-16, 16) / 16.0f);
+					y += cell_h / 4 * (Random(-16, 16) / 16.0f);
+					if (rand() % 2) {
+						x = floorf(x);
+						y = floorf(y);
+					}
+				}
+				grid[gy][gx] = Vector2(x, y);
+			}
+
+		for (int gy = 0; gy < CELLS; ++gy)
+			for (int gx = 0; gx < CELLS; ++gx) {
+				const Vector2& a = grid[gy][gx], & b = grid[gy][gx + 1], & c = grid[gy + 1][gx + 1], & d = grid[gy + 1][gx];
+				// Either diagonal that splits the quad in two, a concave quad has only one
+				bool ac = Cross(a, c, b) * Cross(a, c, d) < 0, bd = Cross(b, d, a) * Cross(b, d, c) < 0;
+				Vector2 triangles[2][3] = { { a, b, c }, { a, c, d } };
+				if (!ac || (bd && rand() % 2)) {
+					triangles[0][2] = d;
+					triangles[1][0] = b;
+				}
+				for (int t = 0; t < 2; ++t)
+					TriangleRasterizer::Rasterize(triangles[t][0], triangles[t][1], triangles[t][2], 0, 0, width - 1, height - 1, [&](int x, int y, int count) {
+						for (int k = 0; k < count; ++k)
+							writes[y * width + x + k]++;
+					});
+			}
+
+		for (int y = 0; y < height; ++y)
+			for (int x = 0; x < width; ++x) {
+				int expected = x > x0 && x < x1 && y > y0 && y < y1 ? 1 : 0;
+				if (writes[y * width + x] != expected) {
+					snprintf(what, sizeof(what), "pixel %d,%d written %d times instead of %d, rectangle %g,%g - %g,%g",
+						x, y, writes[y * width + x], expected, x0, y0, x1, y1);
+					Fail("shared edges", what);
+					y = height;
+					break;
+				}
+			}
+	}
+}
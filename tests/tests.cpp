@@ -0,0 +1,86 @@
+/*
+	+ Checks of the rasterizers and the thread pool against slow reference versions, built from the same sources as the app
+	  and the tests/test_*.cpp files.
+	+ Every check draws random shapes, prints the first mismatches it finds and the exit code is 1 if any check fails.
+	+ The upload of Presenter needs a GL context, it is checked by its own program, see presenter_tests.cpp.
+	+ Usage: tests [options]
+		--filter <text>        only the checks whose name contains text
+		--seed <n>             seed of the random shapes (default 1)
+		--level <scalar|sse2|avx2>  run the pixel kernels at a lower instruction set
+*/
+
+#include "tests.h"
+#include "framework/pixel_kernels.h"
+
+#include <string>
+
+// Mismatches printed per check, the rest are only counted
+#define MAX_REPORTS 5
+
+static int failures = 0; // Of the running check
+
+void Fail(const char* check, const char* what)
+{
+	if (failures++ < MAX_REPORTS)
+		printf("%s: %s\n", check, what);
+}
+
+bool SamePixels(const Image& a, const Image& b)
+{
+	for (unsigned int y = 0; y < a.height; ++y)
+		for (unsigned int x = 0; x < a.width; ++x) {
+			Color ca = a.GetPixel(x, y), cb = b.GetPixel(x, y);
+			if (ca.r != cb.r || ca.g != cb.g || ca.b != cb.b)
+				return false;
+		}
+	return true;
+}
+
+Image RandomCanvas(int max_size)
+{
+	Image image(Random(1, max_size), Random(1, max_size), (Image::PixelFormat)Random(0, 3), (Image::PixelLayout)Random(0, 1));
+	image.Fill(Color(0, 0, 0));
+	return image;
+}
+
+int main(int argc, char** argv)
+{
+	const char* filter = NULL;
+	unsigned int seed = 1;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--filter" && has_value) filter = argv[++i];
+		else if (arg == "--seed" && has_value) seed = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--level" && has_value) {
+			std::string level = argv[++i];
+			PixelKernels::SetLevel(level == "scalar" ? PixelKernels::SCALAR : (level == "sse2" ? PixelKernels::SSE2 : PixelKernels::AVX2));
+		}
+		else {
+			fprintf(stderr, "Unknown option %s, see the top of tests.cpp\n", argv[i]);
+			return 2;
+		}
+	}
+
+	struct { const char* name; void (*run)(); } checks[] = {
+		{ "lines", CheckLines },
+		{ "shared_edges", CheckSharedEdges },
+		{ "circles", CheckCircles },
+		{ "triangle_batch", CheckTriangleBatch },
+		{ "thread_pool", CheckThreadPool },
+		{ "image_view", CheckImageView },
+	};
+
+	int failed_checks = 0;
+	for (auto& check : checks) {
+		if (filter && std::string(check.name).find(filter) == std::string::npos)
+			continue;
+		srand(seed);
+		failures = 0;
+		check.run();
+		printf("%-16s %s\n", check.name, failures ? "FAILED" : "ok");
+		failed_checks += failures != 0;
+	}
+	return failed_checks ? 1 : 0;
+}
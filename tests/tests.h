@@ -0,0 +1,27 @@
+/*
+	+ Helpers shared by the checks of the test program, each check lives in the test file of what it checks.
+*/
+
+#pragma once
+
+#include "framework/image.h"
+
+#include <cstdlib>
+#include <cstdio>
+
+// Counts a mismatch of the running check and prints the first ones
+void Fail(const char* check, const char* what);
+
+inline int Random(int lo, int hi) { return lo + rand() % (hi - lo + 1); }
+
+bool SamePixels(const Image& a, const Image& b);
+// Image of random size, format and layout, filled with black
+Image RandomCanvas(int max_size);
+
+// The checks, in the order of the table of tests.cpp
+void CheckLines(); // test_line_rasterizer.cpp
+void CheckSharedEdges(); // test_triangle_rasterizer.cpp
+void CheckCircles(); // test_ellipses.cpp
+void CheckTriangleBatch(); // test_triangle_batch.cpp
+void CheckThreadPool(); // test_thread_pool.cpp
+void CheckImageView(); // test_image_view.cpp
@@ -0,0 +1,224 @@
+#include "texture_sampler.h"
+#include "image.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Coordinates are clamped to this many texels before going to int, far beyond the size of any texture
+#define MAX_TEXEL 16777216.0f
+
+static unsigned int NextPowerOfTwo(unsigned int n)
+{
+	unsigned int p = 1;
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+static int Log2(unsigned int power_of_two)
+{
+	int bits = 0;
+	while ((1u << bits) < power_of_two)
+		bits++;
+	return bits;
+}
+
+// The 16 low bits of v at the even bits of the result
+static uint32_t SpreadBits(uint32_t v)
+{
+	v &= 0xffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// Without std::floor, that is a call to the C library without SSE4.1
+static int FloorToInt(float v)
+{
+	if (!(v > -MAX_TEXEL))
+		v = -MAX_TEXEL;
+	else if (v > MAX_TEXEL)
+		v = MAX_TEXEL;
+	int i = (int)v;
+	return i - (v < (float)i);
+}
+
+// log2 from the exponent and the mantissa of the float, linear between powers of two. It is off by less
+// than 0.09, far below what can be seen in the choice of a level, and much cheaper than std::log2.
+static float FastLog2(float v)
+{
+	uint32_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	return (float)((int)(bits >> 23) - 127) + (float)(bits & 0x7fffff) * (1.0f / 8388608.0f);
+}
+
+// Blend of two texels with weight in [0, 256] for b, red and blue are blended together in the same integer
+static uint32_t Lerp(uint32_t a, uint32_t b, int weight)
+{
+	uint32_t rb = ((a & 0x00ff00ff) * (256 - weight) + (b & 0x00ff00ff) * weight + 0x00800080) >> 8;
+	uint32_t g = ((a & 0x0000ff00) * (256 - weight) + (b & 0x0000ff00) * weight + 0x00008000) >> 8;
+	return (rb & 0x00ff00ff) | (g & 0x0000ff00) | 0xff000000u;
+}
+
+// Texel of a level of size texels for any integer coordinate, size is a power of two
+static int WrapCoordinate(int x, int size, TextureSampler::Wrap wrap)
+{
+	switch (wrap) {
+	case TextureSampler::WRAP_REPEAT:
+		return x & (size - 1);
+	case TextureSampler::WRAP_CLAMP_TO_EDGE:
+		return std::min(std::max(x, 0), size - 1);
+	default: {
+		int t = x & (2 * size - 1);
+		return t < size ? t : 2 * size - 1 - t;
+	}
+	}
+}
+
+void TextureSampler::Create(const Image& image)
+{
+	texels.clear();
+	levels.clear();
+	morton_x.clear();
+	morton_y.clear();
+	if (!image.width || !image.height)
+		return;
+
+	// Level 0 is the image resized to powers of two
+	unsigned int width = NextPowerOfTwo(image.width), height = NextPowerOfTwo(image.height);
+	const Image* source = &image;
+	Image resized;
+	if (width != image.width || height != image.height) {
+		resized = image;
+		resized.Scale(width, height, Image::BICUBIC);
+		source = &resized;
+	}
+
+	size_t texel_count = 0, morton_count = 0;
+	for (unsigned int w = width, h = height;; w = std::max(w / 2, 1u), h = std::max(h / 2, 1u)) {
+		Level level = { w, h, texel_count, morton_count };
+		levels.push_back(level);
+		texel_count += (size_t)w * h;
+		morton_count += std::max(w, h);
+		if (w == 1 && h == 1)
+			break;
+	}
+	texels.resize(texel_count);
+	morton_x.resize(morton_count);
+	morton_y.resize(morton_count);
+
+	// The bits of the square part are interleaved, the extra ones of the longest side go on top
+	for (const Level& level : levels) {
+		int bits = Log2(std::min(level.width, level.height));
+		uint32_t mask = (1u << bits) - 1;
+		for (unsigned int x = 0; x < level.width; ++x)
+			morton_x[level.morton + x] = SpreadBits(x & mask) | ((x >> bits) << (2 * bits));
+		for (unsigned int y = 0; y < level.height; ++y)
+			morton_y[level.morton + y] = (SpreadBits(y & mask) << 1) | ((y >> bits) << (2 * bits));
+	}
+
+	const Level& base = levels[0];
+	for (unsigned int y = 0; y < base.height; ++y)
+		for (unsigned int x = 0; x < base.width; ++x) {
+			Color c = source->GetPixel(x, y);
+			texels[base.texels + (morton_x[base.morton + x] | morton_y[base.morton + y])] = c.r | (c.g << 8) | (c.b << 16) | 0xff000000u;
+		}
+
+	// Every other level is the average of 2x2 texels of the previous one, or 2x1 once a side is down to 1
+	for (size_t i = 1; i < levels.size(); ++i) {
+		const Level& parent = levels[i - 1];
+		const Level& level = levels[i];
+		int step_x = parent.width > 1 ? 1 : 0, step_y = parent.height > 1 ? 1 : 0;
+		for (unsigned int y = 0; y < level.height; ++y)
+			for (unsigned int x = 0; x < level.width; ++x) {
+				int px = x * 2, py = y * 2;
+				uint32_t t[4] = { Fetch(parent, px, py), Fetch(parent, px + step_x, py),
+					Fetch(parent, px, py + step_y), Fetch(parent, px + step_x, py + step_y) };
+				uint32_t texel = 0xff000000u;
+				for (int c = 0; c < 24; c += 8) {
+					uint32_t sum = ((t[0] >> c) & 255) + ((t[1] >> c) & 255) + ((t[2] >> c) & 255) + ((t[3] >> c) & 255);
+					texel |= ((sum + 2) >> 2) << c;
+				}
+				texels[level.texels + (morton_x[level.morton + x] | morton_y[level.morton + y])] = texel;
+			}
+	}
+}
+
+void TextureSampler::SetWrap(const Texture& texture)
+{
+	// GL_CLAMP and GL_CLAMP_TO_BORDER have no border color here, they clamp to the edge
+	const unsigned int modes[2] = { texture.wrapS, texture.wrapT };
+	Wrap* wraps[2] = { &wrap_s, &wrap_t };
+	for (int i = 0; i < 2; ++i) {
+		if (modes[i] == GL_REPEAT)
+			*wraps[i] = WRAP_REPEAT;
+		else if (modes[i] == GL_MIRRORED_REPEAT)
+			*wraps[i] = WRAP_MIRRORED_REPEAT;
+		else
+			*wraps[i] = WRAP_CLAMP_TO_EDGE;
+	}
+}
+
+float TextureSampler::GetLevelOfDetail(float du_dx, float dv_dx, float du_dy, float dv_dy) const
+{
+	if (levels.empty())
+		return 0.0f;
+	float width = (float)levels[0].width, height = (float)levels[0].height;
+	float along_x = du_dx * du_dx * width * width + dv_dx * dv_dx * height * height;
+	float along_y = du_dy * du_dy * width * width + dv_dy * dv_dy * height * height;
+	return 0.5f * FastLog2(std::max(along_x, along_y));
+}
+
+uint32_t TextureSampler::SampleNearest(const Level& level, float u, float v) const
+{
+	int x = WrapCoordinate(FloorToInt(u * level.width), level.width, wrap_s);
+	int y = WrapCoordinate(FloorToInt(v * level.height), level.height, wrap_t);
+	return Fetch(level, x, y);
+}
+
+uint32_t TextureSampler::SampleBilinear(const Level& level, float u, float v) const
+{
+	// Texel centers are at half coordinates, the weights have 8 bits
+	float x = u * level.width - 0.5f, y = v * level.height - 0.5f;
+	int x0 = FloorToInt(x), y0 = FloorToInt(y);
+	int wx = std::min(std::max((int)((x - x0) * 256.0f), 0), 256);
+	int wy = std::min(std::max((int)((y - y0) * 256.0f), 0), 256);
+	int xa = WrapCoordinate(x0, level.width, wrap_s), xb = WrapCoordinate(x0 + 1, level.width, wrap_s);
+	int ya = WrapCoordinate(y0, level.height, wrap_t), yb = WrapCoordinate(y0 + 1, level.height, wrap_t);
+	uint32_t bottom = Lerp(Fetch(level, xa, ya), Fetch(level, xb, ya), wx);
+	uint32_t top = Lerp(Fetch(level, xa, yb), Fetch(level, xb, yb), wx);
+	return Lerp(bottom, top, wy);
+}
+
+Color TextureSampler::Sample(float u, float v, float lod) const
+{
+	if (levels.empty())
+		return Color();
+
+	uint32_t texel;
+	int last = (int)levels.size() - 1;
+	if (filter == FILTER_TRILINEAR && lod > 0.0f && last > 0) {
+		lod = std::min(lod, (float)last);
+		int level = (int)lod;
+		int weight = (int)((lod - level) * 256.0f);
+		texel = SampleBilinear(levels[level], u, v);
+		if (weight > 0)
+			texel = Lerp(texel, SampleBilinear(levels[level + 1], u, v), weight);
+	}
+	else {
+		// The closest level, level 0 when the texture is magnified
+		int level = lod > 0.5f ? (int)std::min(lod + 0.5f, (float)last) : 0;
+		if (filter == FILTER_NEAREST)
+			texel = SampleNearest(levels[level], u, v);
+		else
+			texel = SampleBilinear(levels[level], u, v);
+	}
+	Color result;
+	for (int c = 0; c < 3; ++c)
+		result.v[c] = (unsigned char)(texel >> (8 * c));
+	return result;
+}
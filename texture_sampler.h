@@ -0,0 +1,66 @@
+/*
+	+ This file defines the texture sampler, the CPU version of a Texture, read by the software rasterizer.
+	+ It keeps the whole mip chain of an image, every level half the size of the previous one down to 1x1, built once with
+	  a 2x2 box filter. Images that are not a power of two are resized first, as gluBuild2DMipmaps does.
+	+ The texels of each level are stored in Morton order, interleaving the bits of x and y, so the 2x2 texels of a
+	  bilinear fetch and the texels of nearby pixels are almost always in the same cache line whatever the direction.
+	+ Wrap modes and texture coordinates follow OpenGL: u, v in [0, 1] cover the texture and v = 0 is its first row.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "framework.h"
+
+class Image;
+class Texture;
+
+class TextureSampler
+{
+public:
+	// NEAREST and BILINEAR read the level closest to the size on screen, TRILINEAR blends the two around it
+	enum Filter { FILTER_NEAREST, FILTER_BILINEAR, FILTER_TRILINEAR };
+	enum Wrap { WRAP_REPEAT, WRAP_CLAMP_TO_EDGE, WRAP_MIRRORED_REPEAT };
+
+	Filter filter = FILTER_TRILINEAR;
+	Wrap wrap_s = WRAP_REPEAT;
+	Wrap wrap_t = WRAP_REPEAT;
+
+	// Builds the mip chain of the image, the previous one is released
+	void Create(const Image& image);
+	// Takes the wrap modes of a GL texture, wrapS and wrapT
+	void SetWrap(const Texture& texture);
+
+	bool IsEmpty() const { return levels.empty(); }
+	unsigned int GetWidth() const { return levels.empty() ? 0 : levels[0].width; }
+	unsigned int GetHeight() const { return levels.empty() ? 0 : levels[0].height; }
+	unsigned int GetLevelCount() const { return (unsigned int)levels.size(); }
+
+	// Level of detail of a pixel from the change of u and v from it to the next pixel in x and in y,
+	// log2 of the texels of level 0 it covers along its longest side
+	float GetLevelOfDetail(float du_dx, float dv_dx, float du_dy, float dv_dy) const;
+	// Filtered color at u, v for a pixel with that level of detail, black when the sampler is empty
+	Color Sample(float u, float v, float lod) const;
+
+private:
+	struct Level {
+		unsigned int width, height; // Powers of two
+		size_t texels; // First texel in the array of texels
+		size_t morton; // First entry of the level in morton_x and morton_y
+	};
+
+	// Texels are 0xXXBBGGRR, so a channel is a shift away
+	std::vector<uint32_t> texels;
+	std::vector<Level> levels;
+	// Bits of x and y spread over the Morton index, the index of a texel is morton_x[x] | morton_y[y]
+	std::vector<uint32_t> morton_x, morton_y;
+
+	// Texel x, y of a level, both already wrapped inside it
+	uint32_t Fetch(const Level& level, int x, int y) const
+	{
+		return texels[level.texels + (morton_x[level.morton + x] | morton_y[level.morton + y])];
+	}
+	uint32_t SampleNearest(const Level& level, float u, float v) const;
+	uint32_t SampleBilinear(const Level& level, float u, float v) const;
+};
@@ -0,0 +1,105 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+// Set in the pool threads (and in the caller while it helps) to run nested loops serially
+static thread_local bool inside_pool = false;
+
+ThreadPool& ThreadPool::Get()
+{
+	static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+	return pool;
+}
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+{
+	job.next = 0;
+	for (unsigned int i = 0; i < num_threads; ++i)
+		workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+void ThreadPool::ParallelFor(unsigned int count, unsigned int grain, const std::function<void(unsigned int, unsigned int)>& f)
+{
+	if (count == 0)
+		return;
+	grain = std::max(grain, 1u);
+
+	if (workers.empty() || inside_pool || count <= grain) {
+		f(0, count);
+		return;
+	}
+
+	std::lock_guard<std::mutex> job_lock(job_mutex);
+	{
+		// No worker is inside the previous job, it was closed with active at 0
+		std::lock_guard<std::mutex> lock(mutex);
+		job.f = &f;
+		job.count = count;
+		job.grain = grain;
+		job.next = 0;
+		generation++;
+	}
+	wake.notify_all();
+
+	inside_pool = true;
+	RunChunks(f, count, grain);
+	inside_pool = false;
+
+	// Every chunk was taken, the ones still running belong to workers counted in active.
+	// Closing the job under the same lock keeps the late workers out of it.
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return active == 0; });
+	job.f = NULL;
+}
+
+void ThreadPool::RunChunks(const std::function<void(unsigned int, unsigned int)>& f, unsigned int count, unsigned int grain)
+{
+	while (true) {
+		unsigned int k = job.next.fetch_add(1);
+		if (k >= (count + grain - 1) / grain)
+			break;
+		unsigned int begin = k * grain;
+		f(begin, std::min(begin + grain, count));
+	}
+}
+
+void ThreadPool::WorkerLoop()
+{
+	inside_pool = true;
+	unsigned int seen = 0;
+	while (true) {
+		const std::function<void(unsigned int, unsigned int)>* f;
+		unsigned int count, grain;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return quit || generation != seen; });
+			if (quit)
+				return;
+			seen = generation;
+			// The job may be over already when this worker wakes up late
+			if (!job.f)
+				continue;
+			f = job.f;
+			count = job.count;
+			grain = job.grain;
+			active++;
+		}
+		RunChunks(*f, count, grain);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--active == 0)
+				done.notify_all();
+		}
+	}
+}
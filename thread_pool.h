@@ -0,0 +1,52 @@
+/*
+	+ This file defines a persistent pool of worker threads used to split image work in bands.
+	+ Threads are created once and sleep between jobs, so a parallel loop costs only a wake up.
+*/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+class ThreadPool
+{
+public:
+	// Shared pool with one thread per core (the caller counts as one of them)
+	static ThreadPool& Get();
+
+	ThreadPool(unsigned int num_threads);
+	~ThreadPool();
+
+	// Threads that run a ParallelFor, including the caller
+	unsigned int GetNumThreads() const { return (unsigned int)workers.size() + 1; }
+
+	// Calls f(begin, end) over [0, count) in chunks of grain items and waits for all of them.
+	// The calling thread works too. Nested calls from a worker run serially.
+	void ParallelFor(unsigned int count, unsigned int grain, const std::function<void(unsigned int, unsigned int)>& f);
+
+private:
+	// Written under mutex while no worker is inside a job, workers copy it under mutex before they take chunks
+	struct Job {
+		const std::function<void(unsigned int, unsigned int)>* f = NULL; // NULL once the job is over
+		unsigned int count = 0;
+		unsigned int grain = 1;
+		std::atomic<unsigned int> next;
+	};
+
+	void WorkerLoop();
+	void RunChunks(const std::function<void(unsigned int, unsigned int)>& f, unsigned int count, unsigned int grain);
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::mutex job_mutex; // Only one ParallelFor at a time
+	Job job;
+	unsigned int generation = 0;
+	unsigned int active = 0; // Workers inside the current job, under mutex
+	bool quit = false;
+};
@@ -0,0 +1,94 @@
+#include "triangle_batch.h"
+#include "triangle_rasterizer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+void TriangleBatch::Clear()
+{
+	triangles.clear();
+}
+
+void TriangleBatch::Add(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& c)
+{
+	Triangle t;
+	t.p[0] = p0;
+	t.p[1] = p1;
+	t.p[2] = p2;
+	t.color = c;
+	t.smooth = false;
+	triangles.push_back(t);
+}
+
+void TriangleBatch::Add(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& c0, const Color& c1, const Color& c2)
+{
+	Add(p0, p1, p2, c0);
+	Triangle& t = triangles.back();
+
+	// Gradients of the plane through the 3 values, a triangle with no area is never rasterized
+	float x1 = p1.x - p0.x, y1 = p1.y - p0.y;
+	float x2 = p2.x - p0.x, y2 = p2.y - p0.y;
+	float det = x1 * y2 - x2 * y1;
+	if (det == 0.0f)
+		return;
+	t.smooth = true;
+	for (int i = 0; i < 3; ++i) {
+		float v1 = (float)c1.v[i] - c0.v[i], v2 = (float)c2.v[i] - c0.v[i];
+		t.c0[i] = c0.v[i];
+		t.dx[i] = (v1 * y2 - v2 * y1) / det;
+		t.dy[i] = (v2 * x1 - v1 * x2) / det;
+	}
+}
+
+void TriangleBatch::Bin(unsigned int width, unsigned int height)
+{
+	bins_x = (width + BIN_SIZE - 1) / BIN_SIZE;
+	bins_y = (height + BIN_SIZE - 1) / BIN_SIZE;
+	bins.resize((size_t)bins_x * bins_y);
+	for (size_t i = 0; i < bins.size(); ++i)
+		bins[i].clear();
+	used_bins.clear();
+	bounds_x0 = bounds_y0 = INT_MAX;
+	bounds_x1 = bounds_y1 = INT_MIN;
+
+	for (unsigned int i = 0; i < triangles.size(); ++i) {
+		// Box of the pixels the triangle can touch, clipped to the image
+		const Vector2* p = triangles[i].p;
+		// A NaN vertex gives no pixels, it would only be rasterized to nothing in every bin
+		if (std::isnan(p[0].x) || std::isnan(p[0].y) || std::isnan(p[1].x) || std::isnan(p[1].y) || std::isnan(p[2].x) || std::isnan(p[2].y))
+			continue;
+		float min_x = std::min(p[0].x, std::min(p[1].x, p[2].x)), max_x = std::max(p[0].x, std::max(p[1].x, p[2].x));
+		float min_y = std::min(p[0].y, std::min(p[1].y, p[2].y)), max_y = std::max(p[0].y, std::max(p[1].y, p[2].y));
+		int x0, y0, x1, y1;
+		TriangleRasterizer::GetPixelRange(min_x, max_x, width, x0, x1);
+		TriangleRasterizer::GetPixelRange(min_y, max_y, height, y0, y1);
+		x0 = std::max(x0, 0);
+		y0 = std::max(y0, 0);
+		x1 = std::min(x1, (int)width - 1);
+		y1 = std::min(y1, (int)height - 1);
+		if (x0 > x1 || y0 > y1)
+			continue;
+
+		bounds_x0 = std::min(bounds_x0, x0);
+		bounds_y0 = std::min(bounds_y0, y0);
+		bounds_x1 = std::max(bounds_x1, x1);
+		bounds_y1 = std::max(bounds_y1, y1);
+		for (int by = y0 / BIN_SIZE; by <= y1 / BIN_SIZE; ++by)
+			for (int bx = x0 / BIN_SIZE; bx <= x1 / BIN_SIZE; ++bx)
+				bins[(size_t)by * bins_x + bx].push_back(i);
+	}
+
+	for (unsigned int i = 0; i < bins.size(); ++i)
+		if (!bins[i].empty())
+			used_bins.push_back(i);
+}
+
+bool TriangleBatch::GetBounds(int& x0, int& y0, int& x1, int& y1) const
+{
+	x0 = bounds_x0;
+	y0 = bounds_y0;
+	x1 = bounds_x1;
+	y1 = bounds_y1;
+	return x0 <= x1 && y0 <= y1;
+}
@@ -0,0 +1,52 @@
+/*
+	+ This file defines the triangle batch, that draws thousands of triangles in one call on all the cores.
+	+ A front-end pass sorts the triangles into bins, squares of BIN_SIZE pixels of the image, keeping the order they were added.
+	+ Then the bins are rasterized in parallel, each one with its triangles clipped to it (see Image::DrawTriangles),
+	  so no two threads write the same pixel and the triangles of a bin are drawn in order.
+*/
+
+#pragma once
+
+#include <vector>
+#include "framework.h"
+
+class TriangleBatch
+{
+public:
+	// Same size as the tiles of Image, so a bin of a TILED image is one of its tiles
+	static const int BIN_SIZE = 64;
+
+	struct Triangle {
+		Vector2 p[3];
+		Color color;
+		// Smooth triangles interpolate the colors of the vertices, every channel is c0 + dx (x - p[0].x) + dy (y - p[0].y)
+		bool smooth;
+		float c0[3], dx[3], dy[3];
+	};
+
+	// Removes the triangles, the memory is kept for the next frame
+	void Clear();
+	// Adds a triangle of one color
+	void Add(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& c);
+	// Adds a triangle with a color per vertex, interpolated across it
+	void Add(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& c0, const Color& c1, const Color& c2);
+
+	unsigned int GetCount() const { return (unsigned int)triangles.size(); }
+	const Triangle& GetTriangle(unsigned int i) const { return triangles[i]; }
+
+	// Front-end pass: lists the triangles that touch each bin of an image of width x height, in the order they were added
+	void Bin(unsigned int width, unsigned int height);
+	unsigned int GetBinsX() const { return bins_x; }
+	const std::vector<unsigned int>& GetBin(unsigned int bin) const { return bins[bin]; }
+	// Bins with at least one triangle, the work of the parallel pass
+	const std::vector<unsigned int>& GetUsedBins() const { return used_bins; }
+	// Pixels touched by the binned triangles, false when there are none
+	bool GetBounds(int& x0, int& y0, int& x1, int& y1) const;
+
+private:
+	std::vector<Triangle> triangles;
+	std::vector<std::vector<unsigned int>> bins;
+	std::vector<unsigned int> used_bins;
+	unsigned int bins_x = 0, bins_y = 0;
+	int bounds_x0 = 0, bounds_y0 = 0, bounds_x1 = -1, bounds_y1 = -1;
+};
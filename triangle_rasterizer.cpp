@@ -0,0 +1,103 @@
+#include "triangle_rasterizer.h"
+
+#include <cmath>
+
+// Vertices further than this many pixels are clamped, so the edge functions fit in 64 bits
+#define MAX_COORD 1048576.0f
+
+static int64_t Snap(float v)
+{
+	if (!(v > -MAX_COORD))
+		v = -MAX_COORD;
+	else if (v > MAX_COORD)
+		v = MAX_COORD;
+	return (int64_t)std::floor(v * (1 << TriangleRasterizer::SUBPIXEL_BITS) + 0.5f);
+}
+
+void TriangleRasterizer::GetPixelRange(float min_v, float max_v, unsigned int size, int& first, int& last)
+{
+	// NaN fails both comparisons and gives the widest range, the rasterizer drops such triangles anyway
+	float limit = (float)size;
+	min_v = min_v > -1.0f ? std::min(min_v, limit) : -1.0f;
+	max_v = max_v < limit ? std::max(max_v, -1.0f) : limit;
+	first = (int)std::floor(min_v);
+	last = (int)std::ceil(max_v);
+}
+
+// Divisions rounding down and up, d > 0
+static int64_t FloorDiv(int64_t n, int64_t d) { return n >= 0 ? n / d : -((-n + d - 1) / d); }
+static int64_t CeilDiv(int64_t n, int64_t d) { return n >= 0 ? (n + d - 1) / d : -((-n) / d); }
+
+void TriangleRasterizer::FloorStepper::Init(int64_t n0, int64_t d, int64_t step)
+{
+	this->d = d;
+	q = FloorDiv(n0, d);
+	r = n0 - q * d;
+	step_q = FloorDiv(step, d);
+	step_r = step - step_q * d;
+}
+
+bool TriangleRasterizer::Setup(const Vector2& p0, const Vector2& p1, const Vector2& p2, int min_x, int min_y, int max_x, int max_y)
+{
+	// A NaN vertex has no position, Snap would move it to a corner far away
+	if (std::isnan(p0.x) || std::isnan(p0.y) || std::isnan(p1.x) || std::isnan(p1.y) || std::isnan(p2.x) || std::isnan(p2.y))
+		return false;
+
+	int64_t x[3] = { Snap(p0.x), Snap(p1.x), Snap(p2.x) };
+	int64_t y[3] = { Snap(p0.y), Snap(p1.y), Snap(p2.y) };
+
+	// Counter-clockwise, so the inside is on the left of every edge
+	int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (area == 0)
+		return false;
+	if (area < 0) {
+		std::swap(x[1], x[2]);
+		std::swap(y[1], y[2]);
+	}
+
+	// Pixels whose center is inside the box of the vertices, clipped
+	const int64_t one = 1 << SUBPIXEL_BITS;
+	int64_t rows_lo = std::max<int64_t>(min_y, CeilDiv(std::min(y[0], std::min(y[1], y[2])), one));
+	int64_t rows_hi = std::min<int64_t>(max_y, FloorDiv(std::max(y[0], std::max(y[1], y[2])), one));
+	int64_t cols_lo = std::max<int64_t>(min_x, CeilDiv(std::min(x[0], std::min(x[1], x[2])), one));
+	int64_t cols_hi = std::min<int64_t>(max_x, FloorDiv(std::max(x[0], std::max(x[1], x[2])), one));
+	if (cols_lo > cols_hi || rows_lo > rows_hi)
+		return false;
+
+	int64_t a[3], b[3], c[3];
+	for (int k = 0; k < 3; ++k) {
+		int next = (k + 1) % 3;
+		int64_t dx = x[next] - x[k], dy = y[next] - y[k];
+		a[k] = -dy * one;
+		b[k] = dx * one;
+		c[k] = dy * x[k] - dx * y[k];
+		// Going counter-clockwise with y up, the left edges go down and the top edge goes left
+		bool top_left = dy < 0 || (dy == 0 && dx < 0);
+		if (!top_left)
+			c[k] -= 1;
+
+		// A horizontal edge is b y + c >= 0 on its own
+		if (a[k] == 0) {
+			if (b[k] > 0)
+				rows_lo = std::max(rows_lo, CeilDiv(-c[k], b[k]));
+			else
+				rows_hi = std::min(rows_hi, FloorDiv(c[k], -b[k]));
+		}
+	}
+	if (rows_lo > rows_hi)
+		return false;
+
+	x_begin = (int)cols_lo;
+	x_end = (int)cols_hi;
+	y_begin = (int)rows_lo;
+	y_end = (int)rows_hi;
+	left_count = right_count = 0;
+	for (int k = 0; k < 3; ++k) {
+		int64_t n0 = b[k] * y_begin + c[k];
+		if (a[k] > 0)
+			left[left_count++].Init(n0, a[k], b[k]);
+		else if (a[k] < 0)
+			right[right_count++].Init(n0, -a[k], b[k]);
+	}
+	return true;
+}
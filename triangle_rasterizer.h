@@ -0,0 +1,86 @@
+/*
+	+ This file defines the triangle rasterizer, that fills triangles with fixed-point edge functions.
+	+ The vertices are snapped to 1/16 of a pixel and a pixel is inside when its center is. Centers right on an edge
+	  follow the top-left rule, so triangles that share an edge never write a pixel twice nor leave a gap between them.
+	+ A row of a triangle has no holes, so instead of testing pixels every edge gives the first or last pixel of each row,
+	  stepped from one row to the next with an exact integer quotient and remainder, without divisions.
+	+ The bounding box is clipped before anything else and nothing is allocated, the setup is a few multiplications.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include "framework.h"
+
+class TriangleRasterizer
+{
+public:
+	static const int SUBPIXEL_BITS = 4;
+
+	// Calls span(int x, int y, int count) once for every row of the triangle that has pixels inside
+	// [min_x, max_x] x [min_y, max_y]. Pixel centers are at integer coordinates, any winding is fine.
+	template <typename F>
+	static void Rasterize(const Vector2& p0, const Vector2& p1, const Vector2& p2, int min_x, int min_y, int max_x, int max_y, F span)
+	{
+		TriangleRasterizer triangle;
+		if (!triangle.Setup(p0, p1, p2, min_x, min_y, max_x, max_y))
+			return;
+
+		for (int y = triangle.y_begin; y <= triangle.y_end; ++y) {
+			int first, last;
+			if (triangle.NextRow(first, last))
+				span(first, y, last - first + 1);
+		}
+	}
+
+	// Columns or rows [first, last] that a box from min_v to max_v can touch, at most one pixel around [0, size - 1].
+	// Coordinates far off the image or NaN are clamped before they go to int, where they would overflow.
+	static void GetPixelRange(float min_v, float max_v, unsigned int size, int& first, int& last);
+
+private:
+	// floor(n / d) for n = n0, n0 + step, n0 + 2 step... as quotient and remainder, d > 0
+	struct FloorStepper {
+		int64_t q, r, d, step_q, step_r;
+
+		void Init(int64_t n0, int64_t d, int64_t step);
+		void Next()
+		{
+			q += step_q;
+			r += step_r;
+			if (r >= d) {
+				r -= d;
+				q++;
+			}
+		}
+	};
+
+	// The edge functions are E(x, y) = a x + b y + c at the center of pixel x,y, and a pixel is inside when
+	// E >= 0 for the three edges. Edges with a > 0 bound the rows on the left, at x >= -floor((b y + c) / a),
+	// the ones with a < 0 on the right, at x <= floor((b y + c) / -a), and horizontal ones only limit the rows.
+	FloorStepper left[2], right[2];
+	int left_count = 0, right_count = 0;
+	int x_begin, x_end, y_begin, y_end; // Bounding box of the pixels, already clipped
+
+	// Returns false when the triangle has no area or no pixel in the clip rectangle
+	bool Setup(const Vector2& p0, const Vector2& p1, const Vector2& p2, int min_x, int min_y, int max_x, int max_y);
+
+	// First and last column of the next row, false when it is empty
+	bool NextRow(int& first, int& last)
+	{
+		int64_t lo = x_begin, hi = x_end;
+		for (int i = 0; i < left_count; ++i) {
+			lo = std::max(lo, -left[i].q);
+			left[i].Next();
+		}
+		for (int i = 0; i < right_count; ++i) {
+			hi = std::min(hi, right[i].q);
+			right[i].Next();
+		}
+		if (lo > hi)
+			return false;
+		first = (int)lo;
+		last = (int)hi;
+		return true;
+	}
+};
@@ -26,6 +26,8 @@
 #include "main/includes.h"
 #include "application.h"
 #include "image.h"
+#include "render_thread.h"
+#include "input_queue.h"
 
 std::string absResPath( const std::string& p_sFile )
 {
@@ -138,39 +140,66 @@ SDL_Window* createWindow(const char* caption, int width, int height )
 	return window;
 }
 
-// The application main loop
-void launchLoop(Application* app)
+// The simulation thread runs Update, Render and the handlers of the events that launchLoop reads,
+// then hands the frames to the render thread, so neither the input nor the presenting wait for the drawing.
+static void simulationLoop(Application* app, RenderThread& render_thread, InputQueue& input, double frame_interval)
 {
-	SDL_Event sdlEvent;
-	Uint32 last_time = SDL_GetTicks();
-	int x,y;
+	FrameTimer& timer = app->frame_timer;
+	std::vector<SDL_Event> events;
+	InputQueue::State state;
+	app->keystate = state.keys;
 
-	SDL_GetMouseState(&x,&y);
-	app->mouse_position.set(static_cast<float>(x), static_cast<float>(y));
+	double start_time = FrameTimer::Now();
+	double last_time = start_time;
+	double events_time = 0; // Of all the passes since the last frame
+	bool redraw = true; // The window needs a frame even if nothing changed
+	Image hud; // The pixels under the frame timer overlay, with the overlay on them
 
-	Uint32 start_time = SDL_GetTicks();
+	// Frames that present nothing are paced at the refresh rate, as the swaps of the old loop did
+	double next_frame = start_time;
 
 	// Infinite loop
 	while (1)
 	{
-		// Read keyboard state and stored in keystate
-		app->keystate = SDL_GetKeyboardState(NULL);
-
-		// Clear the window and the depth buffer
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		// Render frame
-		app->Render();
-
-		// Swap between front buffer and back buffer
-		SDL_GL_SwapWindow(app->window);
+		// Render and Update run once per frame, when the render thread has room for it and, after a frame that
+		// presented nothing, one refresh interval later. In between the thread sleeps until input arrives.
+		double now = FrameTimer::Now();
+		bool slot_free = render_thread.GetFramesInFlight() < RenderThread::MAX_FRAMES_IN_FLIGHT;
+		bool new_frame = slot_free && now >= next_frame;
+		bool submitted = false;
+		double render_time = 0;
+		if (new_frame) {
+			app->Render();
+			render_time = FrameTimer::Now() - now;
+
+			if (timer.show_hud) {
+				// Only the area under the overlay is copied, the presenter draws it over the frame
+				int hud_x, hud_y;
+				FrameTimer::GetHUDPosition(app->framebuffer, hud_x, hud_y);
+				hud_x = std::max(hud_x, 0);
+				hud_y = std::max(hud_y, 0);
+				hud = app->framebuffer.GetArea(hud_x, hud_y, FrameTimer::HUD_WIDTH, FrameTimer::HUD_HEIGHT);
+				timer.DrawHUD(hud, 0, 0);
+				submitted = render_thread.SubmitFrame(app->framebuffer, &hud, hud_x, hud_y);
+			}
+			else if (app->framebuffer.IsDirty() || redraw)
+				submitted = render_thread.SubmitFrame(app->framebuffer);
+			redraw = redraw && !submitted;
+			// Presented frames are paced by the swaps of the render thread, through the slots
+			next_frame = submitted ? now : now + frame_interval;
+		}
+		else // The frame event of the render thread comes through the queue when a slot is free
+			input.Wait(slot_free ? next_frame - now : -1.0);
 
 		// Update events
-		while(SDL_PollEvent(&sdlEvent))
+		double events_start = FrameTimer::Now();
+		input.Pop(events, state);
+		for (const SDL_Event& sdlEvent : events)
 		{
 			switch(sdlEvent.type)
 				{
-					case SDL_QUIT: return; break; // EVENT for when the user clicks the [x] in the corner
+					case SDL_QUIT: // EVENT for when the user clicks the [x] in the corner
+						return;
 					case SDL_MOUSEBUTTONDOWN: // EXAMPLE OF sync mouse input
 						app->OnMouseButtonDown(sdlEvent.button);
 						break;
@@ -191,37 +220,95 @@ void launchLoop(Application* app)
 							case SDL_WINDOWEVENT_RESIZED: // Resize OpenGL context
 								std::cout << "window resize" << std::endl;
 								app->SetWindowSize( sdlEvent.window.data1, sdlEvent.window.data2 );
+								render_thread.Resize( sdlEvent.window.data1, sdlEvent.window.data2 );
+								redraw = true;
+								break;
+							case SDL_WINDOWEVENT_EXPOSED:
+								redraw = true;
 								break;
 						}
 						break;
 #ifdef WIN32
 					case CDirectoryWatcher::WM_FILE_CHANGED:
 						const char* filename = (const char*)(dir_watcher_data.file_name);
-						app->OnFileChanged(filename);
+						render_thread.ReloadShader(filename); // Shaders live in the GL context
 						break;
 #endif
 				}
 		}
 
 		// Get mouse position and delta
-		app->mouse_state = SDL_GetMouseState(&x,&y);
+		int x = state.mouse_x, y = state.mouse_y;
+		app->mouse_state = state.mouse_buttons;
 		app->mouse_delta.set( app->mouse_position.x - x, app->window_height - app->mouse_position.y - y );
 		app->mouse_position.set(static_cast<float>(x), static_cast<float>(app->window_height - y));
+		events_time += FrameTimer::Now() - events_start;
 
 		// Update logic
-		Uint32 now = SDL_GetTicks();
-		float elapsed_time = (now - last_time) * 0.001f; // 0.001 converts from milliseconds to seconds
-		app->time = (now - start_time) * 0.001f;
-		app->Update(elapsed_time);
-		last_time = now;
-
-		// Check errors in opengl only when working in debug
-		#ifdef _DEBUG
-			checkGLErrors();
-		#endif
+		if (new_frame) {
+			double update_start = FrameTimer::Now();
+			float elapsed_time = (float)(update_start - last_time);
+			app->time = (float)(update_start - start_time);
+			app->Update(elapsed_time);
+			last_time = update_start;
+
+			// Only the frames that reach the screen are measured
+			if (submitted) {
+				timer.Record(FrameTimer::RENDER, render_time);
+				timer.Record(FrameTimer::UPDATE, FrameTimer::Now() - update_start);
+				timer.Record(FrameTimer::EVENTS, events_time);
+				timer.EndFrame();
+			}
+			else
+				timer.SkipFrame();
+			events_time = 0;
+		}
+	}
+}
+
+// The application main loop. This thread only reads the events, SDL needs them on the thread of the window.
+// The simulation thread handles them and draws, the render thread presents.
+void launchLoop(Application* app)
+{
+	std::vector<SDL_Event> events;
+	InputQueue input;
+	InputQueue::State state;
+
+	// Initial state, the simulation thread starts from it
+	state.mouse_buttons = SDL_GetMouseState(&state.mouse_x, &state.mouse_y);
+	app->mouse_position.set(static_cast<float>(state.mouse_x), static_cast<float>(app->window_height - state.mouse_y));
+	input.Push(NULL, 0, state);
+
+	SDL_DisplayMode mode;
+	int refresh_rate = SDL_GetWindowDisplayMode(app->window, &mode) == 0 && mode.refresh_rate > 0 ? mode.refresh_rate : 60;
+
+	RenderThread render_thread;
+	render_thread.Start(app);
+	std::thread simulation(simulationLoop, app, std::ref(render_thread), std::ref(input), 1.0 / refresh_rate);
+
+	bool quit = false;
+	while (!quit)
+	{
+		// Sleep until there is input, then take everything that is waiting
+		SDL_Event sdlEvent;
+		if (!SDL_WaitEvent(&sdlEvent))
+			continue;
+		events.clear();
+		do {
+			events.push_back(sdlEvent);
+			quit = quit || sdlEvent.type == SDL_QUIT;
+		} while (SDL_PollEvent(&sdlEvent));
+
+		int num_keys = 0;
+		const Uint8* keys = SDL_GetKeyboardState(&num_keys);
+		memcpy(state.keys, keys, std::min(num_keys, (int)SDL_NUM_SCANCODES));
+		state.mouse_buttons = SDL_GetMouseState(&state.mouse_x, &state.mouse_y);
+		input.Push(events.data(), (unsigned int)events.size(), state);
 	}
 
-	return;
+	// The simulation thread stops at the SDL_QUIT, only then this thread may send to the render thread
+	simulation.join();
+	render_thread.Stop();
 }
 
 std::vector<std::string> tokenize(const std::string& source, const char* delimiters, bool process_strings)